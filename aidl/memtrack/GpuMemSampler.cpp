@@ -0,0 +1,203 @@
+#include "GpuMemSampler.h"
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <log/log.h>
+#include <pthread.h>
+
+#include <algorithm>
+#include <map>
+
+#undef LOG_TAG
+#define LOG_TAG "memtrack-gpumemsampler"
+
+using ::android::base::StringPrintf;
+using ::android::base::WriteStringToFd;
+
+namespace GpuSysfsReader {
+
+namespace {
+int64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+}
+
+uint64_t percentile(const std::vector<uint64_t>& sorted, int pct) {
+    return sorted[(sorted.size() - 1) * pct / 100];
+}
+} // namespace
+
+GpuMemSampler::GpuMemSampler(std::chrono::milliseconds period, GpuMemSnapshot* snapshot)
+    : mPeriod(period), mSnapshot(snapshot) {
+    mThread = std::thread(&GpuMemSampler::run, this);
+}
+
+GpuMemSampler::~GpuMemSampler() {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mStop = true;
+    }
+    mCond.notify_all();
+    mThread.join();
+}
+
+void GpuMemSampler::run() {
+    pthread_setname_np(pthread_self(), "GpuMemSampler");
+
+    std::unique_lock<std::mutex> lock(mLock);
+    while (!mStop) {
+        lock.unlock();
+
+        // The snapshot is refreshed without its lock, so getMemory() is
+        // served the previous snapshot while this walks sysfs.
+        mSnapshot->read(&mRecords);
+        push(nowMs());
+
+        lock.lock();
+        mCond.wait_for(lock, mPeriod, [this] { return mStop; });
+    }
+}
+
+void GpuMemSampler::push(int64_t timestampMs) {
+    // mRecords is sorted by pid, with the global nodes first
+    if (mRecords.empty() || mRecords.front().pid != 0)
+        return;
+    const GpuMemRecord global = mRecords.front();
+
+    const size_t processCount = mRecords.size() - 1;
+    const size_t topCount = std::min(processCount, kTopProcesses);
+    std::partial_sort(mRecords.begin() + 1, mRecords.begin() + 1 + topCount, mRecords.end(),
+                      [](const GpuMemRecord& a, const GpuMemRecord& b) {
+                          return a.totalGpuMem > b.totalGpuMem;
+                      });
+    bool hasDmaBufPss = false;
+    for (size_t i = 1; i <= topCount; i++)
+        hasDmaBufPss |= mRecords[i].hasDmaBufPss;
+
+    const uint64_t head = mHead.load(std::memory_order_relaxed);
+    Slot& slot = mSlots[head % kCapacity];
+
+    const uint64_t seq = slot.seq.load(std::memory_order_relaxed);
+    slot.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.timestampMs.store(timestampMs, std::memory_order_relaxed);
+    slot.totalGpuMem.store(global.totalGpuMem, std::memory_order_relaxed);
+    slot.dmaBufGpuMem.store(global.dmaBufGpuMem, std::memory_order_relaxed);
+    slot.processCount.store(processCount, std::memory_order_relaxed);
+    slot.hasDmaBufPss.store(hasDmaBufPss, std::memory_order_relaxed);
+    slot.topCount.store(topCount, std::memory_order_relaxed);
+    for (size_t i = 0; i < topCount; i++) {
+        const GpuMemRecord& record = mRecords[i + 1];
+        slot.top[i].pid.store(record.pid, std::memory_order_relaxed);
+        slot.top[i].totalGpuMem.store(record.totalGpuMem, std::memory_order_relaxed);
+        slot.top[i].dmaBufGpuMem.store(record.dmaBufGpuMem, std::memory_order_relaxed);
+        slot.top[i].dmaBufPss.store(record.dmaBufPss, std::memory_order_relaxed);
+    }
+
+    slot.seq.store(seq + 2, std::memory_order_release);
+    mHead.store(head + 1, std::memory_order_release);
+}
+
+void GpuMemSampler::read(std::vector<Sample>* out) const {
+    out->clear();
+
+    const uint64_t head = mHead.load(std::memory_order_acquire);
+    const uint64_t start = head > kCapacity ? head - kCapacity : 0;
+    out->reserve(head - start);
+
+    for (uint64_t i = start; i < head; i++) {
+        const Slot& slot = mSlots[i % kCapacity];
+        // Sample i is the (i / kCapacity + 1)th write to its slot
+        const uint64_t expected = 2 * (i / kCapacity + 1);
+
+        if (slot.seq.load(std::memory_order_acquire) != expected)
+            continue;
+
+        Sample sample = {
+                .timestampMs = slot.timestampMs.load(std::memory_order_relaxed),
+                .totalGpuMem = slot.totalGpuMem.load(std::memory_order_relaxed),
+                .dmaBufGpuMem = slot.dmaBufGpuMem.load(std::memory_order_relaxed),
+                .processCount = slot.processCount.load(std::memory_order_relaxed),
+                .hasDmaBufPss = slot.hasDmaBufPss.load(std::memory_order_relaxed),
+                .topCount = std::min<uint32_t>(slot.topCount.load(std::memory_order_relaxed),
+                                               kTopProcesses),
+        };
+        for (uint32_t j = 0; j < sample.topCount; j++) {
+            sample.top[j] = {
+                    .pid = slot.top[j].pid.load(std::memory_order_relaxed),
+                    .totalGpuMem = slot.top[j].totalGpuMem.load(std::memory_order_relaxed),
+                    .dmaBufGpuMem = slot.top[j].dmaBufGpuMem.load(std::memory_order_relaxed),
+                    .dmaBufPss = slot.top[j].dmaBufPss.load(std::memory_order_relaxed),
+            };
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) != expected)
+            continue;
+
+        out->push_back(sample);
+    }
+}
+
+void GpuMemSampler::dump(int fd, bool csv) const {
+    std::vector<Sample> samples;
+    read(&samples);
+
+    std::string out;
+    if (csv) {
+        // One row for the global nodes (pid 0) and one per top process of
+        // every period. dma_buf_pss is left empty when the kernel has no
+        // dma_bufs/ nodes.
+        out.append("timestamp_ms,pid,total_gpu_mem,dma_buf_gpu_mem,dma_buf_pss\n");
+        for (const Sample& s : samples) {
+            out.append(StringPrintf("%" PRId64 ",0,%" PRIu64 ",%" PRIu64 ",\n", s.timestampMs,
+                                    s.totalGpuMem, s.dmaBufGpuMem));
+            for (uint32_t i = 0; i < s.topCount; i++) {
+                const ProcessSample& p = s.top[i];
+                out.append(StringPrintf("%" PRId64 ",%d,%" PRIu64 ",%" PRIu64 ",", s.timestampMs,
+                                        p.pid, p.totalGpuMem, p.dmaBufGpuMem));
+                out.append(s.hasDmaBufPss ? StringPrintf("%" PRIu64 "\n", p.dmaBufPss) : "\n");
+            }
+        }
+        WriteStringToFd(out, fd);
+        return;
+    }
+
+    std::map<pid_t, std::pair<std::vector<uint64_t>, std::vector<uint64_t>>> values;
+    uint32_t maxProcesses = 0;
+    for (const Sample& s : samples) {
+        values[0].first.push_back(s.totalGpuMem);
+        maxProcesses = std::max(maxProcesses, s.processCount);
+        for (uint32_t i = 0; i < s.topCount; i++) {
+            auto& [totals, pss] = values[s.top[i].pid];
+            totals.push_back(s.top[i].totalGpuMem);
+            if (s.hasDmaBufPss)
+                pss.push_back(s.top[i].dmaBufPss);
+        }
+    }
+
+    auto stats = [](std::vector<uint64_t>* v) {
+        if (v->empty())
+            return std::string("-  -  -  -");
+        std::sort(v->begin(), v->end());
+        return StringPrintf("%" PRIu64 "  %" PRIu64 "  %" PRIu64 "  %" PRIu64, v->front(),
+                            v->back(), percentile(*v, 50), percentile(*v, 95));
+    };
+
+    out.append(StringPrintf("GPU memory samples: %zu, period: %lld ms, processes: up to %u,"
+                            " top %zu per sample\n",
+                            samples.size(), static_cast<long long>(mPeriod.count()),
+                            maxProcesses, kTopProcesses));
+    out.append("pid (0 = global)  samples  min  max  p50  p95 (total_gpu_mem, bytes)"
+               "  min  max  p50  p95 (dma_buf_pss, bytes)\n");
+    for (auto& [pid, v] : values) {
+        auto& [totals, pss] = v;
+        out.append(StringPrintf("%d  %zu  %s  %s\n", pid, totals.size(), stats(&totals).c_str(),
+                                stats(&pss).c_str()));
+    }
+    WriteStringToFd(out, fd);
+}
+
+} // namespace GpuSysfsReader
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <inttypes.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "GpuMemSnapshot.h"
+
+namespace GpuSysfsReader {
+
+// Periodically records the global (pid 0) GPU memory and that of the
+// largest processes into a fixed-size ring so that usage over time can be
+// dumped without tracing. Samples are read from the service's snapshot, so a
+// sample refreshes it for getMemory() and a sample taken within its window
+// costs no sysfs walk.
+//
+// Every slot holds one period, whatever the number of processes, so the
+// ring always covers kCapacity periods. Only the kTopProcesses processes
+// with the most GPU memory are kept per period; the others are counted.
+//
+// The sampler thread is the only writer. Every slot is guarded by its own
+// sequence counter, so readers copy the ring without blocking the sampler
+// and simply skip slots that are being overwritten.
+class GpuMemSampler {
+public:
+    static constexpr size_t kCapacity = 1024;
+    static constexpr size_t kTopProcesses = 8;
+
+    struct ProcessSample {
+        pid_t pid;
+        uint64_t totalGpuMem;
+        uint64_t dmaBufGpuMem;
+        uint64_t dmaBufPss;
+    };
+
+    struct Sample {
+        int64_t timestampMs;
+        uint64_t totalGpuMem; // global nodes
+        uint64_t dmaBufGpuMem;
+        uint32_t processCount;
+        bool hasDmaBufPss;
+        uint32_t topCount;
+        ProcessSample top[kTopProcesses]; // by total_gpu_mem, largest first
+    };
+
+    // snapshot must outlive the sampler
+    GpuMemSampler(std::chrono::milliseconds period, GpuMemSnapshot* snapshot);
+    ~GpuMemSampler();
+
+    // Copies the periods currently in the ring, oldest first
+    void read(std::vector<Sample>* out) const;
+
+    // Writes min/max/p50/p95 of the total GPU memory and of the dma-buf PSS
+    // per pid, or the raw samples as CSV if csv is set. Per-pid statistics
+    // cover the periods in which the pid was among the largest processes.
+    void dump(int fd, bool csv) const;
+
+private:
+    struct ProcessSlot {
+        std::atomic<int32_t> pid{0};
+        std::atomic<uint64_t> totalGpuMem{0};
+        std::atomic<uint64_t> dmaBufGpuMem{0};
+        std::atomic<uint64_t> dmaBufPss{0};
+    };
+
+    struct Slot {
+        std::atomic<uint64_t> seq{0}; // odd while the slot is being written
+        std::atomic<int64_t> timestampMs{0};
+        std::atomic<uint64_t> totalGpuMem{0};
+        std::atomic<uint64_t> dmaBufGpuMem{0};
+        std::atomic<uint32_t> processCount{0};
+        std::atomic<bool> hasDmaBufPss{false};
+        std::atomic<uint32_t> topCount{0};
+        ProcessSlot top[kTopProcesses];
+    };
+
+    void run();
+    void push(int64_t timestampMs);
+
+    const std::chrono::milliseconds mPeriod;
+    GpuMemSnapshot* const mSnapshot;
+    std::vector<GpuMemRecord> mRecords; // sampler thread only
+    Slot mSlots[kCapacity];
+    std::atomic<uint64_t> mHead{0}; // number of periods ever written
+
+    std::mutex mLock;
+    std::condition_variable mCond;
+    bool mStop = false; // protected by mLock
+    std::thread mThread;
+};
+
+} // namespace GpuSysfsReader
@@ -0,0 +1,269 @@
+#include "GpuMemSnapshot.h"
+
+#include <fcntl.h>
+#include <log/log.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "GpuSysfsReader.h"
+#include "filesystem.h"
+
+#undef LOG_TAG
+#define LOG_TAG "memtrack-gpumemsnapshot"
+
+namespace GpuSysfsReader {
+
+namespace {
+uint64_t readNodeAt(int dirfd, const char* relPath) {
+    int fd = openat(dirfd, relPath, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return 0;
+
+    char buf[32];
+    ssize_t ret = TEMP_FAILURE_RETRY(pread(fd, buf, sizeof(buf) - 1, 0));
+    close(fd);
+    if (ret <= 0)
+        return 0;
+
+    buf[ret] = '\0';
+    return strtoull(buf, nullptr, 10);
+}
+
+bool parseNumber(const char* name, uint64_t* out) {
+    char* end;
+    unsigned long long val = strtoull(name, &end, 10);
+    if (!*name || *end != '\0')
+        return false;
+
+    *out = val;
+    return true;
+}
+
+bool parsePid(const char* name, pid_t* pid) {
+    uint64_t val;
+    if (!parseNumber(name, &val) || val == 0 || val > INT32_MAX)
+        return false;
+
+    *pid = static_cast<pid_t>(val);
+    return true;
+}
+
+size_t hashInode(uint64_t inode) {
+    uint64_t h = inode * 0x9e3779b97f4a7c15ULL;
+    return static_cast<size_t>(h ^ (h >> 32));
+}
+} // namespace
+
+uint64_t GpuMemRecord::privateGpuMem() const {
+    if (dmaBufGpuMem > totalGpuMem) {
+        ALOGE("Bug in reader, dma-buf size (%" PRIu64 ") is higher than total gpu size (%" PRIu64
+              ")",
+              dmaBufGpuMem, totalGpuMem);
+        return 0;
+    }
+
+    return totalGpuMem - dmaBufGpuMem;
+}
+
+bool GpuMemSnapshot::lookup(pid_t pid, GpuMemRecord* out) {
+    if (mWindow.count() <= 0)
+        return false;
+
+    std::shared_ptr<const Snapshot> snapshot = acquire();
+    const std::vector<GpuMemRecord>& records = snapshot->records;
+
+    auto it = std::lower_bound(records.begin(), records.end(), pid,
+                               [](const GpuMemRecord& r, pid_t p) { return r.pid < p; });
+    if (it != records.end() && it->pid == pid)
+        *out = *it;
+    else
+        *out = {.pid = pid,
+                .totalGpuMem = 0,
+                .dmaBufGpuMem = 0,
+                .dmaBufPss = 0,
+                .hasDmaBufPss = snapshot->hasDmaBufs};
+
+    return true;
+}
+
+void GpuMemSnapshot::read(std::vector<GpuMemRecord>* out) {
+    std::shared_ptr<const Snapshot> snapshot = acquire();
+    out->assign(snapshot->records.begin(), snapshot->records.end());
+}
+
+std::shared_ptr<const GpuMemSnapshot::Snapshot> GpuMemSnapshot::current() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mCurrent;
+}
+
+bool GpuMemSnapshot::isFresh(const Snapshot* snapshot) const {
+    return snapshot && std::chrono::steady_clock::now() - snapshot->timestamp < mWindow;
+}
+
+std::shared_ptr<const GpuMemSnapshot::Snapshot> GpuMemSnapshot::acquire() {
+    std::shared_ptr<const Snapshot> snapshot = current();
+    if (isFresh(snapshot.get()))
+        return snapshot;
+
+    std::unique_lock<std::mutex> refresh(mRefreshLock, std::try_to_lock);
+    if (!refresh.owns_lock()) {
+        // The refresh in progress is at most one walk newer than the
+        // snapshot we have, which is not worth waiting for.
+        if (snapshot)
+            return snapshot;
+        refresh.lock();
+    }
+
+    // Another thread may have published a snapshot since
+    snapshot = current();
+    if (isFresh(snapshot.get()))
+        return snapshot;
+
+    refreshLocked();
+    return current();
+}
+
+// kprcs/<pid>/dma_bufs/ holds one node per dma-buf mapped into the GPU
+// context of the process. Each node is named after the inode number of the
+// buffer and reads back its size in bytes.
+void GpuMemSnapshot::readMappedDmaBufsLocked(int procFd, const filesystem::path& procDir,
+                                             GpuMemRecord* record) {
+    char pidStr[16];
+    snprintf(pidStr, sizeof(pidStr), "%d", record->pid);
+    filesystem::path dir = procDir / pidStr / kMappedDmaBufsDir;
+
+    char relPath[96];
+    for (auto& entry : filesystem::directory_iterator(dir)) {
+        uint64_t inode;
+        const filesystem::path name = entry.path().filename();
+        if (!parseNumber(name.c_str(), &inode) || inode == 0)
+            continue;
+
+        record->hasDmaBufPss = true;
+        mMappings.emplace_back(record->pid, inode);
+
+        bool inserted;
+        DmaBufInfo* info = findOrInsertDmaBufLocked(inode, &inserted);
+        if (inserted) {
+            snprintf(relPath, sizeof(relPath), "%s/%s/%s", pidStr, kMappedDmaBufsDir,
+                     name.c_str());
+            info->size = readNodeAt(procFd, relPath);
+        }
+        info->mapCount++;
+    }
+}
+
+GpuMemSnapshot::DmaBufInfo* GpuMemSnapshot::findOrInsertDmaBufLocked(uint64_t inode,
+                                                                     bool* inserted) {
+    // Keep the load factor at or below 1/2
+    if ((mDmaBufCount + 1) * 2 > mDmaBufs.size()) {
+        std::vector<DmaBufInfo> old;
+        old.swap(mDmaBufs);
+        mDmaBufs.assign(std::max<size_t>(64, old.size() * 2), DmaBufInfo{});
+        mDmaBufCount = 0;
+        for (const DmaBufInfo& info : old) {
+            if (!info.inode)
+                continue;
+            bool unused;
+            *findOrInsertDmaBufLocked(info.inode, &unused) = info;
+        }
+    }
+
+    DmaBufInfo* info = findDmaBufLocked(inode);
+    *inserted = !info->inode;
+    if (*inserted) {
+        *info = {.inode = inode, .size = 0, .mapCount = 0};
+        mDmaBufCount++;
+    }
+
+    return info;
+}
+
+// Returns the slot holding inode, or the empty slot where it belongs
+GpuMemSnapshot::DmaBufInfo* GpuMemSnapshot::findDmaBufLocked(uint64_t inode) {
+    const size_t mask = mDmaBufs.size() - 1;
+    for (size_t i = hashInode(inode) & mask;; i = (i + 1) & mask) {
+        DmaBufInfo& info = mDmaBufs[i];
+        if (info.inode == inode || !info.inode)
+            return &info;
+    }
+}
+
+void GpuMemSnapshot::computeDmaBufPssLocked(std::vector<GpuMemRecord>* records) {
+    // records is sorted and mMappings is grouped by pid in the same order.
+    auto record = records->begin();
+    for (const auto& [pid, inode] : mMappings) {
+        while (record != records->end() && record->pid < pid)
+            ++record;
+        if (record == records->end())
+            break;
+
+        const DmaBufInfo* info = findDmaBufLocked(inode);
+        record->dmaBufPss += info->size / info->mapCount;
+    }
+}
+
+void GpuMemSnapshot::refreshLocked() {
+    if (!mSpare || mSpare.use_count() > 1)
+        mSpare = std::make_shared<Snapshot>();
+
+    std::vector<GpuMemRecord>& records = mSpare->records;
+    records.clear();
+    std::fill(mDmaBufs.begin(), mDmaBufs.end(), DmaBufInfo{});
+    mDmaBufCount = 0;
+    mMappings.clear();
+
+    // The global nodes are read through the node cache of GpuSysfsReader.
+    // Per-pid nodes are opened relative to kprcs/ and closed right away: a
+    // refresh visits every process, which would only flush the cache.
+    records.push_back({.pid = 0,
+                       .totalGpuMem = getGpuMemTotal(0),
+                       .dmaBufGpuMem = getDmaBufGpuMem(0),
+                       .dmaBufPss = 0,
+                       .hasDmaBufPss = false});
+
+    const filesystem::path procDir = filesystem::path(getSysfsDevicePath()) / kProcessDir;
+    int procFd = open(procDir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (procFd >= 0) {
+        for (auto& entry : filesystem::directory_iterator(procDir)) {
+            pid_t pid;
+            if (!parsePid(entry.path().filename().c_str(), &pid))
+                continue;
+
+            char relPath[64];
+            snprintf(relPath, sizeof(relPath), "%d/%s", pid, kTotalGpuMemNode);
+            const uint64_t totalGpuMem = readNodeAt(procFd, relPath);
+            snprintf(relPath, sizeof(relPath), "%d/%s", pid, kDmaBufGpuMemNode);
+            const uint64_t dmaBufGpuMem = readNodeAt(procFd, relPath);
+
+            GpuMemRecord record = {.pid = pid,
+                                   .totalGpuMem = totalGpuMem,
+                                   .dmaBufGpuMem = dmaBufGpuMem,
+                                   .dmaBufPss = 0,
+                                   .hasDmaBufPss = false};
+            readMappedDmaBufsLocked(procFd, procDir, &record);
+            records.push_back(record);
+        }
+        close(procFd);
+    }
+
+    std::sort(records.begin(), records.end(),
+              [](const GpuMemRecord& a, const GpuMemRecord& b) { return a.pid < b.pid; });
+    // Unlike std::stable_sort, std::sort needs no temporary buffer
+    std::sort(mMappings.begin(), mMappings.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+    computeDmaBufPssLocked(&records);
+
+    mSpare->timestamp = std::chrono::steady_clock::now();
+    mSpare->hasDmaBufs = mDmaBufCount > 0;
+
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mCurrent.swap(mSpare);
+    }
+}
+
+} // namespace GpuSysfsReader
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <inttypes.h>
+#include <sys/types.h>
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "filesystem.h"
+
+namespace GpuSysfsReader {
+
+struct GpuMemRecord {
+    pid_t pid;
+    uint64_t totalGpuMem;
+    uint64_t dmaBufGpuMem;
+    // Proportional share of the dma-bufs mapped by the process, where each
+    // buffer's size is divided by the number of processes mapping it. Only
+    // valid if hasDmaBufPss is set, i.e. the kernel exposes dma_bufs/.
+    uint64_t dmaBufPss;
+    bool hasDmaBufPss;
+
+    uint64_t privateGpuMem() const;
+};
+
+// Reads the GPU memory of every process under kprcs/ in a single pass and
+// serves per-pid queries from that result until it is older than the
+// staleness window. A sweep such as dumpsys meminfo then walks sysfs once
+// instead of once per pid.
+//
+// A refresh builds a new snapshot without holding mLock and publishes it by
+// swapping a pointer, so that readers never wait for a sysfs walk. While one
+// thread refreshes, others are served the previous snapshot.
+class GpuMemSnapshot {
+public:
+    explicit GpuMemSnapshot(std::chrono::milliseconds window) : mWindow(window) {}
+
+    // Returns false if snapshots are disabled and the caller should read
+    // sysfs directly. A pid without GPU memory yields a zeroed record.
+    bool lookup(pid_t pid, GpuMemRecord* out);
+
+    // Copies the records of all processes, pid 0 holding the global nodes.
+    void read(std::vector<GpuMemRecord>* out);
+
+private:
+    struct Snapshot {
+        std::vector<GpuMemRecord> records; // sorted by pid
+        std::chrono::steady_clock::time_point timestamp;
+        bool hasDmaBufs; // some process has a dma_bufs/ directory
+    };
+
+    struct DmaBufInfo {
+        uint64_t inode; // 0 marks an empty slot
+        uint64_t size;
+        uint32_t mapCount;
+    };
+
+    std::shared_ptr<const Snapshot> acquire();
+    std::shared_ptr<const Snapshot> current();
+    bool isFresh(const Snapshot* snapshot) const;
+
+    // The methods below are called with mRefreshLock held
+    void refreshLocked();
+    void readMappedDmaBufsLocked(int procFd, const filesystem::path& procDir,
+                                 GpuMemRecord* record);
+    DmaBufInfo* findOrInsertDmaBufLocked(uint64_t inode, bool* inserted);
+    DmaBufInfo* findDmaBufLocked(uint64_t inode);
+    void computeDmaBufPssLocked(std::vector<GpuMemRecord>* records);
+
+    const std::chrono::milliseconds mWindow;
+    std::mutex mLock;
+    std::shared_ptr<Snapshot> mCurrent; // protected by mLock
+
+    std::mutex mRefreshLock; // serializes refreshes
+    // The previously published snapshot, refilled by the next refresh once no
+    // reader holds it. A steady state refresh then allocates only the DIR
+    // streams of opendir().
+    std::shared_ptr<Snapshot> mSpare;
+    // Scratch state of a refresh: inode of every mapped dma-buf, indexed so
+    // that shared buffers are read and counted once across all processes.
+    // Both are reused across refreshes; mDmaBufs is an open addressing table.
+    std::vector<DmaBufInfo> mDmaBufs;
+    size_t mDmaBufCount = 0;
+    std::vector<std::pair<pid_t, uint64_t>> mMappings;
+};
+
+} // namespace GpuSysfsReader
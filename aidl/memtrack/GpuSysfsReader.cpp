@@ -1,11 +1,17 @@
 #include "GpuSysfsReader.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <log/log.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
-#include <fstream>
-#include <sstream>
-
-#include "filesystem.h"
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
 
 #undef LOG_TAG
 #define LOG_TAG "memtrack-gpusysfsreader"
@@ -13,36 +19,132 @@
 using namespace GpuSysfsReader;
 
 namespace {
-uint64_t readNode(const std::string node, pid_t pid) {
-    std::stringstream ss;
+// Keeps sysfs nodes open between queries so that repeated reads of the same
+// pid cost a single pread() instead of a stat/open/read/close sequence.
+// Nodes of an exited process fail with ENODEV once the kprcs/<pid> directory
+// is removed, which is when the entry is evicted. A full cache evicts the
+// least recently read process. Snapshot refreshes, which visit every process,
+// read their nodes without the cache so that they do not flush it.
+constexpr size_t kMaxCachedProcesses = 64;
+
+enum Node { kDmaBufGpuMem, kTotalGpuMem, kNodeCount };
+
+constexpr const char* kNodeNames[kNodeCount] = {kDmaBufGpuMemNode, kTotalGpuMemNode};
+
+struct CachedNodes {
+    int fds[kNodeCount] = {-1, -1};
+    uint64_t lastUse = 0;
+};
+
+std::mutex gCacheLock;
+std::unordered_map<pid_t, CachedNodes> gCache; // protected by gCacheLock
+uint64_t gUseCount = 0;                        // protected by gCacheLock
+std::atomic<const char*> gDevicePath{kSysfsDevicePath};
+
+void buildDirPath(char* buf, size_t len, pid_t pid) {
     if (pid)
-        ss << kSysfsDevicePath << "/" << kProcessDir << "/" << pid << "/" << node;
+        snprintf(buf, len, "%s/%s/%d", gDevicePath.load(), kProcessDir, pid);
     else
-        ss << kSysfsDevicePath << "/" << node;
-    const std::string path = ss.str();
+        snprintf(buf, len, "%s", gDevicePath.load());
+}
 
-    if (!filesystem::exists(filesystem::path(path))) {
-        ALOGV("File not found: %s", path.c_str());
-        return 0;
+void closeNodes(CachedNodes& nodes) {
+    for (int& fd : nodes.fds) {
+        if (fd >= 0)
+            close(fd);
+        fd = -1;
     }
+}
 
-    std::ifstream file(path.c_str());
-    if (!file.is_open()) {
-        ALOGW("Failed to open %s path", path.c_str());
-        return 0;
+void evictLocked(pid_t pid) {
+    auto it = gCache.find(pid);
+    if (it == gCache.end())
+        return;
+
+    closeNodes(it->second);
+    gCache.erase(it);
+}
+
+// The global nodes of pid 0 are never evicted
+void evictLeastRecentlyUsedLocked() {
+    auto victim = gCache.end();
+    for (auto it = gCache.begin(); it != gCache.end(); ++it) {
+        if (it->first && (victim == gCache.end() || it->second.lastUse < victim->second.lastUse))
+            victim = it;
+    }
+
+    if (victim != gCache.end()) {
+        closeNodes(victim->second);
+        gCache.erase(victim);
+    }
+}
+
+int openNodeLocked(Node node, pid_t pid) {
+    if (gCache.find(pid) == gCache.end() && gCache.size() >= kMaxCachedProcesses)
+        evictLeastRecentlyUsedLocked();
+
+    CachedNodes& nodes = gCache[pid];
+    nodes.lastUse = ++gUseCount;
+    int& fd = nodes.fds[node];
+    if (fd >= 0)
+        return fd;
+
+    char path[PATH_MAX];
+    buildDirPath(path, sizeof(path), pid);
+    size_t len = strlen(path);
+    snprintf(path + len, sizeof(path) - len, "/%s", kNodeNames[node]);
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT)
+            ALOGV("File not found: %s", path);
+        else
+            ALOGW("Failed to open %s path", path);
+        evictLocked(pid);
+    }
+
+    return fd;
+}
+
+uint64_t readNode(Node node, pid_t pid) {
+    std::lock_guard<std::mutex> lock(gCacheLock);
+
+    char buf[32];
+    ssize_t ret = -1;
+    // A stale fd of a previous process with the same pid fails; retry once
+    // with a freshly opened node.
+    for (int attempt = 0; attempt < 2 && ret <= 0; attempt++) {
+        int fd = openNodeLocked(node, pid);
+        if (fd < 0)
+            return 0;
+
+        ret = TEMP_FAILURE_RETRY(pread(fd, buf, sizeof(buf) - 1, 0));
+        if (ret <= 0)
+            evictLocked(pid);
     }
 
-    uint64_t out;
-    file >> out;
-    file.close();
+    if (ret <= 0)
+        return 0;
 
-    return out;
+    buf[ret] = '\0';
+    return strtoull(buf, nullptr, 10);
 }
 } // namespace
 
-uint64_t GpuSysfsReader::getDmaBufGpuMem(pid_t pid) { return readNode(kDmaBufGpuMemNode, pid); }
+const char* GpuSysfsReader::getSysfsDevicePath() { return gDevicePath.load(); }
+
+void GpuSysfsReader::setSysfsDevicePath(const char* path) {
+    std::lock_guard<std::mutex> lock(gCacheLock);
+
+    gDevicePath.store(path);
+    for (auto& entry : gCache)
+        closeNodes(entry.second);
+    gCache.clear();
+}
+
+uint64_t GpuSysfsReader::getDmaBufGpuMem(pid_t pid) { return readNode(kDmaBufGpuMem, pid); }
 
-uint64_t GpuSysfsReader::getGpuMemTotal(pid_t pid) { return readNode(kTotalGpuMemNode, pid); }
+uint64_t GpuSysfsReader::getGpuMemTotal(pid_t pid) { return readNode(kTotalGpuMem, pid); }
 
 uint64_t GpuSysfsReader::getPrivateGpuMem(pid_t pid) {
     auto dma_buf_size = getDmaBufGpuMem(pid);
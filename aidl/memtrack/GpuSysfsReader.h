@@ -14,4 +14,9 @@ constexpr char kProcessDir[] = "kprcs";
 constexpr char kMappedDmaBufsDir[] = "dma_bufs";
 constexpr char kTotalGpuMemNode[] = "total_gpu_mem";
 constexpr char kDmaBufGpuMemNode[] = "dma_buf_gpu_mem";
+
+// Root of the nodes above, kSysfsDevicePath unless a test points it at a fake
+// tree. The path must stay valid while it is in use.
+const char* getSysfsDevicePath();
+void setSysfsDevicePath(const char* path);
 } // namespace GpuSysfsReader
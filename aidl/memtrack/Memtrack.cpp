@@ -1,5 +1,8 @@
 #include <Memtrack.h>
+#include <android-base/file.h>
+#include <android-base/properties.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <sstream>
 #include <string>
@@ -16,6 +19,21 @@ namespace android {
 namespace hardware {
 namespace memtrack {
 
+constexpr char kSnapshotWindowProp[] = "vendor.memtrack.snapshot_window_ms";
+constexpr uint32_t kSnapshotWindowDefaultMs = 50;
+
+constexpr char kSamplerPeriodProp[] = "vendor.memtrack.sampler.period_ms";
+
+Memtrack::Memtrack()
+    : mSnapshot(std::chrono::milliseconds(::android::base::GetUintProperty<uint32_t>(
+              kSnapshotWindowProp, kSnapshotWindowDefaultMs))) {
+    // The background sampler is off unless a period is configured
+    uint32_t periodMs = ::android::base::GetUintProperty<uint32_t>(kSamplerPeriodProp, 0);
+    if (periodMs)
+        mSampler = std::make_unique<GpuSysfsReader::GpuMemSampler>(
+                std::chrono::milliseconds(periodMs), &mSnapshot);
+}
+
 ndk::ScopedAStatus Memtrack::getMemory(int pid, MemtrackType type,
                                        std::vector<MemtrackRecord>* _aidl_return) {
     if (pid < 0)
@@ -35,23 +53,34 @@ ndk::ScopedAStatus Memtrack::getMemory(int pid, MemtrackType type,
     if (pid == 0 && type != MemtrackType::GL)
         return ndk::ScopedAStatus::ok();
 
+    GpuSysfsReader::GpuMemRecord snapshot;
+    bool fromSnapshot = mSnapshot.lookup(pid, &snapshot);
+
     uint64_t size = 0;
+    int32_t flags = MemtrackRecord::FLAG_SMAPS_UNACCOUNTED;
     switch (type) {
         case MemtrackType::GL:
-            size = GpuSysfsReader::getPrivateGpuMem(pid);
+            size = fromSnapshot ? snapshot.privateGpuMem() : GpuSysfsReader::getPrivateGpuMem(pid);
             break;
         case MemtrackType::GRAPHICS:
-            // TODO(b/194483693): This is not PSS as required by memtrack HAL
-            // but complete dmabuf allocations. Reporting PSS requires reading
-            // procfs. This HAL does not have that permission yet.
-            size = GpuSysfsReader::getDmaBufGpuMem(pid);
+            // Buffers shared between processes are split proportionally
+            // across the processes that map them. Without the per-process
+            // dma_bufs directory, fall back to the complete dmabuf
+            // allocations (b/194483693), which is not PSS as required by
+            // the memtrack HAL.
+            if (fromSnapshot && snapshot.hasDmaBufPss) {
+                size = snapshot.dmaBufPss;
+                flags |= MemtrackRecord::FLAG_SHARED_PSS;
+            } else {
+                size = fromSnapshot ? snapshot.dmaBufGpuMem : GpuSysfsReader::getDmaBufGpuMem(pid);
+            }
             break;
         default:
             break;
     }
 
     MemtrackRecord record = {
-            .flags = MemtrackRecord::FLAG_SMAPS_UNACCOUNTED,
+            .flags = flags,
             .sizeInBytes = static_cast<long>(size),
     };
     _aidl_return->emplace_back(record);
@@ -60,7 +89,7 @@ ndk::ScopedAStatus Memtrack::getMemory(int pid, MemtrackType type,
 }
 
 ndk::ScopedAStatus Memtrack::getGpuDeviceInfo(std::vector<DeviceInfo>* _aidl_return) {
-    auto devPath = filesystem::path(GpuSysfsReader::kSysfsDevicePath);
+    auto devPath = filesystem::path(GpuSysfsReader::getSysfsDevicePath());
     std::string devName = "default-gpu";
     if (filesystem::exists(devPath) && filesystem::is_symlink(devPath)) {
         devName = filesystem::read_symlink(devPath).filename().string();
@@ -73,6 +102,23 @@ ndk::ScopedAStatus Memtrack::getGpuDeviceInfo(std::vector<DeviceInfo>* _aidl_ret
     return ndk::ScopedAStatus::ok();
 }
 
+binder_status_t Memtrack::dump(int fd, const char** args, uint32_t numArgs) {
+    if (!mSampler) {
+        ::android::base::WriteStringToFd(
+                std::string("GPU memory sampler disabled, set ") + kSamplerPeriodProp + "\n", fd);
+        return STATUS_OK;
+    }
+
+    bool csv = false;
+    for (uint32_t i = 0; i < numArgs; i++) {
+        if (!strcmp(args[i], "--csv"))
+            csv = true;
+    }
+
+    mSampler->dump(fd, csv);
+    return STATUS_OK;
+}
+
 } // namespace memtrack
 } // namespace hardware
 } // namespace android
@@ -6,6 +6,11 @@
 #include <aidl/android/hardware/memtrack/MemtrackRecord.h>
 #include <aidl/android/hardware/memtrack/MemtrackType.h>
 
+#include <memory>
+
+#include "GpuMemSampler.h"
+#include "GpuMemSnapshot.h"
+
 namespace aidl {
 namespace android {
 namespace hardware {
@@ -13,10 +18,18 @@ namespace memtrack {
 
 class Memtrack : public BnMemtrack {
 public:
+    Memtrack();
+
     ndk::ScopedAStatus getMemory(int pid, MemtrackType type,
                                  std::vector<MemtrackRecord>* _aidl_return) override;
 
     ndk::ScopedAStatus getGpuDeviceInfo(std::vector<DeviceInfo>* _aidl_return) override;
+
+    binder_status_t dump(int fd, const char** args, uint32_t numArgs) override;
+
+private:
+    GpuSysfsReader::GpuMemSnapshot mSnapshot;
+    std::unique_ptr<GpuSysfsReader::GpuMemSampler> mSampler;
 };
 
 } // namespace memtrack
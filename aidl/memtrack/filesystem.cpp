@@ -1,25 +1,47 @@
 #include "filesystem.h"
 
 #include <dirent.h>
+#include <errno.h>
 #include <log/log.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
-#include <sstream>
-#include <string>
-#include <vector>
-
 namespace filesystem {
 
+void path::assign(const char* src, size_t srcLen) {
+    if (srcLen >= sizeof(buf)) {
+        ALOGE("Path too long, truncating: %.*s...", 64, src);
+        srcLen = sizeof(buf) - 1;
+    }
+
+    memmove(buf, src, srcLen);
+    buf[srcLen] = '\0';
+    len = srcLen;
+}
+
+path& path::operator/=(const char* component) {
+    int ret = snprintf(buf + len, sizeof(buf) - len, "/%s", component);
+    if (ret < 0 || static_cast<size_t>(ret) >= sizeof(buf) - len) {
+        ALOGE("Path too long, truncating: %.*s...", 64, buf);
+        len = sizeof(buf) - 1;
+    } else {
+        len += ret;
+    }
+
+    return *this;
+}
+
 bool exists(const path& p) {
     struct stat s;
-    return stat(p.string().c_str(), &s) == 0;
+    return stat(p.c_str(), &s) == 0;
 }
 
 bool is_directory(const path& p) {
     struct stat s;
-    if (stat(p.string().c_str(), &s))
+    if (stat(p.c_str(), &s))
         return false;
 
     return S_ISDIR(s.st_mode);
@@ -27,44 +49,47 @@ bool is_directory(const path& p) {
 
 bool is_symlink(const path& p) {
     struct stat s;
-    if (lstat(p.string().c_str(), &s))
+    if (lstat(p.c_str(), &s))
         return false;
 
     return S_ISLNK(s.st_mode);
 }
 
 path read_symlink(const path& p) {
-    char* actualPath = realpath(p.string().c_str(), NULL);
-    if (!actualPath) {
-        return path(p.string());
+    char actualPath[PATH_MAX];
+    if (!realpath(p.c_str(), actualPath)) {
+        return p;
     }
 
-    path out(actualPath);
-    free(actualPath);
-    return out;
+    return path(actualPath);
 }
 
-std::vector<directory_entry> directory_iterator(const path& p) {
-    if (!exists(p) || !is_directory(p))
-        return {};
+directory_iterator::directory_iterator(const path& p) : dir(nullptr), root(p) {
+    dir = opendir(p.c_str());
+    if (!dir && errno != ENOENT && errno != ENOTDIR)
+        ALOGE("Failed to open %s directory", p.c_str());
+}
 
-    std::unique_ptr<DIR, decltype(&closedir)> dir(opendir(p.string().c_str()), &closedir);
-    if (!dir) {
-        ALOGE("Failed to open %s directory", p.string().c_str());
-    }
+directory_iterator::~directory_iterator() {
+    if (dir)
+        closedir(dir);
+}
+
+bool directory_iterator::advance() {
+    if (!dir)
+        return false;
 
-    std::vector<directory_entry> out;
     struct dirent* dent;
-    while ((dent = readdir(dir.get()))) {
+    while ((dent = readdir(dir))) {
         if (!strcmp(dent->d_name, ".") || !strcmp(dent->d_name, ".."))
             continue;
 
-        std::stringstream ss(p.string());
-        ss << "/" << dent->d_name;
-        out.emplace_back(ss.str());
+        entry.p = root;
+        entry.p /= dent->d_name;
+        return true;
     }
 
-    return out;
+    return false;
 }
 
 } // namespace filesystem
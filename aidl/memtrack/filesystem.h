@@ -6,44 +6,70 @@
 #pragma once
 
 #include <dirent.h>
+#include <limits.h>
 #include <log/log.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
 #include <string>
-#include <vector>
 
 namespace filesystem {
+// Paths are kept in a fixed-size buffer so that building, copying and
+// passing them to syscalls never allocates. The buffer is sized for the GPU
+// nodes under /sys, e.g. <device>/kprcs/<pid>/dma_bufs/<inode>, so that
+// paths stay cheap to copy; overlong paths are truncated.
 class path {
 public:
-    path(const std::string _path) : strPath(_path) {}
+    path() : len(0) { buf[0] = '\0'; }
+    path(const char* _path) { assign(_path, strlen(_path)); }
+    path(const std::string& _path) { assign(_path.c_str(), _path.size()); }
+    path(const path& other) { assign(other.buf, other.len); }
+
+    path& operator=(const path& other) {
+        if (this != &other)
+            assign(other.buf, other.len);
+        return *this;
+    }
 
-    path filename() const {
-        auto pos = strPath.rfind('/');
-        if (pos == std::string::npos)
-            return path(strPath);
+    // Appends a path component, inserting a separator
+    path& operator/=(const char* component);
+    path operator/(const char* component) const {
+        path out(*this);
+        out /= component;
+        return out;
+    }
 
-        pos++;
-        auto l = strPath.size();
-        return path(strPath.substr(pos, l - pos));
+    path filename() const {
+        const char* pos = strrchr(buf, '/');
+        return path(pos ? pos + 1 : buf);
     }
 
-    std::string string() const { return strPath; }
+    const char* c_str() const { return buf; }
+    size_t size() const { return len; }
+    bool empty() const { return len == 0; }
+
+    std::string string() const { return std::string(buf, len); }
 
 private:
-    std::string strPath;
+    void assign(const char* src, size_t srcLen);
+
+    static constexpr size_t kCapacity = 128;
+
+    char buf[kCapacity];
+    size_t len;
 };
 
 class directory_entry {
 public:
-    directory_entry(const std::string _path) : p(_path) {}
+    directory_entry() {}
+    directory_entry(const class path& _path) : p(_path) {}
 
-    class path path() {
-        return p;
-    }
+    const class path& path() const { return p; }
 
 private:
+    friend class directory_iterator;
     class path p;
 };
 
@@ -55,6 +81,45 @@ bool is_symlink(const path& p);
 
 path read_symlink(const path& p);
 
-// Vector is easier to create than an iterator and serves our purposes well
-std::vector<directory_entry> directory_iterator(const path& p);
+// Lazily walks a directory with readdir(), yielding one entry at a time
+// instead of materialising the whole listing. Only opendir() allocates, for
+// the DIR stream. Iterators refer to the directory_iterator, which must
+// outlive them:
+//
+//   for (auto& entry : filesystem::directory_iterator(dir)) { ... }
+class directory_iterator {
+public:
+    class iterator {
+    public:
+        const directory_entry& operator*() const { return dir->entry; }
+        const directory_entry* operator->() const { return &dir->entry; }
+        iterator& operator++() {
+            if (!dir->advance())
+                dir = nullptr;
+            return *this;
+        }
+        bool operator==(const iterator& other) const { return dir == other.dir; }
+        bool operator!=(const iterator& other) const { return dir != other.dir; }
+
+    private:
+        friend class directory_iterator;
+        explicit iterator(directory_iterator* _dir) : dir(_dir) {}
+        directory_iterator* dir;
+    };
+
+    explicit directory_iterator(const path& p);
+    ~directory_iterator();
+    directory_iterator(const directory_iterator&) = delete;
+    directory_iterator& operator=(const directory_iterator&) = delete;
+
+    iterator begin() { return iterator(advance() ? this : nullptr); }
+    iterator end() { return iterator(nullptr); }
+
+private:
+    bool advance();
+
+    DIR* dir;
+    path root;
+    directory_entry entry;
+};
 } // namespace filesystem
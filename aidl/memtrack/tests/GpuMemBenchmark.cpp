@@ -0,0 +1,199 @@
+// Cost of answering the GL and GRAPHICS queries of every process, as
+// dumpsys meminfo does, read per pid from sysfs or through GpuMemSnapshot.
+// All run against a fake kprcs/ tree in a temporary directory, so they
+// measure the syscalls of the walk rather than the kbase sysfs handlers.
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <sys/stat.h>
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "GpuMemSnapshot.h"
+#include "GpuSysfsReader.h"
+
+using android::base::StringPrintf;
+using android::base::WriteStringToFile;
+
+// Counts the C++ heap allocations of the code under test. malloc() calls
+// made by libc, such as the DIR stream of opendir(), are not counted.
+static std::atomic<uint64_t> gAllocations{0};
+
+void* operator new(size_t size) {
+    gAllocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size);
+    if (!p)
+        abort();
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+namespace GpuSysfsReader {
+namespace {
+
+constexpr pid_t kFirstPid = 1000;
+// Every process maps one buffer shared by all of them and a few of its own
+constexpr int kPrivateDmaBufs = 3;
+constexpr uint64_t kSharedInode = 1;
+
+class FakeSysfs {
+public:
+    explicit FakeSysfs(int numPids) : mNumPids(numPids) {
+        const std::string root = mDir.path;
+        WriteStringToFile("0", root + "/" + kTotalGpuMemNode);
+        WriteStringToFile("0", root + "/" + kDmaBufGpuMemNode);
+        mkdir((root + "/" + kProcessDir).c_str(), 0755);
+
+        for (int i = 0; i < numPids; i++) {
+            const std::string dir = StringPrintf("%s/%s/%d", root.c_str(), kProcessDir,
+                                                 kFirstPid + i);
+            const std::string bufDir = dir + "/" + kMappedDmaBufsDir;
+            mkdir(dir.c_str(), 0755);
+            mkdir(bufDir.c_str(), 0755);
+            WriteStringToFile("8388608", dir + "/" + kTotalGpuMemNode);
+            WriteStringToFile("4194304", dir + "/" + kDmaBufGpuMemNode);
+
+            WriteStringToFile("1048576", StringPrintf("%s/%" PRIu64, bufDir.c_str(), kSharedInode));
+            for (int j = 0; j < kPrivateDmaBufs; j++) {
+                const uint64_t inode = kSharedInode + 1 + i * kPrivateDmaBufs + j;
+                WriteStringToFile("1048576", StringPrintf("%s/%" PRIu64, bufDir.c_str(), inode));
+            }
+        }
+
+        setSysfsDevicePath(mDir.path);
+    }
+
+    ~FakeSysfs() { setSysfsDevicePath(kSysfsDevicePath); }
+
+    int numPids() const { return mNumPids; }
+
+private:
+    TemporaryDir mDir;
+    const int mNumPids;
+};
+
+void BM_SweepDirect(benchmark::State& state) {
+    FakeSysfs sysfs(state.range(0));
+
+    for (auto _ : state) {
+        for (pid_t pid = kFirstPid; pid < kFirstPid + sysfs.numPids(); pid++) {
+            benchmark::DoNotOptimize(getPrivateGpuMem(pid));
+            benchmark::DoNotOptimize(getDmaBufGpuMem(pid));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * sysfs.numPids());
+}
+BENCHMARK(BM_SweepDirect)->Arg(100)->Arg(500);
+
+// A sweep within the staleness window, i.e. one refresh per sweep
+void BM_SweepSnapshot(benchmark::State& state) {
+    FakeSysfs sysfs(state.range(0));
+    GpuMemRecord record;
+
+    for (auto _ : state) {
+        GpuMemSnapshot snapshot(std::chrono::seconds(1));
+        for (pid_t pid = kFirstPid; pid < kFirstPid + sysfs.numPids(); pid++) {
+            snapshot.lookup(pid, &record);
+            benchmark::DoNotOptimize(record);
+            snapshot.lookup(pid, &record);
+            benchmark::DoNotOptimize(record);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * sysfs.numPids());
+}
+BENCHMARK(BM_SweepSnapshot)->Arg(100)->Arg(500);
+
+// dma-buf PSS depends on the mappings of every process, so without a
+// snapshot each GRAPHICS query walks all of kprcs/.
+void BM_SweepPssPerQuery(benchmark::State& state) {
+    FakeSysfs sysfs(state.range(0));
+    GpuMemRecord record;
+
+    for (auto _ : state) {
+        for (pid_t pid = kFirstPid; pid < kFirstPid + sysfs.numPids(); pid++) {
+            GpuMemSnapshot snapshot(std::chrono::seconds(1));
+            snapshot.lookup(pid, &record);
+            benchmark::DoNotOptimize(record);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * sysfs.numPids());
+}
+BENCHMARK(BM_SweepPssPerQuery)->Arg(100)->Unit(benchmark::kMillisecond);
+
+// Steady state refreshes with a zero window, where every read walks sysfs
+void BM_RefreshAllocations(benchmark::State& state) {
+    FakeSysfs sysfs(state.range(0));
+    GpuMemSnapshot snapshot(std::chrono::milliseconds(0));
+    std::vector<GpuMemRecord> records;
+
+    // Grow the scratch state of both snapshot buffers
+    snapshot.read(&records);
+    snapshot.read(&records);
+
+    const uint64_t before = gAllocations.load();
+    for (auto _ : state) {
+        snapshot.read(&records);
+    }
+    state.counters["allocs_per_refresh"] =
+            static_cast<double>(gAllocations.load() - before) / state.iterations();
+}
+BENCHMARK(BM_RefreshAllocations)->Arg(500);
+
+void BM_DirectoryIterate(benchmark::State& state) {
+    TemporaryDir dir;
+    for (int i = 0; i < state.range(0); i++)
+        WriteStringToFile("0", StringPrintf("%s/%d", dir.path, i));
+
+    const filesystem::path root(dir.path);
+    size_t entries = 0;
+    const uint64_t before = gAllocations.load();
+    for (auto _ : state) {
+        for (auto& entry : filesystem::directory_iterator(root)) {
+            benchmark::DoNotOptimize(entry.path().c_str());
+            entries++;
+        }
+    }
+    state.counters["allocs_per_walk"] =
+            static_cast<double>(gAllocations.load() - before) / state.iterations();
+    state.SetItemsProcessed(entries);
+}
+BENCHMARK(BM_DirectoryIterate)->Arg(1000);
+
+// Lookups racing with refreshes: a reader only waits for a walk when there
+// is no previous snapshot to serve.
+void BM_LookupContended(benchmark::State& state) {
+    static std::unique_ptr<FakeSysfs> sysfs;
+    static std::unique_ptr<GpuMemSnapshot> snapshot;
+    if (state.thread_index() == 0) {
+        sysfs = std::make_unique<FakeSysfs>(500);
+        snapshot = std::make_unique<GpuMemSnapshot>(std::chrono::milliseconds(1));
+    }
+    GpuMemRecord record;
+
+    for (auto _ : state) {
+        snapshot->lookup(kFirstPid, &record);
+        benchmark::DoNotOptimize(record);
+    }
+
+    if (state.thread_index() == 0) {
+        snapshot.reset();
+        sysfs.reset();
+    }
+}
+BENCHMARK(BM_LookupContended)->Threads(1)->Threads(4);
+
+} // namespace
+} // namespace GpuSysfsReader
+
+BENCHMARK_MAIN();
@@ -0,0 +1,180 @@
+/*
+ * Copyright 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+
+// The ADPF PID controller, free of any Android dependency so that the HAL
+// and the host simulator (tools/adpf_pid_sim.cpp) run the very same math.
+
+namespace aidl {
+namespace google {
+namespace hardware {
+namespace power {
+namespace impl {
+namespace pixel {
+
+// PID controller state of a session
+struct PidState {
+    int64_t durationNanos;
+    uint64_t update_count;
+    int64_t integral_error;
+    int64_t previous_error;
+};
+
+// Tunables of the controller, defaulting to the values the HAL ships with.
+// The integral values are in units of uclamp, as in the properties.
+struct AdpfPidParams {
+    double pOver = 2.0;
+    double pUnder = 1.0;
+    double i = 0.001;
+    double dOver = 500.0;
+    double dUnder = 0.0;
+    int64_t iInit = 200;
+    int64_t iHighLimit = 512;
+    int64_t iLowLimit = -30;
+    int32_t uclampMinHighLimit = 384;
+    int32_t uclampMinLowLimit = 2;
+    uint32_t uclampMinGranularity = 5;
+    // Number of most recent samples of a report each term looks at, 0 for all
+    int64_t pSamplingWindow = 1;
+    int64_t iSamplingWindow = 0;
+    int64_t dSamplingWindow = 1;
+};
+
+// Outputs and intermediate terms of one update, for tracing
+struct AdpfPidResult {
+    int64_t error;       // average P error, in 100us
+    int64_t derivative;  // average D error per dt
+    int64_t pOut;
+    int64_t iOut;
+    int64_t dOut;
+    int64_t output;
+    bool overtime;
+    // Last sample more than 20 times off the target, 0 if none
+    int64_t outlierNanos;
+};
+
+class AdpfPidController {
+  public:
+    explicit AdpfPidController(const AdpfPidParams &params)
+        : mParams(params),
+          mIInit(scaleIntegral(params.iInit)),
+          mIHighLimit(scaleIntegral(params.iHighLimit)),
+          mILowLimit(scaleIntegral(params.iLowLimit)) {}
+
+    const AdpfPidParams &params() const { return mParams; }
+
+    // Restores the integral term after a pause or a stale period
+    void rewind(PidState *state) const {
+        state->integral_error = std::max(mIInit, state->integral_error);
+    }
+
+    // Rescales the integral term by old target / new target
+    void setTarget(PidState *state, int64_t targetDurationNanos) const {
+        double ratio = targetDurationNanos == 0
+                               ? 1.0
+                               : static_cast<double>(state->durationNanos) / targetDurationNanos;
+        state->integral_error =
+                std::max(mIInit, static_cast<int64_t>(state->integral_error * ratio));
+        state->durationNanos = targetDurationNanos;
+    }
+
+    // Runs the controller over the samples of one report. WorkDurations is
+    // any container of elements with a durationNanos member; state must have
+    // a non-zero target and actual must not be empty.
+    template <typename WorkDurations>
+    AdpfPidResult update(const WorkDurations &actual, PidState *state) const {
+        AdpfPidResult result = {};
+        const int64_t targetDurationNanos = state->durationNanos;
+        const int64_t length = actual.size();
+        const int64_t p_start = windowStart(mParams.pSamplingWindow, length);
+        const int64_t i_start = windowStart(mParams.iSamplingWindow, length);
+        const int64_t d_start = windowStart(mParams.dSamplingWindow, length);
+        const int64_t dt = ns_to_100us(targetDurationNanos);
+        int64_t err_sum = 0;
+        int64_t derivative_sum = 0;
+        for (int64_t i = std::min({p_start, i_start, d_start}); i < length; i++) {
+            int64_t actualDurationNanos = actual[i].durationNanos;
+            if (std::abs(actualDurationNanos) > targetDurationNanos * 20) {
+                result.outlierNanos = actualDurationNanos;
+            }
+            int64_t error = ns_to_100us(actualDurationNanos - targetDurationNanos);
+            if (i >= d_start) {
+                derivative_sum += error - state->previous_error;
+            }
+            if (i >= p_start) {
+                err_sum += error;
+            }
+            if (i >= i_start) {
+                state->integral_error = state->integral_error + error * dt;
+                state->integral_error = std::min(mIHighLimit, state->integral_error);
+                state->integral_error = std::max(mILowLimit, state->integral_error);
+            }
+            state->previous_error = error;
+        }
+
+        result.error = err_sum / (length - p_start);
+        result.derivative = derivative_sum / dt / (length - d_start);
+        result.pOut = static_cast<int64_t>((err_sum > 0 ? mParams.pOver : mParams.pUnder) *
+                                           err_sum / (length - p_start));
+        result.iOut = static_cast<int64_t>(mParams.i * state->integral_error);
+        result.dOut = static_cast<int64_t>((derivative_sum > 0 ? mParams.dOver : mParams.dUnder) *
+                                           derivative_sum / dt / (length - d_start));
+        result.output = result.pOut + result.iOut + result.dOut;
+        result.overtime = err_sum > 0;
+        return result;
+    }
+
+    // Returns the uclamp min to apply for output, or -1 to keep currentMin
+    int32_t nextUclampMin(int64_t output, int32_t currentMin) const {
+        if (output == 0) {
+            return -1;
+        }
+        int32_t next_min = std::min(mParams.uclampMinHighLimit, static_cast<int32_t>(output));
+        next_min = std::max(mParams.uclampMinLowLimit, next_min);
+        if (std::abs(currentMin - next_min) <= static_cast<int32_t>(mParams.uclampMinGranularity)) {
+            return -1;
+        }
+        return next_min;
+    }
+
+  private:
+    static int64_t ns_to_100us(int64_t ns) { return ns / 100000; }
+
+    static int64_t windowStart(int64_t window, int64_t length) {
+        return window == 0 || window > length ? 0 : length - window;
+    }
+
+    int64_t scaleIntegral(int64_t value) const {
+        return mParams.i == 0 ? 0 : static_cast<int64_t>(value / mParams.i);
+    }
+
+    const AdpfPidParams mParams;
+    const int64_t mIInit;
+    const int64_t mIHighLimit;
+    const int64_t mILowLimit;
+};
+
+}  // namespace pixel
+}  // namespace impl
+}  // namespace power
+}  // namespace hardware
+}  // namespace google
+}  // namespace aidl
@@ -0,0 +1,236 @@
+/*
+ * Copyright 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "powerhal-libperfmgr"
+
+#include "HintCoalescer.h"
+
+#include <android-base/logging.h>
+#include <android/binder_enums.h>
+#include <pthread.h>
+
+#include <algorithm>
+
+namespace aidl {
+namespace google {
+namespace hardware {
+namespace power {
+namespace impl {
+namespace pixel {
+
+HintCoalescer::HintCoalescer(std::shared_ptr<HintManager> hm, std::chrono::milliseconds window)
+    : mHintManager(hm), mWindow(window) {
+    std::lock_guard<std::mutex> guard(mInternLock);
+    for (Boost type : ndk::enum_range<Boost>()) {
+        size_t index = static_cast<size_t>(type);
+        if (index >= mBoostIds.size()) {
+            mBoostIds.resize(index + 1, kInvalidHint);
+        }
+        mBoostIds[index] = internLocked(toString(type));
+    }
+    for (Mode type : ndk::enum_range<Mode>()) {
+        size_t index = static_cast<size_t>(type);
+        if (index >= mModeIds.size()) {
+            mModeIds.resize(index + 1, kInvalidHint);
+        }
+        mModeIds[index] = internLocked(toString(type));
+    }
+    mThread = std::thread(&HintCoalescer::run, this);
+}
+
+HintCoalescer::~HintCoalescer() {
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+        mStop = true;
+    }
+    mCond.notify_all();
+    mThread.join();
+}
+
+HintCoalescer::HintId HintCoalescer::getId(Boost type) const {
+    size_t index = static_cast<size_t>(type);
+    return index < mBoostIds.size() ? mBoostIds[index] : kInvalidHint;
+}
+
+HintCoalescer::HintId HintCoalescer::getId(Mode type) const {
+    size_t index = static_cast<size_t>(type);
+    return index < mModeIds.size() ? mModeIds[index] : kInvalidHint;
+}
+
+HintCoalescer::HintId HintCoalescer::getId(const std::string &name) {
+    std::lock_guard<std::mutex> guard(mInternLock);
+    auto it = mIds.find(name);
+    if (it != mIds.end()) {
+        return it->second;
+    }
+    // Do not let clients fill the table with names that would be no-ops
+    if (!mHintManager->IsHintSupported(name)) {
+        return kInvalidHint;
+    }
+    return internLocked(name);
+}
+
+const std::string &HintCoalescer::getName(HintId id) const {
+    static const std::string kEmpty;
+    if (id < 0 || static_cast<size_t>(id) >= mHintCount.load(std::memory_order_acquire)) {
+        return kEmpty;
+    }
+    return mHints[id].name;
+}
+
+HintCoalescer::HintId HintCoalescer::internLocked(const std::string &name) {
+    auto it = mIds.find(name);
+    if (it != mIds.end()) {
+        return it->second;
+    }
+    size_t count = mHintCount.load(std::memory_order_relaxed);
+    if (count == kMaxHints) {
+        LOG(ERROR) << "Too many hints, not coalescing " << name;
+        return kInvalidHint;
+    }
+    Hint &hint = mHints[count];
+    hint.name = name;
+    hint.supported = mHintManager->IsHintSupported(name);
+    mIds.emplace(name, count);
+    mHintCount.store(count + 1, std::memory_order_release);
+    return count;
+}
+
+void HintCoalescer::doHint(HintId id) {
+    request(id, Op::kDo, Clock::time_point::max());
+}
+
+void HintCoalescer::doHint(HintId id, std::chrono::milliseconds timeout) {
+    request(id, Op::kDoTimed, Clock::now() + timeout);
+}
+
+void HintCoalescer::endHint(HintId id) {
+    request(id, Op::kEnd, Clock::time_point::min());
+}
+
+void HintCoalescer::request(HintId id, Op op, Clock::time_point deadline) {
+    if (id < 0 || static_cast<size_t>(id) >= mHintCount.load(std::memory_order_acquire) ||
+        !mHints[id].supported) {
+        return;
+    }
+
+    Hint &hint = mHints[id];
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+        const Op pending = hint.pendingOp;
+        if (op == Op::kDoTimed) {
+            if (pending == Op::kDoTimed) {
+                hint.pendingDeadline = std::max(hint.pendingDeadline, deadline);
+                return;
+            }
+            if (pending == Op::kNone && hint.appliedDeadline != Clock::time_point::max() &&
+                hint.appliedDeadline >= deadline) {
+                return;
+            }
+        } else if (op == Op::kDo && pending == Op::kNone &&
+                   hint.appliedDeadline == Clock::time_point::max()) {
+            return;
+        }
+
+        hint.pendingOp = op;
+        hint.pendingDeadline = deadline;
+        if (pending != Op::kNone) {
+            return;
+        }
+        mQueue.push_back(id);
+    }
+    mCond.notify_one();
+}
+
+// Extending a running timed hint waits for the coalescing window, but never
+// closer than one window to the applied deadline. Anything else is due now.
+HintCoalescer::Clock::time_point HintCoalescer::dueTimeLocked(const Hint &hint) const {
+    if (hint.pendingOp != Op::kDoTimed || hint.appliedDeadline == Clock::time_point::max() ||
+        hint.appliedDeadline == Clock::time_point::min()) {
+        return Clock::time_point::min();
+    }
+    return std::min(hint.lastApplied + mWindow, hint.appliedDeadline - mWindow);
+}
+
+void HintCoalescer::run() {
+    pthread_setname_np(pthread_self(), "HintCoalescer");
+
+    std::vector<PendingOp> batch;
+    std::unique_lock<std::mutex> lock(mLock);
+    while (!mStop) {
+        const Clock::time_point now = Clock::now();
+        Clock::time_point wake = Clock::time_point::max();
+        batch.clear();
+        for (auto it = mQueue.begin(); it != mQueue.end();) {
+            Hint &hint = mHints[*it];
+            const Clock::time_point due = dueTimeLocked(hint);
+            if (due > now) {
+                wake = std::min(wake, due);
+                ++it;
+                continue;
+            }
+            batch.push_back({*it, hint.pendingOp, hint.pendingDeadline});
+            // Requests from here on are merged against what is about to be
+            // applied.
+            hint.appliedDeadline = hint.pendingDeadline;
+            hint.lastApplied = now;
+            hint.pendingOp = Op::kNone;
+            it = mQueue.erase(it);
+        }
+
+        if (batch.empty()) {
+            if (wake == Clock::time_point::max()) {
+                mCond.wait(lock);
+            } else {
+                mCond.wait_until(lock, wake);
+            }
+            continue;
+        }
+
+        lock.unlock();
+        for (const PendingOp &op : batch) {
+            apply(op, now);
+        }
+        lock.lock();
+    }
+}
+
+void HintCoalescer::apply(const PendingOp &op, Clock::time_point now) {
+    const std::string &name = mHints[op.id].name;
+    switch (op.op) {
+        case Op::kDo:
+            mHintManager->DoHint(name);
+            break;
+        case Op::kDoTimed:
+            if (op.deadline > now) {
+                mHintManager->DoHint(name, std::chrono::ceil<std::chrono::milliseconds>(
+                                                   op.deadline - now));
+            }
+            break;
+        case Op::kEnd:
+            mHintManager->EndHint(name);
+            break;
+        case Op::kNone:
+            break;
+    }
+}
+
+}  // namespace pixel
+}  // namespace impl
+}  // namespace power
+}  // namespace hardware
+}  // namespace google
+}  // namespace aidl
@@ -0,0 +1,135 @@
+/*
+ * Copyright 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <aidl/android/hardware/power/Boost.h>
+#include <aidl/android/hardware/power/Mode.h>
+#include <perfmgr/HintManager.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace aidl {
+namespace google {
+namespace hardware {
+namespace power {
+namespace impl {
+namespace pixel {
+
+using ::aidl::android::hardware::power::Boost;
+using ::aidl::android::hardware::power::Mode;
+using ::android::perfmgr::HintManager;
+
+// Front-end of HintManager::DoHint/EndHint for the binder threads.
+//
+// Hint names are interned to small integer ids, Boost and Mode at
+// construction, so a request does not build a string. Requests only record
+// the wanted state of the hint and a single worker thread applies it to
+// HintManager. Requests that arrive before the worker gets to a hint are
+// merged, the last one winning, and a timed DoHint whose deadline is already
+// covered is dropped. Extending the deadline of a running timed hint is
+// applied at most once per coalescing window, and always at least one
+// window before the applied deadline runs out.
+//
+// Requests are skipped against the state the worker last applied, so every
+// DoHint/EndHint of the HAL must go through here. A hint driven directly on
+// HintManager would leave that state stale and drop later requests.
+class HintCoalescer {
+  public:
+    using HintId = int32_t;
+    static constexpr HintId kInvalidHint = -1;
+
+    HintCoalescer(std::shared_ptr<HintManager> hm, std::chrono::milliseconds window);
+    ~HintCoalescer();
+
+    HintId getId(Boost type) const;
+    HintId getId(Mode type) const;
+    // Interns name on first use. Returns kInvalidHint for a name that is
+    // not in the HintManager config.
+    HintId getId(const std::string &name);
+    // Returns an empty string for kInvalidHint or an unknown id
+    const std::string &getName(HintId id) const;
+
+    void doHint(HintId id);
+    void doHint(HintId id, std::chrono::milliseconds timeout);
+    void endHint(HintId id);
+
+  private:
+    using Clock = std::chrono::steady_clock;
+    // More than the Boost and Mode hints plus the few fixed and PowerExt
+    // names of a powerhint.json
+    static constexpr size_t kMaxHints = 128;
+
+    enum class Op { kNone, kDo, kDoTimed, kEnd };
+
+    struct Hint {
+        std::string name;
+        bool supported = false;
+        // Protected by mLock
+        Op pendingOp = Op::kNone;
+        Clock::time_point pendingDeadline;
+        // Worker state, also read by requests under mLock. max() while an
+        // untimed DoHint is applied and min() once ended.
+        Clock::time_point appliedDeadline = Clock::time_point::min();
+        Clock::time_point lastApplied = Clock::time_point::min();
+    };
+
+    struct PendingOp {
+        HintId id;
+        Op op;
+        Clock::time_point deadline;
+    };
+
+    HintId internLocked(const std::string &name);
+    void request(HintId id, Op op, Clock::time_point deadline);
+    Clock::time_point dueTimeLocked(const Hint &hint) const;
+    void run();
+    void apply(const PendingOp &op, Clock::time_point now);
+
+    const std::shared_ptr<HintManager> mHintManager;
+    const Clock::duration mWindow;
+
+    // Names are written once before mHintCount publishes them
+    std::array<Hint, kMaxHints> mHints;
+    std::atomic<size_t> mHintCount{0};
+    std::mutex mInternLock;
+    std::unordered_map<std::string, HintId> mIds;  // protected by mInternLock
+    std::vector<HintId> mBoostIds;
+    std::vector<HintId> mModeIds;
+
+    std::mutex mLock;
+    std::condition_variable mCond;
+    std::deque<HintId> mQueue;  // hints with a pending op in arrival order
+    bool mStop = false;         // protected by mLock
+    std::thread mThread;
+};
+
+}  // namespace pixel
+}  // namespace impl
+}  // namespace power
+}  // namespace hardware
+}  // namespace google
+}  // namespace aidl
@@ -0,0 +1,137 @@
+/*
+ * Copyright 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "powerhal-libperfmgr"
+
+#include "HintRecorder.h"
+
+#include <aidl/android/hardware/power/Boost.h>
+#include <aidl/android/hardware/power/Mode.h>
+#include <android-base/file.h>
+
+#include <chrono>
+#include <string>
+
+namespace aidl {
+namespace google {
+namespace hardware {
+namespace power {
+namespace impl {
+namespace pixel {
+
+using ::aidl::android::hardware::power::Boost;
+using ::aidl::android::hardware::power::Mode;
+using ::android::base::WriteStringToFd;
+
+namespace {
+// Names of the Boost, Mode and PowerExt hints that appear in records
+HintRecorder::HintNames hintNames(const std::vector<HintRecorder::Record> &records,
+                                  const HintRecorder::ExtNameFn &extName) {
+    HintRecorder::HintNames names;
+    for (const HintRecorder::Record &r : records) {
+        if (names.count({r.event, r.id})) {
+            continue;
+        }
+        switch (r.event) {
+            case HintRecorder::Event::kSetMode:
+                names[{r.event, r.id}] = toString(static_cast<Mode>(r.id));
+                break;
+            case HintRecorder::Event::kSetBoost:
+                names[{r.event, r.id}] = toString(static_cast<Boost>(r.id));
+                break;
+            case HintRecorder::Event::kExtSetMode:
+            case HintRecorder::Event::kExtSetBoost:
+                if (extName && !extName(r.id).empty()) {
+                    names[{r.event, r.id}] = extName(r.id);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    return names;
+}
+}  // namespace
+
+void HintRecorder::record(Event event, int32_t id, int64_t value, uint64_t session) {
+    const uint64_t n = mHead.fetch_add(1, std::memory_order_relaxed);
+    Slot &slot = mSlots[n % kCapacity];
+    // Record n is the (n / kCapacity + 1)th write to its slot
+    const uint64_t seq = 2 * (n / kCapacity);
+
+    slot.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.timestampNs.store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                   std::chrono::steady_clock::now().time_since_epoch())
+                                   .count(),
+                           std::memory_order_relaxed);
+    slot.event.store(static_cast<uint32_t>(event), std::memory_order_relaxed);
+    slot.id.store(id, std::memory_order_relaxed);
+    slot.value.store(value, std::memory_order_relaxed);
+    slot.session.store(session, std::memory_order_relaxed);
+
+    slot.seq.store(seq + 2, std::memory_order_release);
+}
+
+void HintRecorder::read(std::vector<Record> *out) const {
+    out->clear();
+
+    const uint64_t head = mHead.load(std::memory_order_acquire);
+    const uint64_t start = head > kCapacity ? head - kCapacity : 0;
+    out->reserve(head - start);
+
+    for (uint64_t i = start; i < head; i++) {
+        const Slot &slot = mSlots[i % kCapacity];
+        const uint64_t expected = 2 * (i / kCapacity + 1);
+
+        if (slot.seq.load(std::memory_order_acquire) != expected)
+            continue;
+
+        Record record = {
+                .timestampNs = slot.timestampNs.load(std::memory_order_relaxed),
+                .event = static_cast<Event>(slot.event.load(std::memory_order_relaxed)),
+                .id = slot.id.load(std::memory_order_relaxed),
+                .value = slot.value.load(std::memory_order_relaxed),
+                .session = slot.session.load(std::memory_order_relaxed),
+        };
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) != expected)
+            continue;
+
+        out->push_back(record);
+    }
+}
+
+void HintRecorder::dumpBinary(int fd, const ExtNameFn &extName) const {
+    std::vector<Record> records;
+    read(&records);
+    WriteStringToFd(toBinary(records, hintNames(records, extName)), fd);
+}
+
+void HintRecorder::dumpJson(int fd, const ExtNameFn &extName) const {
+    std::vector<Record> records;
+    read(&records);
+    WriteStringToFd(toJson(records, hintNames(records, extName)), fd);
+}
+
+}  // namespace pixel
+}  // namespace impl
+}  // namespace power
+}  // namespace hardware
+}  // namespace google
+}  // namespace aidl
@@ -0,0 +1,117 @@
+/*
+ * Copyright 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace aidl {
+namespace google {
+namespace hardware {
+namespace power {
+namespace impl {
+namespace pixel {
+
+// Timeline of what the HAL did, kept in a fixed-size ring so that it can be
+// dumped after a jank report without having had tracing enabled.
+//
+// Any thread may record. A writer claims the next slot with a single
+// fetch_add and guards it with the slot's sequence counter, so recording
+// takes no lock and readers skip the slots that are being overwritten.
+class HintRecorder {
+  public:
+    enum class Event : uint16_t {
+        kSetMode = 0,              // id: Mode, value: enabled
+        kSetBoost = 1,             // id: Boost, value: duration in ms
+        kInteractionAcquire = 2,   // value: hold duration in ms
+        kInteractionRelease = 3,   // value: ms held
+        kUclamp = 4,               // id: tid, value: min << 16 | max
+        kSessionStale = 5,         // session: session pointer
+        kExtSetMode = 6,           // id: HintCoalescer id, value: enabled
+        kExtSetBoost = 7,          // id: HintCoalescer id, value: duration in ms
+    };
+
+    struct Record {
+        int64_t timestampNs;  // CLOCK_MONOTONIC
+        Event event;
+        int32_t id;
+        int64_t value;
+        uint64_t session;
+    };
+
+    // Hint names by event and id, for the events whose id names a hint
+    using HintNames = std::map<std::pair<Event, int32_t>, std::string>;
+    // Returns the name of a HintCoalescer id, for the PowerExt events
+    using ExtNameFn = std::function<std::string(int32_t)>;
+
+    static constexpr size_t kCapacity = 4096;
+
+    static HintRecorder &getInstance() {
+        static HintRecorder instance;
+        return instance;
+    }
+
+    void record(Event event, int32_t id, int64_t value, uint64_t session = 0);
+
+    // Copies the records currently in the ring, oldest first
+    void read(std::vector<Record> *out) const;
+
+    // Writes the ring and the names of its hints in the binary format of
+    // toBinary()
+    void dumpBinary(int fd, const ExtNameFn &extName) const;
+    // Writes the ring in the Chrome JSON trace format that Perfetto imports
+    void dumpJson(int fd, const ExtNameFn &extName) const;
+
+    // The trace formats live in HintTrace.cpp, which does not depend on the
+    // HAL, so that host tools can convert a dump. toBinary() writes a
+    // "PHTR" header, fixed-size little endian records and the hint names.
+    static std::string toBinary(const std::vector<Record> &records, const HintNames &names);
+    // Returns false if data is not a complete dump of a known version
+    static bool parseBinary(const std::string &data, std::vector<Record> *out,
+                            HintNames *names);
+    static std::string toJson(const std::vector<Record> &records, const HintNames &names);
+
+  private:
+    struct Slot {
+        std::atomic<uint64_t> seq{0};  // odd while the slot is being written
+        std::atomic<int64_t> timestampNs{0};
+        std::atomic<uint32_t> event{0};
+        std::atomic<int32_t> id{0};
+        std::atomic<int64_t> value{0};
+        std::atomic<uint64_t> session{0};
+    };
+
+    HintRecorder() = default;
+    HintRecorder(HintRecorder const &) = delete;
+    void operator=(HintRecorder const &) = delete;
+
+    Slot mSlots[kCapacity];
+    std::atomic<uint64_t> mHead{0};  // number of records ever claimed
+};
+
+}  // namespace pixel
+}  // namespace impl
+}  // namespace power
+}  // namespace hardware
+}  // namespace google
+}  // namespace aidl
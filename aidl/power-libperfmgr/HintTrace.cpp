@@ -0,0 +1,206 @@
+/*
+ * Copyright 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Trace formats of HintRecorder. Built into the HAL and into the host
+// converter, so nothing here depends on the HAL interfaces.
+
+#include "HintRecorder.h"
+
+#include <android-base/stringprintf.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+
+namespace aidl {
+namespace google {
+namespace hardware {
+namespace power {
+namespace impl {
+namespace pixel {
+
+using ::android::base::StringPrintf;
+
+namespace {
+// Binary dump, in little endian, the byte order of every device this HAL
+// runs on:
+//   header: uint32 magic, version, record size, record count
+//   record: int64 timestamp_ns, uint16 event, uint16 reserved, int32 id,
+//           int64 value, uint64 session
+//   names:  uint32 count, then per name
+//           uint16 event, uint16 length, int32 id, length bytes of name
+// Version 1 dumps end after the records.
+constexpr uint32_t kBinaryMagic = 0x52544850;  // "PHTR"
+constexpr uint32_t kBinaryVersion = 2;
+
+struct __attribute__((packed)) BinaryRecord {
+    int64_t timestampNs;
+    uint16_t event;
+    uint16_t reserved;
+    int32_t id;
+    int64_t value;
+    uint64_t session;
+};
+static_assert(sizeof(BinaryRecord) == 32, "binary record layout changed");
+
+struct BinaryName {
+    uint16_t event;
+    uint16_t length;
+    int32_t id;
+};
+static_assert(sizeof(BinaryName) == 8, "binary name layout changed");
+
+// Reads len bytes at *offset, advancing it
+bool take(const std::string &data, size_t *offset, void *out, size_t len) {
+    if (data.size() - *offset < len) {
+        return false;
+    }
+    memcpy(out, data.data() + *offset, len);
+    *offset += len;
+    return true;
+}
+
+std::string eventName(const HintRecorder::Record &r, const HintRecorder::HintNames &names) {
+    auto hintName = [&](const char *prefix) {
+        auto it = names.find({r.event, r.id});
+        return it != names.end() ? prefix + it->second : StringPrintf("%s%d", prefix, r.id);
+    };
+
+    switch (r.event) {
+        case HintRecorder::Event::kSetMode:
+            return hintName("Mode:");
+        case HintRecorder::Event::kSetBoost:
+            return hintName("Boost:");
+        case HintRecorder::Event::kExtSetMode:
+            return hintName("ExtMode:");
+        case HintRecorder::Event::kExtSetBoost:
+            return hintName("ExtBoost:");
+        case HintRecorder::Event::kInteractionAcquire:
+            return "Interaction:acquire";
+        case HintRecorder::Event::kInteractionRelease:
+            return "Interaction:release";
+        case HintRecorder::Event::kUclamp:
+            return StringPrintf("Uclamp:%d", r.id);
+        case HintRecorder::Event::kSessionStale:
+            return StringPrintf("Stale:%" PRIx64, r.session);
+    }
+    return StringPrintf("Event:%u", static_cast<unsigned>(r.event));
+}
+}  // namespace
+
+std::string HintRecorder::toBinary(const std::vector<Record> &records, const HintNames &names) {
+    std::string out;
+    const uint32_t header[] = {kBinaryMagic, kBinaryVersion, sizeof(BinaryRecord),
+                               static_cast<uint32_t>(records.size())};
+    out.append(reinterpret_cast<const char *>(header), sizeof(header));
+
+    for (const Record &r : records) {
+        const BinaryRecord b = {.timestampNs = r.timestampNs,
+                                .event = static_cast<uint16_t>(r.event),
+                                .reserved = 0,
+                                .id = r.id,
+                                .value = r.value,
+                                .session = r.session};
+        out.append(reinterpret_cast<const char *>(&b), sizeof(b));
+    }
+
+    const uint32_t count = names.size();
+    out.append(reinterpret_cast<const char *>(&count), sizeof(count));
+    for (const auto &[key, name] : names) {
+        const uint16_t length = std::min<size_t>(name.size(), UINT16_MAX);
+        const BinaryName b = {
+                .event = static_cast<uint16_t>(key.first), .length = length, .id = key.second};
+        out.append(reinterpret_cast<const char *>(&b), sizeof(b));
+        out.append(name, 0, b.length);
+    }
+    return out;
+}
+
+bool HintRecorder::parseBinary(const std::string &data, std::vector<Record> *out,
+                               HintNames *names) {
+    uint32_t header[4];
+    size_t offset = 0;
+    out->clear();
+    names->clear();
+
+    if (!take(data, &offset, header, sizeof(header)) || header[0] != kBinaryMagic ||
+        header[1] < 1 || header[1] > kBinaryVersion || header[2] != sizeof(BinaryRecord) ||
+        (data.size() - offset) / sizeof(BinaryRecord) < header[3]) {
+        return false;
+    }
+
+    out->reserve(header[3]);
+    for (uint32_t i = 0; i < header[3]; i++) {
+        BinaryRecord r;
+        if (!take(data, &offset, &r, sizeof(r))) {
+            return false;
+        }
+        out->push_back({.timestampNs = r.timestampNs,
+                        .event = static_cast<Event>(r.event),
+                        .id = r.id,
+                        .value = r.value,
+                        .session = r.session});
+    }
+    if (header[1] < 2) {
+        return true;
+    }
+
+    uint32_t count;
+    if (!take(data, &offset, &count, sizeof(count))) {
+        return false;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        BinaryName b;
+        if (!take(data, &offset, &b, sizeof(b)) || data.size() - offset < b.length) {
+            return false;
+        }
+        (*names)[{static_cast<Event>(b.event), b.id}] = data.substr(offset, b.length);
+        offset += b.length;
+    }
+    return true;
+}
+
+std::string HintRecorder::toJson(const std::vector<Record> &records, const HintNames &names) {
+    // Instant events on one track per event kind, uclamp as counters
+    std::string out("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (size_t i = 0; i < records.size(); i++) {
+        const Record &r = records[i];
+        const double tsUs = r.timestampNs / 1000.0;
+        if (r.event == Event::kUclamp) {
+            out.append(StringPrintf("{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":0,"
+                                    "\"args\":{\"min\":%" PRId64 ",\"max\":%" PRId64 "}}",
+                                    eventName(r, names).c_str(), tsUs, r.value >> 16,
+                                    r.value & 0xffff));
+        } else {
+            out.append(StringPrintf("{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,"
+                                    "\"pid\":0,\"tid\":%u,\"args\":{\"id\":%d,\"value\":%" PRId64
+                                    ",\"session\":\"%" PRIx64 "\"}}",
+                                    eventName(r, names).c_str(), tsUs,
+                                    static_cast<unsigned>(r.event), r.id, r.value, r.session));
+        }
+        out.append(i + 1 < records.size() ? ",\n" : "\n");
+    }
+    out.append("]}\n");
+    return out;
+}
+
+}  // namespace pixel
+}  // namespace impl
+}  // namespace power
+}  // namespace hardware
+}  // namespace google
+}  // namespace aidl
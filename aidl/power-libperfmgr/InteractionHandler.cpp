@@ -17,12 +17,14 @@
 #define LOG_TAG "powerhal-libperfmgr"
 #define ATRACE_TAG (ATRACE_TAG_POWER | ATRACE_TAG_HAL)
 
+#include <algorithm>
 #include <array>
 #include <memory>
 
 #include <fcntl.h>
-#include <poll.h>
+#include <sys/epoll.h>
 #include <sys/eventfd.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -30,6 +32,7 @@
 #include <utils/Log.h>
 #include <utils/Trace.h>
 
+#include "HintRecorder.h"
 #include "InteractionHandler.h"
 
 #define MAX_LENGTH 64
@@ -50,6 +53,7 @@ static const bool kDisplayIdleSupport =
         ::android::base::GetBoolProperty("vendor.powerhal.disp.idle_support", true);
 static const std::array<const char *, 2> kDispIdlePath = {"/sys/class/drm/card0/device/idle_state",
                                                           "/sys/class/graphics/fb0/idle_state"};
+// Minimum time a boost is held before an idle display releases it
 static const uint32_t kWaitMs =
         ::android::base::GetUintProperty("vendor.powerhal.disp.idle_wait", /*default*/ 100U);
 static const uint32_t kMinDurationMs =
@@ -58,6 +62,12 @@ static const uint32_t kMaxDurationMs =
         ::android::base::GetUintProperty("vendor.powerhal.interaction.max", /*default*/ 5650U);
 static const uint32_t kDurationOffsetMs =
         ::android::base::GetUintProperty("vendor.powerhal.interaction.offset", /*default*/ 650U);
+// Hold boosts for the p90 of how long the display recently stayed active
+// instead of the requested duration plus offset, but never for less than the
+// requested duration. Both are bounded by the interaction min and max.
+static const bool kAdaptiveDuration =
+        ::android::base::GetBoolProperty("vendor.powerhal.interaction.adaptive", false);
+static constexpr float kAdaptivePercentile = 0.9f;
 
 static size_t CalcTimespecDiffMs(struct timespec start, struct timespec end) {
     size_t diff_in_ms = 0;
@@ -79,24 +89,57 @@ static int FbIdleOpen(void) {
 
 }  // namespace
 
-InteractionHandler::InteractionHandler(std::shared_ptr<HintManager> const &hint_manager)
+DurationHistogram::DurationHistogram(uint32_t max_ms)
+    : mTotalWeight(0.0f), mBinMs(std::max<uint32_t>(1, (max_ms + kBins - 1) / kBins)) {
+    mWeights.fill(0.0f);
+}
+
+void DurationHistogram::Add(uint32_t ms) {
+    for (float &weight : mWeights)
+        weight *= kDecay;
+    mWeights[std::min<size_t>(ms / mBinMs, kBins - 1)] += 1.0f;
+    mTotalWeight = mTotalWeight * kDecay + 1.0f;
+}
+
+uint32_t DurationHistogram::Percentile(float fraction) const {
+    if (mTotalWeight < kMinWeight)
+        return 0;
+
+    const float target = mTotalWeight * fraction;
+    float sum = 0.0f;
+    for (size_t i = 0; i < kBins; i++) {
+        sum += mWeights[i];
+        if (sum >= target)
+            return (i + 1) * mBinMs;
+    }
+    return kBins * mBinMs;
+}
+
+InteractionHandler::InteractionHandler(std::shared_ptr<HintCoalescer> const &hint_coalescer)
     : mState(INTERACTION_STATE_UNINITIALIZED),
+      mDisplayIdle(false),
+      mIdleSamplePending(false),
+      mActiveHistogram(kMaxDurationMs),
       mDurationMs(0),
-      mHintManager(hint_manager) {}
+      mHintCoalescer(hint_coalescer),
+      mInteractionHintId(hint_coalescer->getId(Boost::INTERACTION)) {}
 
 InteractionHandler::~InteractionHandler() {
     Exit();
 }
 
-bool InteractionHandler::Init() {
+bool InteractionHandler::Init(const char *idle_path) {
     std::lock_guard<std::mutex> lk(mLock);
 
     if (mState != INTERACTION_STATE_UNINITIALIZED)
         return true;
 
-    int fd = FbIdleOpen();
-    if (fd < 0)
+    int fd = idle_path ? open(idle_path, O_RDONLY | O_CLOEXEC) : FbIdleOpen();
+    if (fd < 0) {
+        if (idle_path)
+            ALOGE("Unable to open %s (%d)", idle_path, errno);
         return false;
+    }
     mIdleFd = fd;
 
     mEventFd = eventfd(0, EFD_NONBLOCK);
@@ -106,6 +149,28 @@ bool InteractionHandler::Init() {
         return false;
     }
 
+    // The idle node stays armed for the lifetime of the handler, so the
+    // display state is known before a boost has to be released.
+    mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    // sysfs signals a new state with POLLPRI, a FIFO by becoming readable
+    struct stat st;
+    bool fifo = fstat(mIdleFd, &st) == 0 && S_ISFIFO(st.st_mode);
+    struct epoll_event ev[2] = {};
+    ev[0].events = EPOLLIN;
+    ev[0].data.fd = mEventFd;
+    ev[1].events = fifo ? EPOLLIN : EPOLLPRI | EPOLLERR;
+    ev[1].data.fd = mIdleFd;
+    if (mEpollFd < 0 || epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mEventFd, &ev[0]) ||
+        epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mIdleFd, &ev[1])) {
+        ALOGE("Unable to set up epoll (%d)", errno);
+        if (mEpollFd >= 0)
+            close(mEpollFd);
+        close(mEventFd);
+        close(mIdleFd);
+        return false;
+    }
+    UpdateIdleState();
+
     mState = INTERACTION_STATE_IDLE;
     mThread = std::unique_ptr<std::thread>(new std::thread(&InteractionHandler::Routine, this));
 
@@ -117,29 +182,25 @@ void InteractionHandler::Exit() {
     if (mState == INTERACTION_STATE_UNINITIALIZED)
         return;
 
-    AbortWaitLocked();
     mState = INTERACTION_STATE_UNINITIALIZED;
+    WakeLocked();
     lk.unlock();
 
-    mCond.notify_all();
     mThread->join();
 
+    close(mEpollFd);
     close(mEventFd);
     close(mIdleFd);
 }
 
 void InteractionHandler::PerfLock() {
     ALOGV("%s: acquiring perf lock", __func__);
-    if (!mHintManager->DoHint("INTERACTION")) {
-        ALOGE("%s: do hint INTERACTION failed", __func__);
-    }
+    mHintCoalescer->doHint(mInteractionHintId);
 }
 
 void InteractionHandler::PerfRel() {
     ALOGV("%s: releasing perf lock", __func__);
-    if (!mHintManager->EndHint("INTERACTION")) {
-        ALOGE("%s: end hint INTERACTION failed", __func__);
-    }
+    mHintCoalescer->endHint(mInteractionHintId);
 }
 
 void InteractionHandler::Acquire(int32_t duration) {
@@ -147,20 +208,13 @@ void InteractionHandler::Acquire(int32_t duration) {
 
     std::lock_guard<std::mutex> lk(mLock);
 
-    int inputDuration = duration + kDurationOffsetMs;
-    int finalDuration;
-    if (inputDuration > kMaxDurationMs)
-        finalDuration = kMaxDurationMs;
-    else if (inputDuration > kMinDurationMs)
-        finalDuration = inputDuration;
-    else
-        finalDuration = kMinDurationMs;
+    int finalDuration = CalcDurationLocked(duration);
 
     // Fallback to do boost directly
     // 1) override property is set OR
     // 2) InteractionHandler not initialized
     if (!kDisplayIdleSupport || mState == INTERACTION_STATE_UNINITIALIZED) {
-        mHintManager->DoHint("INTERACTION", std::chrono::milliseconds(finalDuration));
+        mHintCoalescer->doHint(mInteractionHintId, std::chrono::milliseconds(finalDuration));
         return;
     }
 
@@ -178,100 +232,129 @@ void InteractionHandler::Acquire(int32_t duration) {
     }
     mLastTimespec = cur_timespec;
     mDurationMs = finalDuration;
+    mIdleSamplePending = true;
 
     ALOGV("%s: input: %d final duration: %d", __func__, duration, finalDuration);
+    HintRecorder::getInstance().record(HintRecorder::Event::kInteractionAcquire, 0,
+                                       finalDuration);
 
-    if (mState == INTERACTION_STATE_WAITING)
-        AbortWaitLocked();
-    else if (mState == INTERACTION_STATE_IDLE)
+    if (mState == INTERACTION_STATE_IDLE)
         PerfLock();
 
     mState = INTERACTION_STATE_INTERACTION;
-    mCond.notify_one();
+    WakeLocked();
 }
 
-void InteractionHandler::Release() {
-    std::lock_guard<std::mutex> lk(mLock);
-    if (mState == INTERACTION_STATE_WAITING) {
-        ATRACE_CALL();
-        PerfRel();
-        mState = INTERACTION_STATE_IDLE;
-    } else {
-        // clear any wait aborts pending in event fd
-        uint64_t val;
-        ssize_t ret = read(mEventFd, &val, sizeof(val));
-
-        ALOGW_IF(ret < 0, "%s: failed to clear eventfd (%zd, %d)", __func__, ret, errno);
+int32_t InteractionHandler::CalcDurationLocked(int32_t duration) {
+    if (kAdaptiveDuration) {
+        uint32_t learned = mActiveHistogram.Percentile(kAdaptivePercentile);
+        if (learned)
+            return std::clamp(std::max<int64_t>(learned, duration),
+                              static_cast<int64_t>(kMinDurationMs),
+                              static_cast<int64_t>(std::max(kMinDurationMs, kMaxDurationMs)));
     }
+
+    int inputDuration = duration + kDurationOffsetMs;
+    if (inputDuration > static_cast<int>(kMaxDurationMs))
+        return kMaxDurationMs;
+    else if (inputDuration > static_cast<int>(kMinDurationMs))
+        return inputDuration;
+    else
+        return kMinDurationMs;
 }
 
-// should be called while locked
-void InteractionHandler::AbortWaitLocked() {
+// Wakes Routine to re-evaluate the state, should be called while locked
+void InteractionHandler::WakeLocked() {
     uint64_t val = 1;
     ssize_t ret = write(mEventFd, &val, sizeof(val));
     if (ret != sizeof(val))
         ALOGW("Unable to write to event fd (%zd)", ret);
 }
 
-void InteractionHandler::WaitForIdle(int32_t wait_ms, int32_t timeout_ms) {
+// Reading the node also re-arms its POLLPRI notification. A FIFO has no
+// offset and is read from where it is. Returns true if the display went from
+// active to idle.
+bool InteractionHandler::UpdateIdleState() {
     char data[MAX_LENGTH];
-    ssize_t ret;
-    struct pollfd pfd[2];
-
-    ATRACE_CALL();
-
-    ALOGV("%s: wait:%d timeout:%d", __func__, wait_ms, timeout_ms);
+    ssize_t ret = pread(mIdleFd, data, sizeof(data) - 1, 0);
+    if (ret < 0 && errno == ESPIPE)
+        ret = read(mIdleFd, data, sizeof(data) - 1);
+    if (ret <= 0) {
+        ALOGE("%s: Unable to read idle state (%zd, %d)", __func__, ret, errno);
+        return false;
+    }
+    data[ret] = '\0';
 
-    pfd[0].fd = mEventFd;
-    pfd[0].events = POLLIN;
-    pfd[1].fd = mIdleFd;
-    pfd[1].events = POLLPRI | POLLERR;
+    bool idle = !strncmp(data, "idle", 4);
+    ALOGV("%s: display %s", __func__, idle ? "idle" : "active");
+    return !mDisplayIdle.exchange(idle, std::memory_order_relaxed) && idle;
+}
 
-    ret = poll(pfd, 1, wait_ms);
-    if (ret > 0) {
-        ALOGV("%s: wait aborted", __func__);
-        return;
-    } else if (ret < 0) {
-        ALOGE("%s: error in poll while waiting", __func__);
+// Records how long the display stayed active after the last boost, at its
+// first active to idle transition, whether or not the boost is still held.
+void InteractionHandler::SampleActiveDuration() {
+    std::lock_guard<std::mutex> lk(mLock);
+    if (!mIdleSamplePending)
         return;
-    }
+    mIdleSamplePending = false;
 
-    ret = pread(mIdleFd, data, sizeof(data), 0);
-    if (!ret) {
-        ALOGE("%s: Unexpected EOF!", __func__);
-        return;
-    }
+    struct timespec cur_timespec;
+    clock_gettime(CLOCK_MONOTONIC, &cur_timespec);
+    size_t active_ms = CalcTimespecDiffMs(mLastTimespec, cur_timespec);
+    mActiveHistogram.Add(std::min<size_t>(active_ms, kMaxDurationMs));
+}
 
-    if (!strncmp(data, "idle", 4)) {
-        ALOGV("%s: already idle", __func__);
-        return;
+int32_t InteractionHandler::ReleaseIfDueLocked() {
+    if (mState != INTERACTION_STATE_INTERACTION)
+        return -1;
+
+    struct timespec cur_timespec;
+    clock_gettime(CLOCK_MONOTONIC, &cur_timespec);
+    int32_t elapsed_ms = CalcTimespecDiffMs(mLastTimespec, cur_timespec);
+    bool idle = mDisplayIdle.load(std::memory_order_relaxed);
+    if (elapsed_ms >= mDurationMs || (idle && elapsed_ms >= static_cast<int32_t>(kWaitMs))) {
+        ATRACE_NAME("InteractionHandler::Release");
+        ALOGV("%s: release after %d ms, display %s", __func__, elapsed_ms,
+              idle ? "idle" : "active");
+        HintRecorder::getInstance().record(HintRecorder::Event::kInteractionRelease, 0,
+                                           elapsed_ms);
+        PerfRel();
+        mState = INTERACTION_STATE_IDLE;
+        return -1;
     }
 
-    ret = poll(pfd, 2, timeout_ms);
-    if (ret < 0)
-        ALOGE("%s: Error on waiting for idle (%zd)", __func__, ret);
-    else if (ret == 0)
-        ALOGV("%s: timed out waiting for idle", __func__);
-    else if (pfd[0].revents)
-        ALOGV("%s: wait for idle aborted", __func__);
-    else if (pfd[1].revents)
-        ALOGV("%s: idle detected", __func__);
+    // An active display can only release the boost by going idle, which
+    // wakes up the epoll wait anyway.
+    return (idle ? static_cast<int32_t>(kWaitMs) : mDurationMs) - elapsed_ms;
 }
 
 void InteractionHandler::Routine() {
     pthread_setname_np(pthread_self(), "DispIdle");
-    std::unique_lock<std::mutex> lk(mLock, std::defer_lock);
+    struct epoll_event events[2];
 
     while (true) {
-        lk.lock();
-        mCond.wait(lk, [&] { return mState != INTERACTION_STATE_IDLE; });
-        if (mState == INTERACTION_STATE_UNINITIALIZED)
-            return;
-        mState = INTERACTION_STATE_WAITING;
-        lk.unlock();
+        int32_t timeout_ms;
+        {
+            std::lock_guard<std::mutex> lk(mLock);
+            if (mState == INTERACTION_STATE_UNINITIALIZED)
+                return;
+            timeout_ms = ReleaseIfDueLocked();
+        }
 
-        WaitForIdle(kWaitMs, mDurationMs);
-        Release();
+        int n = epoll_wait(mEpollFd, events, 2, timeout_ms);
+        if (n < 0 && errno != EINTR) {
+            ALOGE("%s: Error on epoll wait (%d)", __func__, errno);
+            return;
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == mEventFd) {
+                uint64_t val;
+                ssize_t ret = read(mEventFd, &val, sizeof(val));
+                ALOGW_IF(ret < 0, "%s: failed to clear eventfd (%zd, %d)", __func__, ret, errno);
+            } else if (UpdateIdleState() && kAdaptiveDuration) {
+                SampleActiveDuration();
+            }
+        }
     }
 }
 
@@ -16,13 +16,14 @@
 
 #pragma once
 
-#include <condition_variable>
+#include <array>
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
 
-#include <perfmgr/HintManager.h>
+#include "HintCoalescer.h"
 
 namespace aidl {
 namespace google {
@@ -31,28 +32,49 @@ namespace power {
 namespace impl {
 namespace pixel {
 
-using ::android::perfmgr::HintManager;
-
 enum InteractionState {
     INTERACTION_STATE_UNINITIALIZED,
     INTERACTION_STATE_IDLE,
     INTERACTION_STATE_INTERACTION,
-    INTERACTION_STATE_WAITING,
+};
+
+// Exponentially decayed histogram of how long the display stayed active
+// after a boost. Older interactions lose weight with every new sample.
+class DurationHistogram {
+  public:
+    explicit DurationHistogram(uint32_t max_ms);
+    void Add(uint32_t ms);
+    // Returns 0 until enough interactions have been recorded
+    uint32_t Percentile(float fraction) const;
+
+  private:
+    static constexpr size_t kBins = 64;
+    static constexpr float kDecay = 0.95f;
+    static constexpr float kMinWeight = 8.0f;
+
+    std::array<float, kBins> mWeights;
+    float mTotalWeight;
+    const uint32_t mBinMs;
 };
 
 class InteractionHandler {
   public:
-    InteractionHandler(std::shared_ptr<HintManager> const &hint_manager);
+    InteractionHandler(std::shared_ptr<HintCoalescer> const &hint_coalescer);
     ~InteractionHandler();
-    bool Init();
+    // idle_path replaces the display idle node, which may then also be a
+    // FIFO that is written one state at a time
+    bool Init(const char *idle_path = nullptr);
     void Exit();
     void Acquire(int32_t duration);
 
   private:
-    void Release();
-    void WaitForIdle(int32_t wait_ms, int32_t timeout_ms);
-    void AbortWaitLocked();
+    bool UpdateIdleState();
+    void SampleActiveDuration();
+    // Releases the boost once it is due, otherwise returns how long to wait
+    int32_t ReleaseIfDueLocked();
+    void WakeLocked();
     void Routine();
+    int32_t CalcDurationLocked(int32_t duration);
 
     void PerfLock();
     void PerfRel();
@@ -60,12 +82,18 @@ class InteractionHandler {
     enum InteractionState mState;
     int mIdleFd;
     int mEventFd;
+    int mEpollFd;
+    // Last state read from the idle node, kept up to date by Routine
+    std::atomic<bool> mDisplayIdle;
+    // Set by a boost until the display next goes idle, protected by mLock
+    bool mIdleSamplePending;
+    DurationHistogram mActiveHistogram;  // protected by mLock
     int32_t mDurationMs;
     struct timespec mLastTimespec;
     std::unique_ptr<std::thread> mThread;
     std::mutex mLock;
-    std::condition_variable mCond;
-    std::shared_ptr<HintManager> mHintManager;
+    std::shared_ptr<HintCoalescer> mHintCoalescer;
+    const HintCoalescer::HintId mInteractionHintId;
 };
 
 }  // namespace pixel
@@ -28,6 +28,7 @@
 
 #include <utils/Log.h>
 
+#include "HintRecorder.h"
 #include "PowerHintSession.h"
 #include "PowerSessionManager.h"
 
@@ -46,28 +47,32 @@ constexpr char kPowerHalRenderingProp[] = "vendor.powerhal.rendering";
 constexpr char kPowerHalAdpfRateProp[] = "vendor.powerhal.adpf.rate";
 constexpr int64_t kPowerHalAdpfRateDefault = -1;
 
-Power::Power(std::shared_ptr<HintManager> hm)
+Power::Power(std::shared_ptr<HintManager> hm, std::shared_ptr<HintCoalescer> hc)
     : mHintManager(hm),
+      mHintCoalescer(hc),
       mInteractionHandler(nullptr),
       mVRModeOn(false),
       mSustainedPerfModeOn(false),
+      mVrHintId(hc->getId(Mode::VR)),
+      mSustainedHintId(hc->getId(Mode::SUSTAINED_PERFORMANCE)),
+      mVrSustainedHintId(hc->getId("VR_SUSTAINED_PERFORMANCE")),
       mAdpfRateNs(
               ::android::base::GetIntProperty(kPowerHalAdpfRateProp, kPowerHalAdpfRateDefault)) {
-    mInteractionHandler = std::make_unique<InteractionHandler>(mHintManager);
+    mInteractionHandler = std::make_unique<InteractionHandler>(mHintCoalescer);
     mInteractionHandler->Init();
 
     std::string state = ::android::base::GetProperty(kPowerHalStateProp, "");
     if (state == "SUSTAINED_PERFORMANCE") {
         LOG(INFO) << "Initialize with SUSTAINED_PERFORMANCE on";
-        mHintManager->DoHint("SUSTAINED_PERFORMANCE");
+        mHintCoalescer->doHint(mSustainedHintId);
         mSustainedPerfModeOn = true;
     } else if (state == "VR") {
         LOG(INFO) << "Initialize with VR on";
-        mHintManager->DoHint(state);
+        mHintCoalescer->doHint(mVrHintId);
         mVRModeOn = true;
     } else if (state == "VR_SUSTAINED_PERFORMANCE") {
         LOG(INFO) << "Initialize with SUSTAINED_PERFORMANCE and VR on";
-        mHintManager->DoHint("VR_SUSTAINED_PERFORMANCE");
+        mHintCoalescer->doHint(mVrSustainedHintId);
         mSustainedPerfModeOn = true;
         mVRModeOn = true;
     } else {
@@ -77,13 +82,13 @@ Power::Power(std::shared_ptr<HintManager> hm)
     state = ::android::base::GetProperty(kPowerHalAudioProp, "");
     if (state == "AUDIO_STREAMING_LOW_LATENCY") {
         LOG(INFO) << "Initialize with AUDIO_LOW_LATENCY on";
-        mHintManager->DoHint(state);
+        mHintCoalescer->doHint(mHintCoalescer->getId(Mode::AUDIO_STREAMING_LOW_LATENCY));
     }
 
     state = ::android::base::GetProperty(kPowerHalRenderingProp, "");
     if (state == "EXPENSIVE_RENDERING") {
         LOG(INFO) << "Initialize with EXPENSIVE_RENDERING on";
-        mHintManager->DoHint("EXPENSIVE_RENDERING");
+        mHintCoalescer->doHint(mHintCoalescer->getId(Mode::EXPENSIVE_RENDERING));
     }
 
     // Now start to take powerhint
@@ -91,52 +96,61 @@ Power::Power(std::shared_ptr<HintManager> hm)
 }
 
 ndk::ScopedAStatus Power::setMode(Mode type, bool enabled) {
+    const HintCoalescer::HintId id = mHintCoalescer->getId(type);
     LOG(DEBUG) << "Power setMode: " << toString(type) << " to: " << enabled;
-    PowerSessionManager::getInstance()->updateHintMode(toString(type), enabled);
+    HintRecorder::getInstance().record(HintRecorder::Event::kSetMode, static_cast<int32_t>(type),
+                                       enabled);
+    if (id != HintCoalescer::kInvalidHint) {
+        PowerSessionManager::getInstance()->updateHintMode(mHintCoalescer->getName(id), enabled);
+    }
     switch (type) {
         case Mode::LOW_POWER:
             if (enabled) {
-                mHintManager->DoHint(toString(type));
+                mHintCoalescer->doHint(id);
             } else {
-                mHintManager->EndHint(toString(type));
+                mHintCoalescer->endHint(id);
             }
             break;
-        case Mode::SUSTAINED_PERFORMANCE:
+        case Mode::SUSTAINED_PERFORMANCE: {
+            std::lock_guard<std::mutex> guard(mModeLock);
             if (enabled && !mSustainedPerfModeOn) {
                 if (!mVRModeOn) {  // Sustained mode only.
-                    mHintManager->DoHint("SUSTAINED_PERFORMANCE");
+                    mHintCoalescer->doHint(mSustainedHintId);
                 } else {  // Sustained + VR mode.
-                    mHintManager->EndHint("VR");
-                    mHintManager->DoHint("VR_SUSTAINED_PERFORMANCE");
+                    mHintCoalescer->endHint(mVrHintId);
+                    mHintCoalescer->doHint(mVrSustainedHintId);
                 }
                 mSustainedPerfModeOn = true;
             } else if (!enabled && mSustainedPerfModeOn) {
-                mHintManager->EndHint("VR_SUSTAINED_PERFORMANCE");
-                mHintManager->EndHint("SUSTAINED_PERFORMANCE");
+                mHintCoalescer->endHint(mVrSustainedHintId);
+                mHintCoalescer->endHint(mSustainedHintId);
                 if (mVRModeOn) {  // Switch back to VR Mode.
-                    mHintManager->DoHint("VR");
+                    mHintCoalescer->doHint(mVrHintId);
                 }
                 mSustainedPerfModeOn = false;
             }
             break;
-        case Mode::VR:
+        }
+        case Mode::VR: {
+            std::lock_guard<std::mutex> guard(mModeLock);
             if (enabled && !mVRModeOn) {
                 if (!mSustainedPerfModeOn) {  // VR mode only.
-                    mHintManager->DoHint("VR");
+                    mHintCoalescer->doHint(mVrHintId);
                 } else {  // Sustained + VR mode.
-                    mHintManager->EndHint("SUSTAINED_PERFORMANCE");
-                    mHintManager->DoHint("VR_SUSTAINED_PERFORMANCE");
+                    mHintCoalescer->endHint(mSustainedHintId);
+                    mHintCoalescer->doHint(mVrSustainedHintId);
                 }
                 mVRModeOn = true;
             } else if (!enabled && mVRModeOn) {
-                mHintManager->EndHint("VR_SUSTAINED_PERFORMANCE");
-                mHintManager->EndHint("VR");
+                mHintCoalescer->endHint(mVrSustainedHintId);
+                mHintCoalescer->endHint(mVrHintId);
                 if (mSustainedPerfModeOn) {  // Switch back to sustained Mode.
-                    mHintManager->DoHint("SUSTAINED_PERFORMANCE");
+                    mHintCoalescer->doHint(mSustainedHintId);
                 }
                 mVRModeOn = false;
             }
             break;
+        }
         case Mode::LAUNCH:
             if (mVRModeOn || mSustainedPerfModeOn) {
                 break;
@@ -166,9 +180,9 @@ ndk::ScopedAStatus Power::setMode(Mode type, bool enabled) {
             [[fallthrough]];
         default:
             if (enabled) {
-                mHintManager->DoHint(toString(type));
+                mHintCoalescer->doHint(id);
             } else {
-                mHintManager->EndHint(toString(type));
+                mHintCoalescer->endHint(id);
             }
             break;
     }
@@ -199,6 +213,8 @@ ndk::ScopedAStatus Power::isModeSupported(Mode type, bool *_aidl_return) {
 
 ndk::ScopedAStatus Power::setBoost(Boost type, int32_t durationMs) {
     LOG(DEBUG) << "Power setBoost: " << toString(type) << " duration: " << durationMs;
+    HintRecorder::getInstance().record(HintRecorder::Event::kSetBoost, static_cast<int32_t>(type),
+                                       durationMs);
     switch (type) {
         case Boost::INTERACTION:
             if (mVRModeOn || mSustainedPerfModeOn) {
@@ -221,11 +237,12 @@ ndk::ScopedAStatus Power::setBoost(Boost type, int32_t durationMs) {
                 break;
             }
             if (durationMs > 0) {
-                mHintManager->DoHint(toString(type), std::chrono::milliseconds(durationMs));
+                mHintCoalescer->doHint(mHintCoalescer->getId(type),
+                                       std::chrono::milliseconds(durationMs));
             } else if (durationMs == 0) {
-                mHintManager->DoHint(toString(type));
+                mHintCoalescer->doHint(mHintCoalescer->getId(type));
             } else {
-                mHintManager->EndHint(toString(type));
+                mHintCoalescer->endHint(mHintCoalescer->getId(type));
             }
             break;
     }
@@ -244,7 +261,18 @@ constexpr const char *boolToString(bool b) {
     return b ? "true" : "false";
 }
 
-binder_status_t Power::dump(int fd, const char **, uint32_t) {
+binder_status_t Power::dump(int fd, const char **args, uint32_t numArgs) {
+    // dumpsys android.hardware.power.IPower/default --hint-trace[-json]
+    auto extHintName = [this](int32_t id) { return mHintCoalescer->getName(id); };
+    if (numArgs > 0 && args[0] == std::string_view("--hint-trace")) {
+        HintRecorder::getInstance().dumpBinary(fd, extHintName);
+        return STATUS_OK;
+    }
+    if (numArgs > 0 && args[0] == std::string_view("--hint-trace-json")) {
+        HintRecorder::getInstance().dumpJson(fd, extHintName);
+        return STATUS_OK;
+    }
+
     std::string buf(::android::base::StringPrintf(
             "HintManager Running: %s\n"
             "VRMode: %s\n"
@@ -256,6 +284,9 @@ binder_status_t Power::dump(int fd, const char **, uint32_t) {
     if (!::android::base::WriteStringToFd(buf, fd)) {
         PLOG(ERROR) << "Failed to dump state to fd";
     }
+    if (mAdpfRateNs > 0) {
+        PowerSessionManager::getInstance()->dumpToFd(fd);
+    }
     fsync(fd);
     return STATUS_OK;
 }
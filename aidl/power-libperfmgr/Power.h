@@ -18,11 +18,13 @@
 
 #include <atomic>
 #include <memory>
+#include <mutex>
 #include <thread>
 
 #include <aidl/android/hardware/power/BnPower.h>
 #include <perfmgr/HintManager.h>
 
+#include "HintCoalescer.h"
 #include "InteractionHandler.h"
 
 namespace aidl {
@@ -39,7 +41,7 @@ using ::android::perfmgr::HintManager;
 
 class Power : public ::aidl::android::hardware::power::BnPower {
   public:
-    Power(std::shared_ptr<HintManager> hm);
+    Power(std::shared_ptr<HintManager> hm, std::shared_ptr<HintCoalescer> hc);
     ndk::ScopedAStatus setMode(Mode type, bool enabled) override;
     ndk::ScopedAStatus isModeSupported(Mode type, bool *_aidl_return) override;
     ndk::ScopedAStatus setBoost(Boost type, int32_t durationMs) override;
@@ -53,9 +55,16 @@ class Power : public ::aidl::android::hardware::power::BnPower {
 
   private:
     std::shared_ptr<HintManager> mHintManager;
+    std::shared_ptr<HintCoalescer> mHintCoalescer;
     std::unique_ptr<InteractionHandler> mInteractionHandler;
+    // Written under mModeLock, which serializes the VR and sustained
+    // performance transitions. Other hints only read them.
+    std::mutex mModeLock;
     std::atomic<bool> mVRModeOn;
     std::atomic<bool> mSustainedPerfModeOn;
+    const HintCoalescer::HintId mVrHintId;
+    const HintCoalescer::HintId mSustainedHintId;
+    const HintCoalescer::HintId mVrSustainedHintId;
     const int64_t mAdpfRateNs;
 };
 
@@ -17,6 +17,7 @@
 #define LOG_TAG "android.hardware.power-service.exynos9810.ext-libperfmgr"
 
 #include "PowerExt.h"
+#include "HintRecorder.h"
 #include "PowerSessionManager.h"
 
 #include <mutex>
@@ -39,10 +40,12 @@ namespace pixel {
 ndk::ScopedAStatus PowerExt::setMode(const std::string &mode, bool enabled) {
     LOG(DEBUG) << "PowerExt setMode: " << mode << " to: " << enabled;
 
+    HintCoalescer::HintId id = mHintCoalescer->getId(mode);
+    HintRecorder::getInstance().record(HintRecorder::Event::kExtSetMode, id, enabled);
     if (enabled) {
-        mHintManager->DoHint(mode);
+        mHintCoalescer->doHint(id);
     } else {
-        mHintManager->EndHint(mode);
+        mHintCoalescer->endHint(id);
     }
     PowerSessionManager::getInstance()->updateHintMode(mode, enabled);
 
@@ -59,12 +62,14 @@ ndk::ScopedAStatus PowerExt::isModeSupported(const std::string &mode, bool *_aid
 ndk::ScopedAStatus PowerExt::setBoost(const std::string &boost, int32_t durationMs) {
     LOG(DEBUG) << "PowerExt setBoost: " << boost << " duration: " << durationMs;
 
+    HintCoalescer::HintId id = mHintCoalescer->getId(boost);
+    HintRecorder::getInstance().record(HintRecorder::Event::kExtSetBoost, id, durationMs);
     if (durationMs > 0) {
-        mHintManager->DoHint(boost, std::chrono::milliseconds(durationMs));
+        mHintCoalescer->doHint(id, std::chrono::milliseconds(durationMs));
     } else if (durationMs == 0) {
-        mHintManager->DoHint(boost);
+        mHintCoalescer->doHint(id);
     } else {
-        mHintManager->EndHint(boost);
+        mHintCoalescer->endHint(id);
     }
 
     return ndk::ScopedAStatus::ok();
@@ -23,6 +23,8 @@
 #include <aidl/google/hardware/power/extension/pixel/BnPowerExt.h>
 #include <perfmgr/HintManager.h>
 
+#include "HintCoalescer.h"
+
 namespace aidl {
 namespace google {
 namespace hardware {
@@ -34,8 +36,8 @@ using ::android::perfmgr::HintManager;
 
 class PowerExt : public ::aidl::google::hardware::power::extension::pixel::BnPowerExt {
   public:
-    PowerExt(std::shared_ptr<HintManager> hm)
-        : mHintManager(hm) {}
+    PowerExt(std::shared_ptr<HintManager> hm, std::shared_ptr<HintCoalescer> hc)
+        : mHintManager(hm), mHintCoalescer(hc) {}
     ndk::ScopedAStatus setMode(const std::string &mode, bool enabled) override;
     ndk::ScopedAStatus isModeSupported(const std::string &mode, bool *_aidl_return) override;
     ndk::ScopedAStatus setBoost(const std::string &boost, int32_t durationMs) override;
@@ -43,6 +45,7 @@ class PowerExt : public ::aidl::google::hardware::power::extension::pixel::BnPow
 
   private:
     std::shared_ptr<HintManager> mHintManager;
+    std::shared_ptr<HintCoalescer> mHintCoalescer;
 };
 
 }  // namespace pixel
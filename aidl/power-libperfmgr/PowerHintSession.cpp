@@ -21,7 +21,6 @@
 #include <android-base/parsedouble.h>
 #include <android-base/properties.h>
 #include <android-base/stringprintf.h>
-#include <sys/syscall.h>
 #include <time.h>
 #include <utils/Trace.h>
 #include <atomic>
@@ -49,7 +48,6 @@ constexpr char kPowerHalAdpfPidDUnder[] = "vendor.powerhal.adpf.pid_d.under";
 constexpr char kPowerHalAdpfPidIInit[] = "vendor.powerhal.adpf.pid_i.init";
 constexpr char kPowerHalAdpfPidIHighLimit[] = "vendor.powerhal.adpf.pid_i.high_limit";
 constexpr char kPowerHalAdpfPidILowLimit[] = "vendor.powerhal.adpf.pid_i.low_limit";
-constexpr char kPowerHalAdpfUclampEnable[] = "vendor.powerhal.adpf.uclamp";
 constexpr char kPowerHalAdpfUclampMinGranularity[] = "vendor.powerhal.adpf.uclamp_min.granularity";
 constexpr char kPowerHalAdpfUclampMinHighLimit[] = "vendor.powerhal.adpf.uclamp_min.high_limit";
 constexpr char kPowerHalAdpfUclampMinLowLimit[] = "vendor.powerhal.adpf.uclamp_min.low_limit";
@@ -59,34 +57,6 @@ constexpr char kPowerHalAdpfISamplingWindow[] = "vendor.powerhal.adpf.i.window";
 constexpr char kPowerHalAdpfDSamplingWindow[] = "vendor.powerhal.adpf.d.window";
 
 namespace {
-/* there is no glibc or bionic wrapper */
-struct sched_attr {
-    __u32 size;
-    __u32 sched_policy;
-    __u64 sched_flags;
-    __s32 sched_nice;
-    __u32 sched_priority;
-    __u64 sched_runtime;
-    __u64 sched_deadline;
-    __u64 sched_period;
-    __u32 sched_util_min;
-    __u32 sched_util_max;
-};
-
-static int sched_setattr(int pid, struct sched_attr *attr, unsigned int flags) {
-    static const bool kPowerHalAdpfUclamp =
-            ::android::base::GetBoolProperty(kPowerHalAdpfUclampEnable, true);
-    if (!kPowerHalAdpfUclamp) {
-        ALOGV("PowerHintSession:%s: skip", __func__);
-        return 0;
-    }
-    return syscall(__NR_sched_setattr, pid, attr, flags);
-}
-
-static inline int64_t ns_to_100us(int64_t ns) {
-    return ns / 100000;
-}
-
 static double getDoubleProperty(const char *prop, double value) {
     std::string result = ::android::base::GetProperty(prop, std::to_string(value).c_str());
     if (!::android::base::ParseDouble(result.c_str(), &value)) {
@@ -95,63 +65,90 @@ static double getDoubleProperty(const char *prop, double value) {
     return value;
 }
 
-static double sPidPOver = getDoubleProperty(kPowerHalAdpfPidPOver, 2.0);
-static double sPidPUnder = getDoubleProperty(kPowerHalAdpfPidPUnder, 1.0);
-static double sPidI = getDoubleProperty(kPowerHalAdpfPidI, 0.001);
-static double sPidDOver = getDoubleProperty(kPowerHalAdpfPidDOver, 500.0);
-static double sPidDUnder = getDoubleProperty(kPowerHalAdpfPidDUnder, 0.0);
-static const int64_t sPidIInit =
-        (sPidI == 0) ? 0
-                     : static_cast<int64_t>(::android::base::GetIntProperty<int64_t>(
-                                                    kPowerHalAdpfPidIInit, 200) /
-                                            sPidI);
-static const int64_t sPidIHighLimit =
-        (sPidI == 0) ? 0
-                     : static_cast<int64_t>(::android::base::GetIntProperty<int64_t>(
-                                                    kPowerHalAdpfPidIHighLimit, 512) /
-                                            sPidI);
-static const int64_t sPidILowLimit =
-        (sPidI == 0) ? 0
-                     : static_cast<int64_t>(::android::base::GetIntProperty<int64_t>(
-                                                    kPowerHalAdpfPidILowLimit, -30) /
-                                            sPidI);
-static const int32_t sUclampMinHighLimit =
-        ::android::base::GetUintProperty<uint32_t>(kPowerHalAdpfUclampMinHighLimit, 384);
-static const int32_t sUclampMinLowLimit =
-        ::android::base::GetUintProperty<uint32_t>(kPowerHalAdpfUclampMinLowLimit, 2);
-static const uint32_t sUclampMinGranularity =
-        ::android::base::GetUintProperty<uint32_t>(kPowerHalAdpfUclampMinGranularity, 5);
+static AdpfPidParams getPidParams() {
+    using ::android::base::GetIntProperty;
+    using ::android::base::GetUintProperty;
+    AdpfPidParams p;
+    p.pOver = getDoubleProperty(kPowerHalAdpfPidPOver, p.pOver);
+    p.pUnder = getDoubleProperty(kPowerHalAdpfPidPUnder, p.pUnder);
+    p.i = getDoubleProperty(kPowerHalAdpfPidI, p.i);
+    p.dOver = getDoubleProperty(kPowerHalAdpfPidDOver, p.dOver);
+    p.dUnder = getDoubleProperty(kPowerHalAdpfPidDUnder, p.dUnder);
+    p.iInit = GetIntProperty<int64_t>(kPowerHalAdpfPidIInit, p.iInit);
+    p.iHighLimit = GetIntProperty<int64_t>(kPowerHalAdpfPidIHighLimit, p.iHighLimit);
+    p.iLowLimit = GetIntProperty<int64_t>(kPowerHalAdpfPidILowLimit, p.iLowLimit);
+    p.uclampMinHighLimit =
+            GetUintProperty<uint32_t>(kPowerHalAdpfUclampMinHighLimit, p.uclampMinHighLimit);
+    p.uclampMinLowLimit =
+            GetUintProperty<uint32_t>(kPowerHalAdpfUclampMinLowLimit, p.uclampMinLowLimit);
+    p.uclampMinGranularity =
+            GetUintProperty<uint32_t>(kPowerHalAdpfUclampMinGranularity, p.uclampMinGranularity);
+    p.pSamplingWindow = GetUintProperty<uint32_t>(kPowerHalAdpfPSamplingWindow, p.pSamplingWindow);
+    p.iSamplingWindow = GetUintProperty<uint32_t>(kPowerHalAdpfISamplingWindow, p.iSamplingWindow);
+    p.dSamplingWindow = GetUintProperty<uint32_t>(kPowerHalAdpfDSamplingWindow, p.dSamplingWindow);
+    return p;
+}
+
+static const AdpfPidController sPidController(getPidParams());
 static const int64_t sStaleTimeFactor =
         ::android::base::GetUintProperty<uint32_t>(kPowerHalAdpfStaleTimeFactor, 20);
-static const int64_t sPSamplingWindow =
-        ::android::base::GetUintProperty<uint32_t>(kPowerHalAdpfPSamplingWindow, 1);
-static const int64_t sISamplingWindow =
-        ::android::base::GetUintProperty<uint32_t>(kPowerHalAdpfISamplingWindow, 0);
-static const int64_t sDSamplingWindow =
-        ::android::base::GetUintProperty<uint32_t>(kPowerHalAdpfDSamplingWindow, 1);
 
 }  // namespace
 
+SessionTraceCounters::SessionTraceCounters(const std::string &idstr) {
+    // In the order of TraceCounter
+    static constexpr const char *kSuffixes[kTraceCounterCount] = {
+            "target",
+            "active",
+            "stale",
+            "actl_last",
+            "min",
+            "wakeup",
+            "err",
+            "integral",
+            "derivative",
+            "sample_size",
+            "pid.count",
+            "pid.pOut",
+            "pid.iOut",
+            "pid.dOut",
+            "pid.output",
+            "pid.overtime",
+    };
+    for (size_t i = 0; i < kTraceCounterCount; i++) {
+        mOffsets[i] = static_cast<uint16_t>(mNames.size());
+        mNames.append(StringPrintf("adpf.%s-%s", idstr.c_str(), kSuffixes[i]));
+        mNames.push_back('\0');
+    }
+}
+
+void SessionTraceCounters::emit(TraceCounter counter, int64_t value) const {
+    if (mNames.empty()) {
+        return;
+    }
+    ATRACE_INT(mNames.c_str() + mOffsets[static_cast<size_t>(counter)], value);
+}
+
 PowerHintSession::PowerHintSession(int32_t tgid, int32_t uid, const std::vector<int32_t> &threadIds,
                                    int64_t durationNanos, const nanoseconds adpfRate)
-    : kAdpfRate(adpfRate) {
+    : kAdpfRate(adpfRate),
+      kStaleTimeout(duration_cast<milliseconds>(adpfRate) * sStaleTimeFactor),
+      mLastUpdatedTime(steady_clock::now().time_since_epoch().count()) {
     mDescriptor = new AppHintDesc(tgid, uid, threadIds);
-    mDescriptor->duration = std::chrono::nanoseconds(durationNanos);
-    mStaleHandler = sp<StaleHandler>(new StaleHandler(this));
+    PidState state = mDescriptor->load();
+    state.durationNanos = durationNanos;
+    mDescriptor->store(state);
+    mTraceCounters = SessionTraceCounters(getIdString());
     mPowerManagerHandler = PowerSessionManager::getInstance();
 
     if (ATRACE_ENABLED()) {
-        const std::string idstr = getIdString();
-        std::string sz = StringPrintf("adpf.%s-target", idstr.c_str());
-        ATRACE_INT(sz.c_str(), (int64_t)mDescriptor->duration.count());
-        sz = StringPrintf("adpf.%s-active", idstr.c_str());
-        ATRACE_INT(sz.c_str(), mDescriptor->is_active.load());
-        sz = StringPrintf("adpf.%s-stale", idstr.c_str());
-        ATRACE_INT(sz.c_str(), isStale());
+        mTraceCounters.emit(TraceCounter::kTarget, durationNanos);
+        mTraceCounters.emit(TraceCounter::kActive, mDescriptor->is_active.load());
+        mTraceCounters.emit(TraceCounter::kStale, isStale());
     }
     PowerSessionManager::getInstance()->addPowerSession(this);
     // init boost
-    setUclamp(sUclampMinHighLimit);
+    setUclamp(sPidController.params().uclampMinHighLimit);
     ALOGV("PowerHintSession created: %s", mDescriptor->toString().c_str());
 }
 
@@ -159,13 +156,9 @@ PowerHintSession::~PowerHintSession() {
     close();
     ALOGV("PowerHintSession deleted: %s", mDescriptor->toString().c_str());
     if (ATRACE_ENABLED()) {
-        const std::string idstr = getIdString();
-        std::string sz = StringPrintf("adpf.%s-target", idstr.c_str());
-        ATRACE_INT(sz.c_str(), 0);
-        sz = StringPrintf("adpf.%s-actl_last", idstr.c_str());
-        ATRACE_INT(sz.c_str(), 0);
-        sz = sz = StringPrintf("adpf.%s-active", idstr.c_str());
-        ATRACE_INT(sz.c_str(), 0);
+        mTraceCounters.emit(TraceCounter::kTarget, 0);
+        mTraceCounters.emit(TraceCounter::kActualLast, 0);
+        mTraceCounters.emit(TraceCounter::kActive, 0);
     }
     delete mDescriptor;
 }
@@ -181,31 +174,16 @@ void PowerHintSession::updateUniveralBoostMode() {
 }
 
 int PowerHintSession::setUclamp(int32_t min, int32_t max) {
-    std::lock_guard<std::mutex> guard(mLock);
     min = std::max(0, min);
     min = std::min(min, max);
     max = std::max(0, max);
     max = std::max(min, max);
     if (ATRACE_ENABLED()) {
-        const std::string idstr = getIdString();
-        std::string sz = StringPrintf("adpf.%s-min", idstr.c_str());
-        ATRACE_INT(sz.c_str(), min);
+        mTraceCounters.emit(TraceCounter::kUclampMin, min);
     }
-    for (const auto tid : mDescriptor->threadIds) {
-        sched_attr attr = {};
-        attr.size = sizeof(attr);
-
-        attr.sched_flags = (SCHED_FLAG_KEEP_ALL | SCHED_FLAG_UTIL_CLAMP);
-        attr.sched_util_min = min;
-        attr.sched_util_max = max;
-
-        int ret = sched_setattr(tid, &attr, 0);
-        if (ret) {
-            ALOGW("sched_setattr failed for thread %d, err=%d", tid, errno);
-        }
-        ALOGV("PowerHintSession tid: %d, uclamp(%d, %d)", tid, min, max);
-    }
-    mDescriptor->current_min = min;
+    mDescriptor->current_min.store(min);
+    mDescriptor->current_max.store(max);
+    PowerSessionManager::getInstance()->requestUclampUpdate();
     return 0;
 }
 
@@ -216,9 +194,7 @@ ndk::ScopedAStatus PowerHintSession::pause() {
     setUclamp(0);
     mDescriptor->is_active.store(false);
     if (ATRACE_ENABLED()) {
-        const std::string idstr = getIdString();
-        std::string sz = StringPrintf("adpf.%s-active", idstr.c_str());
-        ATRACE_INT(sz.c_str(), mDescriptor->is_active.load());
+        mTraceCounters.emit(TraceCounter::kActive, mDescriptor->is_active.load());
     }
     updateUniveralBoostMode();
     return ndk::ScopedAStatus::ok();
@@ -228,13 +204,13 @@ ndk::ScopedAStatus PowerHintSession::resume() {
     if (mDescriptor->is_active.load())
         return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_STATE);
     mDescriptor->is_active.store(true);
-    mDescriptor->integral_error = std::max(sPidIInit, mDescriptor->integral_error);
+    PidState state = mDescriptor->load();
+    sPidController.rewind(&state);
+    mDescriptor->store(state);
     // resume boost
-    setUclamp(sUclampMinHighLimit);
+    setUclamp(sPidController.params().uclampMinHighLimit);
     if (ATRACE_ENABLED()) {
-        const std::string idstr = getIdString();
-        std::string sz = StringPrintf("adpf.%s-active", idstr.c_str());
-        ATRACE_INT(sz.c_str(), mDescriptor->is_active.load());
+        mTraceCounters.emit(TraceCounter::kActive, mDescriptor->is_active.load());
     }
     updateUniveralBoostMode();
     return ndk::ScopedAStatus::ok();
@@ -245,8 +221,10 @@ ndk::ScopedAStatus PowerHintSession::close() {
     if (!mSessionClosed.compare_exchange_strong(sessionClosedExpectedToBe, true)) {
         return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_STATE);
     }
-    PowerHintMonitor::getInstance()->getLooper()->removeMessages(mStaleHandler);
-    setUclamp(0);
+    PowerHintMonitor::getInstance()->getStaleTimerWheel()->disarm(this);
+    mDescriptor->current_min.store(0);
+    mDescriptor->current_max.store(kMaxUclampValue);
+    // Resets the threads no other session holds and re-evaluates the rest
     PowerSessionManager::getInstance()->removePowerSession(this);
     updateUniveralBoostMode();
     return ndk::ScopedAStatus::ok();
@@ -258,16 +236,11 @@ ndk::ScopedAStatus PowerHintSession::updateTargetWorkDuration(int64_t targetDura
         return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_ARGUMENT);
     }
     ALOGV("update target duration: %" PRId64 " ns", targetDurationNanos);
-    double ratio =
-            targetDurationNanos == 0 ? 1.0 : mDescriptor->duration.count() / targetDurationNanos;
-    mDescriptor->integral_error =
-            std::max(sPidIInit, static_cast<int64_t>(mDescriptor->integral_error * ratio));
-
-    mDescriptor->duration = std::chrono::nanoseconds(targetDurationNanos);
+    PidState state = mDescriptor->load();
+    sPidController.setTarget(&state, targetDurationNanos);
+    mDescriptor->store(state);
     if (ATRACE_ENABLED()) {
-        const std::string idstr = getIdString();
-        std::string sz = StringPrintf("adpf.%s-target", idstr.c_str());
-        ATRACE_INT(sz.c_str(), (int64_t)mDescriptor->duration.count());
+        mTraceCounters.emit(TraceCounter::kTarget, targetDurationNanos);
     }
 
     return ndk::ScopedAStatus::ok();
@@ -275,7 +248,8 @@ ndk::ScopedAStatus PowerHintSession::updateTargetWorkDuration(int64_t targetDura
 
 ndk::ScopedAStatus PowerHintSession::reportActualWorkDuration(
         const std::vector<WorkDuration> &actualDurations) {
-    if (mDescriptor->duration.count() == 0LL) {
+    PidState state = mDescriptor->load();
+    if (state.durationNanos == 0LL) {
         ALOGE("Expect to call updateTargetWorkDuration() first.");
         return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_STATE);
     }
@@ -288,109 +262,88 @@ ndk::ScopedAStatus PowerHintSession::reportActualWorkDuration(
         return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_STATE);
     }
     if (PowerHintMonitor::getInstance()->isRunning() && isStale()) {
-        mDescriptor->integral_error = std::max(sPidIInit, mDescriptor->integral_error);
+        sPidController.rewind(&state);
         if (ATRACE_ENABLED()) {
-            const std::string idstr = getIdString();
-            std::string sz = StringPrintf("adpf.%s-wakeup", idstr.c_str());
-            ATRACE_INT(sz.c_str(), mDescriptor->integral_error);
-            ATRACE_INT(sz.c_str(), 0);
+            mTraceCounters.emit(TraceCounter::kWakeup, state.integral_error);
+            mTraceCounters.emit(TraceCounter::kWakeup, 0);
         }
     }
-    int64_t targetDurationNanos = (int64_t)mDescriptor->duration.count();
+    int64_t targetDurationNanos = state.durationNanos;
     int64_t length = actualDurations.size();
-    int64_t p_start =
-            sPSamplingWindow == 0 || sPSamplingWindow > length ? 0 : length - sPSamplingWindow;
-    int64_t i_start =
-            sISamplingWindow == 0 || sISamplingWindow > length ? 0 : length - sISamplingWindow;
-    int64_t d_start =
-            sDSamplingWindow == 0 || sDSamplingWindow > length ? 0 : length - sDSamplingWindow;
-    int64_t dt = ns_to_100us(targetDurationNanos);
-    int64_t err_sum = 0;
-    int64_t derivative_sum = 0;
-    for (int64_t i = std::min({p_start, i_start, d_start}); i < length; i++) {
-        int64_t actualDurationNanos = actualDurations[i].durationNanos;
-        if (std::abs(actualDurationNanos) > targetDurationNanos * 20) {
-            ALOGW("The actual duration is way far from the target (%" PRId64 " >> %" PRId64 ")",
-                  actualDurationNanos, targetDurationNanos);
-        }
-        // PID control algorithm
-        int64_t error = ns_to_100us(actualDurationNanos - targetDurationNanos);
-        if (i >= d_start) {
-            derivative_sum += error - mDescriptor->previous_error;
-        }
-        if (i >= p_start) {
-            err_sum += error;
-        }
-        if (i >= i_start) {
-            mDescriptor->integral_error = mDescriptor->integral_error + error * dt;
-            mDescriptor->integral_error = std::min(sPidIHighLimit, mDescriptor->integral_error);
-            mDescriptor->integral_error = std::max(sPidILowLimit, mDescriptor->integral_error);
-        }
-        mDescriptor->previous_error = error;
+    const AdpfPidResult pid = sPidController.update(actualDurations, &state);
+    if (pid.outlierNanos) {
+        ALOGW("The actual duration is way far from the target (%" PRId64 " >> %" PRId64 ")",
+              pid.outlierNanos, targetDurationNanos);
     }
-    if (ATRACE_ENABLED()) {
-        const std::string idstr = getIdString();
-        std::string sz = StringPrintf("adpf.%s-err", idstr.c_str());
-        ATRACE_INT(sz.c_str(), err_sum / (length - p_start));
-        sz = StringPrintf("adpf.%s-integral", idstr.c_str());
-        ATRACE_INT(sz.c_str(), mDescriptor->integral_error);
-        sz = StringPrintf("adpf.%s-derivative", idstr.c_str());
-        ATRACE_INT(sz.c_str(), derivative_sum / dt / (length - d_start));
-    }
-    int64_t pOut = static_cast<int64_t>((err_sum > 0 ? sPidPOver : sPidPUnder) * err_sum /
-                                        (length - p_start));
-    int64_t iOut = static_cast<int64_t>(sPidI * mDescriptor->integral_error);
-    int64_t dOut = static_cast<int64_t>((derivative_sum > 0 ? sPidDOver : sPidDUnder) *
-                                        derivative_sum / dt / (length - d_start));
-
-    int64_t output = pOut + iOut + dOut;
 
     if (ATRACE_ENABLED()) {
-        const std::string idstr = getIdString();
-        std::string sz = StringPrintf("adpf.%s-actl_last", idstr.c_str());
-        ATRACE_INT(sz.c_str(), actualDurations[length - 1].durationNanos);
-        sz = StringPrintf("adpf.%s-target", idstr.c_str());
-        ATRACE_INT(sz.c_str(), (int64_t)mDescriptor->duration.count());
-        sz = StringPrintf("adpf.%s-sample_size", idstr.c_str());
-        ATRACE_INT(sz.c_str(), length);
-        sz = StringPrintf("adpf.%s-pid.count", idstr.c_str());
-        ATRACE_INT(sz.c_str(), mDescriptor->update_count);
-        sz = StringPrintf("adpf.%s-pid.pOut", idstr.c_str());
-        ATRACE_INT(sz.c_str(), pOut);
-        sz = StringPrintf("adpf.%s-pid.iOut", idstr.c_str());
-        ATRACE_INT(sz.c_str(), iOut);
-        sz = StringPrintf("adpf.%s-pid.dOut", idstr.c_str());
-        ATRACE_INT(sz.c_str(), dOut);
-        sz = StringPrintf("adpf.%s-pid.output", idstr.c_str());
-        ATRACE_INT(sz.c_str(), output);
-        sz = StringPrintf("adpf.%s-stale", idstr.c_str());
-        ATRACE_INT(sz.c_str(), isStale());
-        sz = StringPrintf("adpf.%s-pid.overtime", idstr.c_str());
-        ATRACE_INT(sz.c_str(), err_sum > 0);
+        mTraceCounters.emit(TraceCounter::kError, pid.error);
+        mTraceCounters.emit(TraceCounter::kIntegral, state.integral_error);
+        mTraceCounters.emit(TraceCounter::kDerivative, pid.derivative);
+        mTraceCounters.emit(TraceCounter::kActualLast, actualDurations[length - 1].durationNanos);
+        mTraceCounters.emit(TraceCounter::kTarget, targetDurationNanos);
+        mTraceCounters.emit(TraceCounter::kSampleSize, length);
+        mTraceCounters.emit(TraceCounter::kPidCount, state.update_count);
+        mTraceCounters.emit(TraceCounter::kPidPOut, pid.pOut);
+        mTraceCounters.emit(TraceCounter::kPidIOut, pid.iOut);
+        mTraceCounters.emit(TraceCounter::kPidDOut, pid.dOut);
+        mTraceCounters.emit(TraceCounter::kPidOutput, pid.output);
+        mTraceCounters.emit(TraceCounter::kStale, isStale());
+        mTraceCounters.emit(TraceCounter::kPidOvertime, pid.overtime);
     }
-    mDescriptor->update_count++;
+    state.update_count++;
+    mDescriptor->store(state);
 
-    mStaleHandler->updateStaleTimer();
+    refreshStaleTimer();
 
     /* apply to all the threads in the group */
-    if (output != 0) {
-        int next_min = std::min(sUclampMinHighLimit, static_cast<int>(output));
-        next_min = std::max(sUclampMinLowLimit, next_min);
-        if (std::abs(mDescriptor->current_min - next_min) > sUclampMinGranularity) {
-            setUclamp(next_min);
-        }
+    int32_t next_min = sPidController.nextUclampMin(pid.output, mDescriptor->current_min.load());
+    if (next_min >= 0) {
+        setUclamp(next_min);
     }
 
     return ndk::ScopedAStatus::ok();
 }
 
+PidState AppHintDesc::load() const {
+    return {.durationNanos = duration.load(std::memory_order_relaxed),
+            .update_count = update_count.load(std::memory_order_relaxed),
+            .integral_error = integral_error.load(std::memory_order_relaxed),
+            .previous_error = previous_error.load(std::memory_order_relaxed)};
+}
+
+void AppHintDesc::store(const PidState &state) {
+    uint32_t s = seq.load(std::memory_order_relaxed);
+    seq.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    duration.store(state.durationNanos, std::memory_order_relaxed);
+    update_count.store(state.update_count, std::memory_order_relaxed);
+    integral_error.store(state.integral_error, std::memory_order_relaxed);
+    previous_error.store(state.previous_error, std::memory_order_relaxed);
+    seq.store(s + 2, std::memory_order_release);
+}
+
+PidState AppHintDesc::snapshot() const {
+    PidState state;
+    uint32_t s;
+    do {
+        s = seq.load(std::memory_order_acquire);
+        state = load();
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((s & 1) || s != seq.load(std::memory_order_relaxed));
+    return state;
+}
+
 std::string AppHintDesc::toString() const {
+    const PidState state = snapshot();
     std::string out =
             StringPrintf("session %" PRIxPTR "\n", reinterpret_cast<uintptr_t>(this) & 0xffff);
-    const int64_t durationNanos = duration.count();
-    out.append(StringPrintf("  duration: %" PRId64 " ns\n", durationNanos));
-    out.append(StringPrintf("  uclamp.min: %d \n", current_min));
+    out.append(StringPrintf("  duration: %" PRId64 " ns\n", state.durationNanos));
+    out.append(StringPrintf("  uclamp.min: %d \n", current_min.load()));
     out.append(StringPrintf("  uid: %d, tgid: %d\n", uid, tgid));
+    out.append(StringPrintf("  pid: count: %" PRIu64 ", integral: %" PRId64 ", previous: %" PRId64
+                            "\n",
+                            state.update_count, state.integral_error, state.previous_error));
 
     out.append("  threadIds: [");
     bool first = true;
@@ -411,18 +364,28 @@ bool PowerHintSession::isActive() {
 
 bool PowerHintSession::isStale() {
     auto now = std::chrono::steady_clock::now();
-    return now >= mStaleHandler->getStaleTime();
+    return now >= getStaleTime();
 }
 
 const std::vector<int> &PowerHintSession::getTidList() const {
     return mDescriptor->threadIds;
 }
 
+int32_t PowerHintSession::getUclampMin() const {
+    return mDescriptor->current_min.load();
+}
+
+int32_t PowerHintSession::getUclampMax() const {
+    return mDescriptor->current_max.load();
+}
+
+std::string PowerHintSession::toString() const {
+    return mDescriptor->toString();
+}
+
 void PowerHintSession::setStale() {
     if (ATRACE_ENABLED()) {
-        const std::string idstr = getIdString();
-        std::string sz = StringPrintf("adpf.%s-stale", idstr.c_str());
-        ATRACE_INT(sz.c_str(), 1);
+        mTraceCounters.emit(TraceCounter::kStale, 1);
     }
     // Reset to default uclamp value.
     setUclamp(0);
@@ -430,47 +393,28 @@ void PowerHintSession::setStale() {
     updateUniveralBoostMode();
 }
 
-void PowerHintSession::StaleHandler::updateStaleTimer() {
-    std::lock_guard<std::mutex> guard(mStaleLock);
-    if (PowerHintMonitor::getInstance()->isRunning()) {
-        auto when = getStaleTime();
-        auto now = std::chrono::steady_clock::now();
-        mLastUpdatedTime.store(now);
-        if (now > when) {
-            mSession->updateUniveralBoostMode();
-        }
-        if (!mIsMonitoringStale.load()) {
-            auto next = getStaleTime();
-            PowerHintMonitor::getInstance()->getLooper()->sendMessageDelayed(
-                    duration_cast<nanoseconds>(next - now).count(), this, NULL);
-            mIsMonitoringStale.store(true);
-        }
-        if (ATRACE_ENABLED()) {
-            const std::string idstr = mSession->getIdString();
-            std::string sz = StringPrintf("adpf.%s-stale", idstr.c_str());
-            ATRACE_INT(sz.c_str(), 0);
-        }
+void PowerHintSession::refreshStaleTimer() {
+    if (!PowerHintMonitor::getInstance()->isRunning() || mSessionClosed.load()) {
+        return;
     }
-}
-
-time_point<steady_clock> PowerHintSession::StaleHandler::getStaleTime() {
-    return mLastUpdatedTime.load() +
-           std::chrono::duration_cast<milliseconds>(mSession->kAdpfRate) * sStaleTimeFactor;
-}
-
-void PowerHintSession::StaleHandler::handleMessage(const Message &) {
-    std::lock_guard<std::mutex> guard(mStaleLock);
     auto now = std::chrono::steady_clock::now();
     auto when = getStaleTime();
-    // Check if the session is stale based on the last_updated_time.
+    mLastUpdatedTime.store(now.time_since_epoch().count());
     if (now > when) {
-        mSession->setStale();
-        mIsMonitoringStale.store(false);
-        return;
+        updateUniveralBoostMode();
+    }
+    // Only the report that finds the timer disarmed pays for the wheel lock.
+    if (!mStaleTimerArmed.exchange(true)) {
+        PowerHintMonitor::getInstance()->getStaleTimerWheel()->arm(this);
+    }
+    if (ATRACE_ENABLED()) {
+        mTraceCounters.emit(TraceCounter::kStale, 0);
     }
-    // Schedule for the next checking time.
-    PowerHintMonitor::getInstance()->getLooper()->sendMessageDelayed(
-            duration_cast<nanoseconds>(when - now).count(), this, NULL);
+}
+
+time_point<steady_clock> PowerHintSession::getStaleTime() const {
+    return time_point<steady_clock>(steady_clock::duration(mLastUpdatedTime.load())) +
+           kStaleTimeout;
 }
 
 }  // namespace pixel
@@ -21,9 +21,13 @@
 #include <utils/Looper.h>
 #include <utils/Thread.h>
 
+#include <atomic>
 #include <mutex>
+#include <string>
 #include <unordered_map>
 
+#include "AdpfPidController.h"
+
 namespace aidl {
 namespace google {
 namespace hardware {
@@ -42,29 +46,80 @@ using std::chrono::steady_clock;
 using std::chrono::time_point;
 
 static const int32_t kMaxUclampValue = 1024;
+
 struct AppHintDesc {
     AppHintDesc(int32_t tgid, int32_t uid, std::vector<int> threadIds)
         : tgid(tgid),
           uid(uid),
           threadIds(std::move(threadIds)),
-          duration(0LL),
           current_min(0),
+          current_max(kMaxUclampValue),
           is_active(true),
+          seq(0),
+          duration(0),
           update_count(0),
           integral_error(0),
           previous_error(0) {}
     std::string toString() const;
+    // The controller state is only written by the binder calls of the
+    // session, which are oneway and therefore delivered one at a time even
+    // with a binder thread pool, so the writer takes no lock:
+    // it reads with load() and publishes with store(). Other threads read a
+    // consistent copy with snapshot(), which retries while a store is in
+    // progress.
+    PidState load() const;
+    void store(const PidState &state);
+    PidState snapshot() const;
     const int32_t tgid;
     const int32_t uid;
     const std::vector<int> threadIds;
-    nanoseconds duration;
-    int current_min;
+    // last requested uclamp
+    std::atomic<int> current_min;
+    std::atomic<int> current_max;
     // status
     std::atomic<bool> is_active;
+
+  private:
+    std::atomic<uint32_t> seq;  // odd while a store is in progress
+    std::atomic<int64_t> duration;
     // pid
-    uint64_t update_count;
-    int64_t integral_error;
-    int64_t previous_error;
+    std::atomic<uint64_t> update_count;
+    std::atomic<int64_t> integral_error;
+    std::atomic<int64_t> previous_error;
+};
+
+// Trace counters of a session, named "adpf.<tgid>-<uid>-<id>-<counter>"
+enum class TraceCounter : uint8_t {
+    kTarget,
+    kActive,
+    kStale,
+    kActualLast,
+    kUclampMin,
+    kWakeup,
+    kError,
+    kIntegral,
+    kDerivative,
+    kSampleSize,
+    kPidCount,
+    kPidPOut,
+    kPidIOut,
+    kPidDOut,
+    kPidOutput,
+    kPidOvertime,
+};
+constexpr size_t kTraceCounterCount = static_cast<size_t>(TraceCounter::kPidOvertime) + 1;
+
+// Builds the counter names of a session once, in a single buffer, so that
+// emitting a counter does not format or allocate.
+class SessionTraceCounters {
+  public:
+    SessionTraceCounters() = default;
+    explicit SessionTraceCounters(const std::string &idstr);
+    void emit(TraceCounter counter, int64_t value) const;
+
+  private:
+    std::string mNames;  // NUL separated
+    uint16_t mOffsets[kTraceCounterCount] = {};
 };
 
 class PowerHintSession : public BnPowerHintSession {
@@ -81,34 +136,30 @@ class PowerHintSession : public BnPowerHintSession {
     bool isActive();
     bool isStale();
     const std::vector<int> &getTidList() const;
+    // The uclamp requested for the session's threads
+    int32_t getUclampMin() const;
+    int32_t getUclampMax() const;
+    std::string toString() const;
 
   private:
-    class StaleHandler : public MessageHandler {
-      public:
-        StaleHandler(PowerHintSession *session)
-            : mSession(session), mIsMonitoringStale(false), mLastUpdatedTime(steady_clock::now()) {}
-        void handleMessage(const Message &message) override;
-        void updateStaleTimer();
-        time_point<steady_clock> getStaleTime();
-
-      private:
-        PowerHintSession *mSession;
-        std::atomic<bool> mIsMonitoringStale;
-        std::atomic<time_point<steady_clock>> mLastUpdatedTime;
-        std::mutex mStaleLock;
-    };
-
-  private:
+    friend class StaleTimerWheel;
     void setStale();
+    void refreshStaleTimer();
+    time_point<steady_clock> getStaleTime() const;
     void updateUniveralBoostMode();
     int setUclamp(int32_t min, int32_t max = kMaxUclampValue);
     std::string getIdString() const;
     AppHintDesc *mDescriptor = nullptr;
-    sp<StaleHandler> mStaleHandler;
+    SessionTraceCounters mTraceCounters;
     sp<MessageHandler> mPowerManagerHandler;
-    std::mutex mLock;
     const nanoseconds kAdpfRate;
+    const nanoseconds kStaleTimeout;
     std::atomic<bool> mSessionClosed = false;
+    // Stale detection: a frame report stores its time, and the session sits
+    // in the StaleTimerWheel while armed.
+    std::atomic<steady_clock::rep> mLastUpdatedTime;
+    std::atomic<bool> mStaleTimerArmed = false;
+    size_t mStaleTimerSlot = 0;  // protected by the StaleTimerWheel lock
 };
 
 }  // namespace pixel
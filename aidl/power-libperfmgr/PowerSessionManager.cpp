@@ -17,10 +17,18 @@
 #define LOG_TAG "powerhal-libperfmgr"
 #define ATRACE_TAG (ATRACE_TAG_POWER | ATRACE_TAG_HAL)
 
+#include <errno.h>
+
+#include <algorithm>
+
+#include <android-base/file.h>
+#include <android-base/properties.h>
 #include <log/log.h>
 #include <processgroup/processgroup.h>
+#include <sys/syscall.h>
 #include <utils/Trace.h>
 
+#include "HintRecorder.h"
 #include "PowerSessionManager.h"
 
 namespace aidl {
@@ -30,10 +38,41 @@ namespace power {
 namespace impl {
 namespace pixel {
 
-void PowerSessionManager::setHintManager(std::shared_ptr<HintManager> const &hint_manager) {
-    // Only initialize hintmanager instance if hint is supported.
-    if (hint_manager->IsHintSupported(kDisableBoostHintName)) {
-        mHintManager = hint_manager;
+using std::chrono::duration_cast;
+
+constexpr char kPowerHalAdpfUclampEnable[] = "vendor.powerhal.adpf.uclamp";
+
+namespace {
+/* there is no glibc or bionic wrapper */
+struct sched_attr {
+    __u32 size;
+    __u32 sched_policy;
+    __u64 sched_flags;
+    __s32 sched_nice;
+    __u32 sched_priority;
+    __u64 sched_runtime;
+    __u64 sched_deadline;
+    __u64 sched_period;
+    __u32 sched_util_min;
+    __u32 sched_util_max;
+};
+
+static int sched_setattr(int pid, struct sched_attr *attr, unsigned int flags) {
+    static const bool kPowerHalAdpfUclamp =
+            ::android::base::GetBoolProperty(kPowerHalAdpfUclampEnable, true);
+    if (!kPowerHalAdpfUclamp) {
+        ALOGV("PowerSessionManager:%s: skip", __func__);
+        return 0;
+    }
+    return syscall(__NR_sched_setattr, pid, attr, flags);
+}
+}  // namespace
+
+void PowerSessionManager::setHintCoalescer(std::shared_ptr<HintCoalescer> const &hint_coalescer) {
+    // Only initialize the coalescer instance if the hint is supported.
+    mDisableBoostHintId = hint_coalescer->getId(kDisableBoostHintName);
+    if (mDisableBoostHintId != HintCoalescer::kInvalidHint) {
+        mHintCoalescer = hint_coalescer;
     }
 }
 
@@ -55,7 +94,7 @@ int PowerSessionManager::getDisplayRefreshRate() {
 }
 
 void PowerSessionManager::addPowerSession(PowerHintSession *session) {
-    std::lock_guard<std::mutex> guard(mLock);
+    std::lock_guard<std::mutex> guard(mSessionsLock);
     for (auto t : session->getTidList()) {
         if (mTidRefCountMap.find(t) == mTidRefCountMap.end()) {
             if (!SetTaskProfiles(t, {"ResetUclampGrp"})) {
@@ -75,7 +114,9 @@ void PowerSessionManager::addPowerSession(PowerHintSession *session) {
 }
 
 void PowerSessionManager::removePowerSession(PowerHintSession *session) {
-    std::lock_guard<std::mutex> guard(mLock);
+    std::lock_guard<std::mutex> uclampGuard(mUclampLock);
+    std::lock_guard<std::mutex> guard(mSessionsLock);
+    bool shared = false;
     for (auto t : session->getTidList()) {
         if (mTidRefCountMap.find(t) == mTidRefCountMap.end()) {
             ALOGE("Unexpected Error! Failed to look up tid:%d in TidRefCountMap", t);
@@ -83,17 +124,87 @@ void PowerSessionManager::removePowerSession(PowerHintSession *session) {
         }
         mTidRefCountMap[t]--;
         if (mTidRefCountMap[t] <= 0) {
+            // Reset right away, the thread may be reused once the session is gone.
+            auto applied = mAppliedUclamp.find(t);
+            if (applied != mAppliedUclamp.end()) {
+                const Uclamp reset = {0, kMaxUclampValue};
+                if (applied->second != reset) {
+                    setThreadUclampLocked(t, reset);
+                }
+                mAppliedUclamp.erase(applied);
+            }
             if (!SetTaskProfiles(t, {"NoResetUclampGrp"})) {
                 ALOGW("Failed to set NoResetUclampGrp task profile for tid:%d", t);
             }
             mTidRefCountMap.erase(t);
+        } else {
+            shared = true;
         }
     }
     mSessions.erase(session);
+    if (shared) {
+        // Other sessions still hold some threads, drop this session's clamp.
+        requestUclampUpdate();
+    }
+}
+
+void PowerSessionManager::requestUclampUpdate() {
+    if (!mUclampUpdatePending.exchange(true)) {
+        PowerHintMonitor::getInstance()->getLooper()->sendMessage(this,
+                                                                  Message(kMsgUpdateUclamp));
+    }
+}
+
+void PowerSessionManager::setThreadUclampLocked(int tid, const Uclamp &uclamp) {
+    sched_attr attr = {};
+    attr.size = sizeof(attr);
+
+    attr.sched_flags = (SCHED_FLAG_KEEP_ALL | SCHED_FLAG_UTIL_CLAMP);
+    attr.sched_util_min = uclamp.min;
+    attr.sched_util_max = uclamp.max;
+
+    int ret = sched_setattr(tid, &attr, 0);
+    if (ret) {
+        ALOGW("sched_setattr failed for thread %d, err=%d", tid, errno);
+    }
+    ALOGV("PowerSessionManager tid: %d, uclamp(%d, %d)", tid, uclamp.min, uclamp.max);
+    HintRecorder::getInstance().record(HintRecorder::Event::kUclamp, tid,
+                                       (static_cast<int64_t>(uclamp.min) << 16) | uclamp.max);
+}
+
+// Runs on the looper. Sessions sharing a thread each request a clamp for it;
+// the thread gets the highest of them, and only threads whose effective
+// clamp changed since the last run are touched.
+void PowerSessionManager::updateUclampLocked() {
+    ATRACE_CALL();
+    mTargetUclamp.clear();
+    {
+        std::lock_guard<std::mutex> guard(mSessionsLock);
+        for (PowerHintSession *s : mSessions) {
+            const Uclamp requested = {s->getUclampMin(), s->getUclampMax()};
+            for (int tid : s->getTidList()) {
+                auto [it, inserted] = mTargetUclamp.try_emplace(tid, requested);
+                if (!inserted) {
+                    it->second.min = std::max(it->second.min, requested.min);
+                    it->second.max = std::max(it->second.max, requested.max);
+                }
+            }
+        }
+    }
+
+    for (auto &[tid, target] : mTargetUclamp) {
+        target.min = std::min(target.min, target.max);
+        auto applied = mAppliedUclamp.find(tid);
+        if (applied != mAppliedUclamp.end() && applied->second == target) {
+            continue;
+        }
+        setThreadUclampLocked(tid, target);
+        mAppliedUclamp[tid] = target;
+    }
 }
 
 std::optional<bool> PowerSessionManager::isAnySessionActive() {
-    std::lock_guard<std::mutex> guard(mLock);
+    std::lock_guard<std::mutex> guard(mSessionsLock);
     bool active = false;
     for (PowerHintSession *s : mSessions) {
         // session active and not stale is actually active.
@@ -111,7 +222,14 @@ std::optional<bool> PowerSessionManager::isAnySessionActive() {
     return active;
 }
 
-void PowerSessionManager::handleMessage(const Message &) {
+void PowerSessionManager::handleMessage(const Message &message) {
+    if (message.what == kMsgUpdateUclamp) {
+        mUclampUpdatePending.store(false);
+        std::lock_guard<std::mutex> guard(mUclampLock);
+        updateUclampLocked();
+        return;
+    }
+
     auto active = isAnySessionActive();
     if (!active.has_value()) {
         return;
@@ -124,19 +242,155 @@ void PowerSessionManager::handleMessage(const Message &) {
 }
 
 void PowerSessionManager::enableSystemTopAppBoost() {
-    if (mHintManager) {
+    if (mHintCoalescer) {
         ALOGV("PowerSessionManager::enableSystemTopAppBoost!!");
-        mHintManager->EndHint(kDisableBoostHintName);
+        mHintCoalescer->endHint(mDisableBoostHintId);
     }
 }
 
 void PowerSessionManager::disableSystemTopAppBoost() {
-    if (mHintManager) {
+    if (mHintCoalescer) {
         ALOGV("PowerSessionManager::disableSystemTopAppBoost!!");
-        mHintManager->DoHint(kDisableBoostHintName);
+        mHintCoalescer->doHint(mDisableBoostHintId);
+    }
+}
+
+void PowerSessionManager::dumpToFd(int fd) {
+    std::string buf("ADPF sessions:\n");
+    {
+        std::lock_guard<std::mutex> guard(mSessionsLock);
+        for (PowerHintSession *s : mSessions) {
+            buf.append(s->toString());
+        }
+    }
+    if (!::android::base::WriteStringToFd(buf, fd)) {
+        ALOGE("Failed to dump ADPF sessions to fd");
     }
 }
 
+// =========== StaleTimerWheel implementation start from here ===========
+int64_t StaleTimerWheel::toTick(time_point<steady_clock> t) const {
+    // Round up so that a session is never swept before its deadline
+    const int64_t ns = duration_cast<nanoseconds>(t.time_since_epoch()).count();
+    return (ns + mTick.count() - 1) / mTick.count();
+}
+
+void StaleTimerWheel::arm(PowerHintSession *session) {
+    std::lock_guard<std::mutex> guard(mLock);
+    auto now = std::chrono::steady_clock::now();
+    if (mCount == 0) {
+        mTick = session->kAdpfRate;
+        mLastSweptTick = toTick(now) - 1;
+    }
+    insertLocked(session, toTick(session->getStaleTime()));
+    scheduleLocked(now);
+}
+
+void StaleTimerWheel::disarm(PowerHintSession *session) {
+    std::lock_guard<std::mutex> guard(mLock);
+    if (session->mStaleTimerArmed.exchange(false)) {
+        removeLocked(session);
+    }
+}
+
+void StaleTimerWheel::insertLocked(PowerHintSession *session, int64_t tick) {
+    // Slots up to the last swept tick won't be visited until the next lap
+    tick = std::max(tick, mLastSweptTick + 1);
+    session->mStaleTimerSlot = static_cast<size_t>(tick) % kSlots;
+    mSlots[session->mStaleTimerSlot].push_back(session);
+    mCount++;
+}
+
+void StaleTimerWheel::removeLocked(PowerHintSession *session) {
+    auto &slot = mSlots[session->mStaleTimerSlot];
+    auto it = std::find(slot.begin(), slot.end(), session);
+    if (it == slot.end()) {
+        ALOGE("Unexpected Error! Session not found in stale timer slot %zu",
+              session->mStaleTimerSlot);
+        return;
+    }
+    *it = slot.back();
+    slot.pop_back();
+    mCount--;
+}
+
+void StaleTimerWheel::sweepSlotLocked(size_t index, time_point<steady_clock> now) {
+    auto &slot = mSlots[index];
+    for (size_t i = 0; i < slot.size();) {
+        PowerHintSession *session = slot[i];
+        if (now < session->getStaleTime()) {
+            size_t due = static_cast<size_t>(toTick(session->getStaleTime())) % kSlots;
+            if (due == index) {
+                i++;
+                continue;
+            }
+            // Reported since it was placed, move it to its new deadline
+            removeLocked(session);
+            insertLocked(session, toTick(session->getStaleTime()));
+            continue;
+        }
+
+        removeLocked(session);
+        session->mStaleTimerArmed.store(false);
+        // A report that raced with the disarm re-arms the session itself once
+        // it gets the lock; only expire the session if it is still stale.
+        if (now >= session->getStaleTime()) {
+            HintRecorder::getInstance().record(HintRecorder::Event::kSessionStale, 0, 0,
+                                               reinterpret_cast<uintptr_t>(session));
+            session->setStale();
+        } else if (!session->mStaleTimerArmed.exchange(true)) {
+            insertLocked(session, toTick(session->getStaleTime()));
+        }
+    }
+}
+
+// First tick after the last sweep whose slot holds a session. Sessions are
+// never in a slot later than their deadline, so nothing is due before it.
+int64_t StaleTimerWheel::nextDueTickLocked() const {
+    for (int64_t tick = mLastSweptTick + 1; tick <= mLastSweptTick + static_cast<int64_t>(kSlots);
+         tick++) {
+        if (!mSlots[static_cast<size_t>(tick) % kSlots].empty()) {
+            return tick;
+        }
+    }
+    return mLastSweptTick + 1;
+}
+
+void StaleTimerWheel::scheduleLocked(time_point<steady_clock> now) {
+    if (mCount == 0) {
+        return;
+    }
+    const int64_t tick = nextDueTickLocked();
+    if (mScheduled && mScheduledTick <= tick) {
+        return;
+    }
+    // A session armed ahead of the pending wake-up moves it earlier
+    sp<Looper> looper = PowerHintMonitor::getInstance()->getLooper();
+    if (mScheduled) {
+        looper->removeMessages(this);
+    }
+    auto next = time_point<steady_clock>(duration_cast<steady_clock::duration>(mTick * tick));
+    looper->sendMessageDelayed(
+            std::max<int64_t>(0, duration_cast<nanoseconds>(next - now).count()), this, NULL);
+    mScheduled = true;
+    mScheduledTick = tick;
+}
+
+void StaleTimerWheel::handleMessage(const Message &) {
+    ATRACE_CALL();
+    std::lock_guard<std::mutex> guard(mLock);
+    mScheduled = false;
+    auto now = std::chrono::steady_clock::now();
+    int64_t nowTick = duration_cast<nanoseconds>(now.time_since_epoch()) / mTick;
+    // After a long sleep every slot is visited once
+    int64_t first = std::max(mLastSweptTick + 1, nowTick - static_cast<int64_t>(kSlots) + 1);
+    for (int64_t tick = first; tick <= nowTick; tick++) {
+        sweepSlotLocked(static_cast<size_t>(tick) % kSlots, now);
+    }
+    mLastSweptTick = std::max(mLastSweptTick, nowTick);
+    scheduleLocked(now);
+}
+
 // =========== PowerHintMonitor implementation start from here ===========
 void PowerHintMonitor::start() {
     if (!isRunning()) {
@@ -155,6 +409,10 @@ sp<Looper> PowerHintMonitor::getLooper() {
     return mLooper;
 }
 
+sp<StaleTimerWheel> PowerHintMonitor::getStaleTimerWheel() {
+    return mStaleTimerWheel;
+}
+
 }  // namespace pixel
 }  // namespace impl
 }  // namespace power
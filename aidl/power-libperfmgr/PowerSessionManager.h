@@ -16,15 +16,17 @@
 
 #pragma once
 
+#include "HintCoalescer.h"
 #include "PowerHintSession.h"
 
 #include <android-base/properties.h>
-#include <perfmgr/HintManager.h>
 #include <utils/Looper.h>
 
+#include <atomic>
 #include <mutex>
 #include <optional>
 #include <unordered_set>
+#include <vector>
 
 namespace aidl {
 namespace google {
@@ -37,7 +39,6 @@ using ::android::Looper;
 using ::android::Message;
 using ::android::MessageHandler;
 using ::android::Thread;
-using ::android::perfmgr::HintManager;
 
 constexpr char kPowerHalAdpfDisableTopAppBoost[] = "vendor.powerhal.adpf.disable.hint";
 
@@ -50,8 +51,13 @@ class PowerSessionManager : public MessageHandler {
     void addPowerSession(PowerHintSession *session);
     void removePowerSession(PowerHintSession *session);
 
+    // Re-evaluates the uclamp of all session threads on the PowerHintMonitor
+    // looper. Requests made before it runs are coalesced.
+    void requestUclampUpdate();
+
     void handleMessage(const Message &message) override;
-    void setHintManager(std::shared_ptr<HintManager> const &hint_manager);
+    void setHintCoalescer(std::shared_ptr<HintCoalescer> const &hint_coalescer);
+    void dumpToFd(int fd);
 
     // Singleton
     static sp<PowerSessionManager> getInstance() {
@@ -60,32 +66,89 @@ class PowerSessionManager : public MessageHandler {
     }
 
   private:
+    // Message::what of the looper messages
+    enum { kMsgUpdateBoost = 0, kMsgUpdateUclamp = 1 };
+
+    struct Uclamp {
+        int32_t min;
+        int32_t max;
+        bool operator==(const Uclamp &other) const {
+            return min == other.min && max == other.max;
+        }
+        bool operator!=(const Uclamp &other) const { return !(*this == other); }
+    };
+
     std::optional<bool> isAnySessionActive();
     void disableSystemTopAppBoost();
     void enableSystemTopAppBoost();
+    void updateUclampLocked();
+    void setThreadUclampLocked(int tid, const Uclamp &uclamp);
     const std::string kDisableBoostHintName;
-    std::shared_ptr<HintManager> mHintManager;
-    std::unordered_set<PowerHintSession *> mSessions;  // protected by mLock
-    std::unordered_map<int, int> mTidRefCountMap;      // protected by mLock
-    std::mutex mLock;
-    int mDisplayRefreshRate;
-    bool mActive;  // protected by mLock
+    std::shared_ptr<HintCoalescer> mHintCoalescer;
+    HintCoalescer::HintId mDisableBoostHintId;
+    // Session reports do not take either lock. mSessionsLock guards the
+    // session set, taken when sessions come and go and by the looper;
+    // mUclampLock guards the uclamp arbiter and is taken before
+    // mSessionsLock when both are needed.
+    std::mutex mSessionsLock;
+    std::unordered_set<PowerHintSession *> mSessions;  // protected by mSessionsLock
+    std::unordered_map<int, int> mTidRefCountMap;      // protected by mSessionsLock
+    bool mActive;                                      // protected by mSessionsLock
+    std::mutex mUclampLock;
+    // Effective uclamp of every session thread: the highest min and max
+    // requested by the sessions holding it, as last applied to the thread.
+    std::unordered_map<int, Uclamp> mAppliedUclamp;  // protected by mUclampLock
+    std::unordered_map<int, Uclamp> mTargetUclamp;   // scratch, protected by mUclampLock
+    std::atomic<bool> mUclampUpdatePending;
+    std::atomic<int> mDisplayRefreshRate;
     // Singleton
     PowerSessionManager()
         : kDisableBoostHintName(::android::base::GetProperty(kPowerHalAdpfDisableTopAppBoost,
                                                              "ADPF_DISABLE_TA_BOOST")),
-          mHintManager(nullptr),
-          mDisplayRefreshRate(60),
-          mActive(false) {}
+          mHintCoalescer(nullptr),
+          mDisableBoostHintId(HintCoalescer::kInvalidHint),
+          mActive(false),
+          mUclampUpdatePending(false),
+          mDisplayRefreshRate(60) {}
     PowerSessionManager(PowerSessionManager const &) = delete;
     void operator=(PowerSessionManager const &) = delete;
 };
 
+// Detects stale sessions on the PowerHintMonitor looper. Armed sessions are
+// hashed by their stale deadline into slots one tick (the ADPF rate) wide and
+// the looper only wakes up at the tick of the next non-empty slot, so a sweep
+// only looks at the sessions due in that slot and a frame report just stores
+// a timestamp. A session whose deadline is more than a lap away stays in its
+// slot for later laps.
+class StaleTimerWheel : public MessageHandler {
+  public:
+    void arm(PowerHintSession *session);
+    void disarm(PowerHintSession *session);
+    void handleMessage(const Message &message) override;
+
+  private:
+    static constexpr size_t kSlots = 64;
+    int64_t toTick(time_point<steady_clock> t) const;
+    void insertLocked(PowerHintSession *session, int64_t tick);
+    void removeLocked(PowerHintSession *session);
+    void sweepSlotLocked(size_t slot, time_point<steady_clock> now);
+    int64_t nextDueTickLocked() const;
+    void scheduleLocked(time_point<steady_clock> now);
+    std::mutex mLock;
+    std::vector<PowerHintSession *> mSlots[kSlots];  // protected by mLock
+    size_t mCount = 0;                               // protected by mLock
+    nanoseconds mTick{0};                            // protected by mLock
+    int64_t mLastSweptTick = 0;                      // protected by mLock
+    bool mScheduled = false;                         // protected by mLock
+    int64_t mScheduledTick = 0;                      // protected by mLock
+};
+
 class PowerHintMonitor : public Thread {
   public:
     void start();
     bool threadLoop() override;
     sp<Looper> getLooper();
+    sp<StaleTimerWheel> getStaleTimerWheel();
     // Singleton
     static sp<PowerHintMonitor> getInstance() {
         static sp<PowerHintMonitor> instance = new PowerHintMonitor();
@@ -96,8 +159,10 @@ class PowerHintMonitor : public Thread {
 
   private:
     sp<Looper> mLooper;
+    sp<StaleTimerWheel> mStaleTimerWheel;
     // Singleton
-    PowerHintMonitor() : Thread(false), mLooper(new Looper(true)) {}
+    PowerHintMonitor()
+        : Thread(false), mLooper(new Looper(true)), mStaleTimerWheel(new StaleTimerWheel()) {}
 };
 
 }  // namespace pixel
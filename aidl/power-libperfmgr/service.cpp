@@ -23,10 +23,12 @@
 #include <android/binder_manager.h>
 #include <android/binder_process.h>
 
+#include "HintCoalescer.h"
 #include "Power.h"
 #include "PowerExt.h"
 #include "PowerSessionManager.h"
 
+using aidl::google::hardware::power::impl::pixel::HintCoalescer;
 using aidl::google::hardware::power::impl::pixel::Power;
 using aidl::google::hardware::power::impl::pixel::PowerExt;
 using aidl::google::hardware::power::impl::pixel::PowerHintMonitor;
@@ -36,6 +38,8 @@ using ::android::perfmgr::HintManager;
 constexpr std::string_view kPowerHalInitProp("vendor.powerhal.init");
 constexpr std::string_view kConfigProperty("vendor.powerhal.config");
 constexpr std::string_view kConfigDefaultFileName("powerhint.json");
+constexpr std::string_view kHintCoalesceProp("vendor.powerhal.hint.coalesce_ms");
+constexpr std::string_view kBinderThreadsProp("vendor.powerhal.binder.threads");
 
 int main() {
     const std::string config_path =
@@ -50,15 +54,27 @@ int main() {
         LOG(FATAL) << "Invalid config: " << config_path;
     }
 
-    // single thread
-    ABinderProcess_setThreadPoolMaxThreadCount(0);
+    // Single thread unless configured otherwise. The oneway calls of one
+    // binder are still delivered in order, so extra threads let different
+    // sessions and the synchronous calls run in parallel.
+    const uint32_t binderThreads =
+            android::base::GetUintProperty<uint32_t>(kBinderThreadsProp.data(), 0);
+    ABinderProcess_setThreadPoolMaxThreadCount(binderThreads);
+    if (binderThreads > 0) {
+        ABinderProcess_startThreadPool();
+    }
+
+    // Every hint request of the HAL is applied to hm from a single worker
+    std::shared_ptr<HintCoalescer> hc = std::make_shared<HintCoalescer>(
+            hm, std::chrono::milliseconds(
+                        android::base::GetUintProperty<uint32_t>(kHintCoalesceProp.data(), 20)));
 
     // core service
-    std::shared_ptr<Power> pw = ndk::SharedRefBase::make<Power>(hm);
+    std::shared_ptr<Power> pw = ndk::SharedRefBase::make<Power>(hm, hc);
     ndk::SpAIBinder pwBinder = pw->asBinder();
 
     // extension service
-    std::shared_ptr<PowerExt> pwExt = ndk::SharedRefBase::make<PowerExt>(hm);
+    std::shared_ptr<PowerExt> pwExt = ndk::SharedRefBase::make<PowerExt>(hm, hc);
 
     // attach the extension to the same binder we will be registering
     CHECK(STATUS_OK == AIBinder_setExtension(pwBinder.get(), pwExt->asBinder().get()));
@@ -70,7 +86,7 @@ int main() {
 
     if (::android::base::GetIntProperty("vendor.powerhal.adpf.rate", -1) != -1) {
         PowerHintMonitor::getInstance()->start();
-        PowerSessionManager::getInstance()->setHintManager(hm);
+        PowerSessionManager::getInstance()->setHintCoalescer(hc);
     }
 
     std::thread initThread([&]() {
@@ -0,0 +1,84 @@
+/*
+ * Copyright 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <aidl/android/hardware/power/Boost.h>
+#include <aidl/android/hardware/power/Mode.h>
+#include <android-base/file.h>
+#include <android/binder_enums.h>
+#include <perfmgr/HintManager.h>
+
+#include <memory>
+#include <string>
+
+namespace aidl {
+namespace google {
+namespace hardware {
+namespace power {
+namespace impl {
+namespace pixel {
+
+// A started HintManager for the tools, in which every Boost and Mode sets a
+// single node in a temporary directory instead of a sysfs node
+class TempHintManager {
+  public:
+    TempHintManager() {
+        using ::aidl::android::hardware::power::Boost;
+        using ::aidl::android::hardware::power::Mode;
+        using ::android::base::WriteStringToFile;
+
+        const std::string node = std::string(mDir.path) + "/node";
+        std::string config = "{\"Nodes\":[{\"Name\":\"Temp\",\"Path\":\"" + node +
+                             "\",\"Values\":[\"1\",\"0\"],\"DefaultIndex\":1,"
+                             "\"ResetOnInit\":true}],\"Actions\":[";
+        bool first = true;
+        auto addAction = [&](const std::string &hint) {
+            config += std::string(first ? "" : ",") + "{\"PowerHint\":\"" + hint +
+                      "\",\"Node\":\"Temp\",\"Duration\":0,\"Value\":\"1\"}";
+            first = false;
+        };
+        for (Boost type : ndk::enum_range<Boost>()) {
+            addAction(toString(type));
+        }
+        for (Mode type : ndk::enum_range<Mode>()) {
+            addAction(toString(type));
+        }
+        config += "]}";
+
+        const std::string configPath = std::string(mDir.path) + "/powerhint.json";
+        if (WriteStringToFile("0", node) && WriteStringToFile(config, configPath)) {
+            mHintManager = ::android::perfmgr::HintManager::GetFromJSON(configPath, false);
+        }
+        if (mHintManager) {
+            mHintManager->Start();
+        }
+    }
+
+    // nullptr if the HintManager could not be created
+    const std::shared_ptr<::android::perfmgr::HintManager> &get() const { return mHintManager; }
+
+  private:
+    TemporaryDir mDir;
+    std::shared_ptr<::android::perfmgr::HintManager> mHintManager;
+};
+
+}  // namespace pixel
+}  // namespace impl
+}  // namespace power
+}  // namespace hardware
+}  // namespace google
+}  // namespace aidl
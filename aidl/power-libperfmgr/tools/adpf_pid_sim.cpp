@@ -0,0 +1,266 @@
+/*
+ * Copyright 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Replays a recorded WorkDuration trace through the ADPF PID controller
+// against a simple CPU capacity model, to tune the controller on a host.
+//
+// The trace is a text file of "timestamp_ns,duration_ns[,target_ns]" lines,
+// '#' starting a comment; a line without a target keeps the previous one.
+// Each recorded duration is taken as work done at --recorded-uclamp and is
+// scaled by the capacity ratio of the uclamp the controller would have
+// applied:
+//
+//   capacity(u) = max(u, --base-capacity) / 1024
+//   simulated   = recorded * capacity(recorded) / capacity(current)
+//
+// Any controller parameter takes a comma separated list of values, and the
+// simulator runs and reports every combination:
+//
+//   adpf_pid_sim --p-over=1,2,4 --i=0.001,0.002 trace.csv
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "../AdpfPidController.h"
+
+using aidl::google::hardware::power::impl::pixel::AdpfPidController;
+using aidl::google::hardware::power::impl::pixel::AdpfPidParams;
+using aidl::google::hardware::power::impl::pixel::PidState;
+
+namespace {
+
+constexpr int32_t kMaxUclampValue = 1024;
+
+struct Sample {
+    int64_t timestampNanos;
+    int64_t durationNanos;
+    int64_t targetNanos;
+};
+
+struct SimOptions {
+    size_t batch = 1;
+    int32_t recordedUclamp = 0;
+    int32_t baseCapacity = 256;
+};
+
+struct SimResult {
+    size_t frames = 0;
+    size_t misses = 0;
+    double uclampSum = 0;
+    std::vector<int64_t> durations;
+};
+
+// A parameter that can be swept, and how to set it from a value
+struct Param {
+    const char *name;
+    std::function<void(AdpfPidParams *, double)> set;
+    std::vector<double> values;
+};
+
+std::vector<double> parseList(const char *arg) {
+    std::vector<double> values;
+    std::string s(arg);
+    size_t pos = 0;
+    while (pos <= s.size()) {
+        size_t end = s.find(',', pos);
+        if (end == std::string::npos)
+            end = s.size();
+        values.push_back(strtod(s.substr(pos, end - pos).c_str(), nullptr));
+        pos = end + 1;
+    }
+    return values;
+}
+
+bool readTrace(const char *path, std::vector<Sample> *out) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Unable to open %s\n", path);
+        return false;
+    }
+
+    char line[256];
+    int64_t target = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        long long ts, duration, t;
+        int n = sscanf(line, "%lld,%lld,%lld", &ts, &duration, &t);
+        if (n < 2) {
+            fprintf(stderr, "Skipping malformed line: %s", line);
+            continue;
+        }
+        if (n == 3)
+            target = t;
+        if (target <= 0) {
+            fprintf(stderr, "No target before: %s", line);
+            continue;
+        }
+        out->push_back({ts, duration, target});
+    }
+    fclose(f);
+    return !out->empty();
+}
+
+double capacity(int32_t uclamp, const SimOptions &opts) {
+    return std::max(uclamp, opts.baseCapacity) / static_cast<double>(kMaxUclampValue);
+}
+
+SimResult simulate(const std::vector<Sample> &trace, const AdpfPidParams &params,
+                   const SimOptions &opts) {
+    const AdpfPidController controller(params);
+    PidState state = {};
+    controller.setTarget(&state, trace.front().targetNanos);
+    int32_t uclampMin = params.uclampMinHighLimit;
+
+    SimResult result;
+    result.durations.reserve(trace.size());
+    std::vector<Sample> report;
+    for (const Sample &s : trace) {
+        if (s.targetNanos != state.durationNanos)
+            controller.setTarget(&state, s.targetNanos);
+
+        Sample simulated = s;
+        simulated.durationNanos = static_cast<int64_t>(
+                s.durationNanos * capacity(opts.recordedUclamp, opts) / capacity(uclampMin, opts));
+        result.frames++;
+        result.misses += simulated.durationNanos > s.targetNanos;
+        result.uclampSum += uclampMin;
+        result.durations.push_back(simulated.durationNanos);
+
+        report.push_back(simulated);
+        if (report.size() < opts.batch)
+            continue;
+
+        int64_t output = controller.update(report, &state).output;
+        state.update_count++;
+        int32_t next = controller.nextUclampMin(output, uclampMin);
+        if (next >= 0)
+            uclampMin = next;
+        report.clear();
+    }
+    return result;
+}
+
+void printResult(const std::vector<Param> &params, const std::vector<size_t> &index,
+                 SimResult *r) {
+    std::sort(r->durations.begin(), r->durations.end());
+    auto pct = [&](int p) { return r->durations[(r->durations.size() - 1) * p / 100]; };
+    for (size_t i = 0; i < params.size(); i++) {
+        if (params[i].values.size() > 1)
+            printf("%s=%g ", params[i].name, params[i].values[index[i]]);
+    }
+    printf("frames=%zu miss_rate=%.4f avg_uclamp=%.1f p50_ns=%" PRId64 " p95_ns=%" PRId64 "\n",
+           r->frames, static_cast<double>(r->misses) / r->frames, r->uclampSum / r->frames,
+           pct(50), pct(95));
+}
+
+void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [options] trace.csv\n"
+            "  --batch=N             frames per reportActualWorkDuration (1)\n"
+            "  --recorded-uclamp=N   uclamp min the trace was recorded at (0)\n"
+            "  --base-capacity=N     capacity without any uclamp, of 1024 (256)\n"
+            "controller parameters, each a comma separated list:\n"
+            "  --p-over --p-under --i --d-over --d-under --i-init --i-high --i-low\n"
+            "  --uclamp-high --uclamp-low --granularity --p-window --i-window --d-window\n",
+            argv0);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    std::vector<Param> params = {
+            {"p-over", [](AdpfPidParams *p, double v) { p->pOver = v; }, {}},
+            {"p-under", [](AdpfPidParams *p, double v) { p->pUnder = v; }, {}},
+            {"i", [](AdpfPidParams *p, double v) { p->i = v; }, {}},
+            {"d-over", [](AdpfPidParams *p, double v) { p->dOver = v; }, {}},
+            {"d-under", [](AdpfPidParams *p, double v) { p->dUnder = v; }, {}},
+            {"i-init", [](AdpfPidParams *p, double v) { p->iInit = v; }, {}},
+            {"i-high", [](AdpfPidParams *p, double v) { p->iHighLimit = v; }, {}},
+            {"i-low", [](AdpfPidParams *p, double v) { p->iLowLimit = v; }, {}},
+            {"uclamp-high", [](AdpfPidParams *p, double v) { p->uclampMinHighLimit = v; }, {}},
+            {"uclamp-low", [](AdpfPidParams *p, double v) { p->uclampMinLowLimit = v; }, {}},
+            {"granularity", [](AdpfPidParams *p, double v) { p->uclampMinGranularity = v; }, {}},
+            {"p-window", [](AdpfPidParams *p, double v) { p->pSamplingWindow = v; }, {}},
+            {"i-window", [](AdpfPidParams *p, double v) { p->iSamplingWindow = v; }, {}},
+            {"d-window", [](AdpfPidParams *p, double v) { p->dSamplingWindow = v; }, {}},
+    };
+    enum { kOptBatch = 1000, kOptRecordedUclamp, kOptBaseCapacity };
+
+    std::vector<struct option> longopts;
+    for (size_t i = 0; i < params.size(); i++)
+        longopts.push_back({params[i].name, required_argument, nullptr, static_cast<int>(i)});
+    longopts.push_back({"batch", required_argument, nullptr, kOptBatch});
+    longopts.push_back({"recorded-uclamp", required_argument, nullptr, kOptRecordedUclamp});
+    longopts.push_back({"base-capacity", required_argument, nullptr, kOptBaseCapacity});
+    longopts.push_back({nullptr, 0, nullptr, 0});
+
+    SimOptions opts;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", longopts.data(), nullptr)) != -1) {
+        if (opt >= 0 && static_cast<size_t>(opt) < params.size()) {
+            params[opt].values = parseList(optarg);
+        } else if (opt == kOptBatch) {
+            opts.batch = std::max(1, atoi(optarg));
+        } else if (opt == kOptRecordedUclamp) {
+            opts.recordedUclamp = atoi(optarg);
+        } else if (opt == kOptBaseCapacity) {
+            opts.baseCapacity = std::max(1, atoi(optarg));
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind + 1 != argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<Sample> trace;
+    if (!readTrace(argv[optind], &trace))
+        return EXIT_FAILURE;
+
+    // Walk every combination, the first parameter varying fastest. Unset
+    // parameters keep the HAL default.
+    std::vector<size_t> index(params.size(), 0);
+    while (true) {
+        AdpfPidParams p;
+        for (size_t i = 0; i < params.size(); i++) {
+            if (!params[i].values.empty())
+                params[i].set(&p, params[i].values[index[i]]);
+        }
+        SimResult r = simulate(trace, p, opts);
+        printResult(params, index, &r);
+
+        size_t i = 0;
+        for (; i < params.size(); i++) {
+            if (++index[i] < params[i].values.size())
+                break;
+            index[i] = 0;
+        }
+        if (i == params.size())
+            break;
+    }
+    return EXIT_SUCCESS;
+}
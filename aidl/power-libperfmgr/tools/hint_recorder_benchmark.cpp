@@ -0,0 +1,57 @@
+/*
+ * Copyright 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Cost of HintRecorder::record() on the calling thread, alone and with
+// several binder threads recording at once, and of reading the full ring.
+
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+#include "../HintRecorder.h"
+
+using aidl::google::hardware::power::impl::pixel::HintRecorder;
+
+namespace {
+
+void BM_Record(benchmark::State &state) {
+    HintRecorder &recorder = HintRecorder::getInstance();
+    int32_t id = state.thread_index();
+
+    for (auto _ : state) {
+        recorder.record(HintRecorder::Event::kSetBoost, id, 100);
+    }
+}
+BENCHMARK(BM_Record)->ThreadRange(1, 8)->UseRealTime();
+
+void BM_Read(benchmark::State &state) {
+    HintRecorder &recorder = HintRecorder::getInstance();
+    std::vector<HintRecorder::Record> records;
+
+    for (size_t i = 0; i < HintRecorder::kCapacity; i++) {
+        recorder.record(HintRecorder::Event::kSetBoost, 0, i);
+    }
+    for (auto _ : state) {
+        recorder.read(&records);
+        benchmark::DoNotOptimize(records.data());
+    }
+    state.SetItemsProcessed(state.iterations() * HintRecorder::kCapacity);
+}
+BENCHMARK(BM_Read);
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,191 @@
+/*
+ * Copyright 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Replays the setMode and setBoost requests of a hint trace through
+// HintCoalescer, and straight into HintManager as the HAL did before, and
+// reports the cost per request on the calling binder thread.
+//
+// The trace is the binary hint timeline of the HAL:
+//
+//   adb shell dumpsys android.hardware.power.IPower/default --hint-trace > trace.bin
+//   powerhal_hint_replay_benchmark --trace=trace.bin
+//
+// Without --trace, a synthetic 2 s scroll is replayed: INTERACTION every 4 ms,
+// DISPLAY_UPDATE_IMMINENT every 8 ms and a LAUNCH mode toggle around it.
+// Requests are replayed back to back, without the recorded gaps.
+//
+// Every hint drives a node in a temporary directory, so the HintManager cost
+// is the one of the real library writing to a plain file.
+
+#include <aidl/android/hardware/power/Boost.h>
+#include <aidl/android/hardware/power/Mode.h>
+#include <android-base/file.h>
+#include <benchmark/benchmark.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../HintCoalescer.h"
+#include "../HintRecorder.h"
+#include "TempHintManager.h"
+
+using aidl::android::hardware::power::Boost;
+using aidl::android::hardware::power::Mode;
+using aidl::google::hardware::power::impl::pixel::HintCoalescer;
+using aidl::google::hardware::power::impl::pixel::HintRecorder;
+using aidl::google::hardware::power::impl::pixel::TempHintManager;
+using ::android::base::ReadFileToString;
+using ::android::perfmgr::HintManager;
+
+namespace {
+
+constexpr std::chrono::milliseconds kCoalesceWindow(20);
+
+using Record = HintRecorder::Record;
+using Event = HintRecorder::Event;
+
+std::vector<Record> gTrace;
+
+std::vector<Record> syntheticScroll() {
+    constexpr int64_t kMs = 1000000;
+    std::vector<Record> trace;
+
+    trace.push_back({0, Event::kSetMode, static_cast<int32_t>(Mode::LAUNCH), 1, 0});
+    for (int64_t t = 0; t < 2000 * kMs; t += 4 * kMs) {
+        trace.push_back({t, Event::kSetBoost, static_cast<int32_t>(Boost::INTERACTION), 0, 0});
+        if (t % (8 * kMs) == 0) {
+            trace.push_back(
+                    {t, Event::kSetBoost, static_cast<int32_t>(Boost::DISPLAY_UPDATE_IMMINENT),
+                     100, 0});
+        }
+    }
+    trace.push_back({2000 * kMs, Event::kSetMode, static_cast<int32_t>(Mode::LAUNCH), 0, 0});
+    return trace;
+}
+
+void BM_ReplayDirect(benchmark::State &state) {
+    TempHintManager replay;
+    const std::shared_ptr<HintManager> &hm = replay.get();
+    if (!hm) {
+        state.SkipWithError("unable to create the HintManager");
+        return;
+    }
+
+    for (auto _ : state) {
+        for (const Record &r : gTrace) {
+            if (r.event == Event::kSetMode) {
+                const std::string name = toString(static_cast<Mode>(r.id));
+                if (r.value) {
+                    hm->DoHint(name);
+                } else {
+                    hm->EndHint(name);
+                }
+            } else {
+                const std::string name = toString(static_cast<Boost>(r.id));
+                if (r.value > 0) {
+                    hm->DoHint(name, std::chrono::milliseconds(r.value));
+                } else if (r.value == 0) {
+                    hm->DoHint(name);
+                } else {
+                    hm->EndHint(name);
+                }
+            }
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * gTrace.size());
+}
+BENCHMARK(BM_ReplayDirect);
+
+void BM_ReplayCoalesced(benchmark::State &state) {
+    TempHintManager replay;
+    if (!replay.get()) {
+        state.SkipWithError("unable to create the HintManager");
+        return;
+    }
+    HintCoalescer hc(replay.get(), kCoalesceWindow);
+
+    for (auto _ : state) {
+        for (const Record &r : gTrace) {
+            if (r.event == Event::kSetMode) {
+                const HintCoalescer::HintId id = hc.getId(static_cast<Mode>(r.id));
+                if (r.value) {
+                    hc.doHint(id);
+                } else {
+                    hc.endHint(id);
+                }
+            } else {
+                const HintCoalescer::HintId id = hc.getId(static_cast<Boost>(r.id));
+                if (r.value > 0) {
+                    hc.doHint(id, std::chrono::milliseconds(r.value));
+                } else if (r.value == 0) {
+                    hc.doHint(id);
+                } else {
+                    hc.endHint(id);
+                }
+            }
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * gTrace.size());
+}
+BENCHMARK(BM_ReplayCoalesced);
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    const char *tracePath = nullptr;
+    int out = 1;
+    for (int i = 1; i < argc; i++) {
+        if (!strncmp(argv[i], "--trace=", strlen("--trace="))) {
+            tracePath = argv[i] + strlen("--trace=");
+        } else {
+            argv[out++] = argv[i];
+        }
+    }
+    argc = out;
+
+    if (tracePath) {
+        std::string data;
+        std::vector<Record> records;
+        HintRecorder::HintNames names;
+        if (!ReadFileToString(tracePath, &data) ||
+            !HintRecorder::parseBinary(data, &records, &names)) {
+            fprintf(stderr, "%s is not a hint trace\n", tracePath);
+            return 1;
+        }
+        for (const Record &r : records) {
+            if (r.event == Event::kSetMode || r.event == Event::kSetBoost) {
+                gTrace.push_back(r);
+            }
+        }
+    } else {
+        gTrace = syntheticScroll();
+    }
+    if (gTrace.empty()) {
+        fprintf(stderr, "no setMode or setBoost requests to replay\n");
+        return 1;
+    }
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
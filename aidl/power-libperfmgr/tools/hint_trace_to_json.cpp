@@ -0,0 +1,60 @@
+/*
+ * Copyright 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Converts a binary hint trace of the HAL to the Chrome JSON trace format,
+// which Perfetto and chrome://tracing open:
+//
+//   adb shell dumpsys android.hardware.power.IPower/default --hint-trace > trace.bin
+//   hint_trace_to_json trace.bin > trace.json
+//
+// Without an input file, the trace is read from stdin.
+
+#include <android-base/file.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "../HintRecorder.h"
+
+using aidl::google::hardware::power::impl::pixel::HintRecorder;
+using ::android::base::ReadFdToString;
+using ::android::base::ReadFileToString;
+using ::android::base::WriteStringToFd;
+
+int main(int argc, char **argv) {
+    if (argc > 2) {
+        fprintf(stderr, "usage: %s [trace.bin]\n", argv[0]);
+        return 1;
+    }
+
+    std::string data;
+    const char *input = argc == 2 ? argv[1] : "stdin";
+    if (!(argc == 2 ? ReadFileToString(argv[1], &data) : ReadFdToString(STDIN_FILENO, &data))) {
+        perror(input);
+        return 1;
+    }
+
+    std::vector<HintRecorder::Record> records;
+    HintRecorder::HintNames names;
+    if (!HintRecorder::parseBinary(data, &records, &names)) {
+        fprintf(stderr, "%s is not a hint trace\n", input);
+        return 1;
+    }
+
+    return WriteStringToFd(HintRecorder::toJson(records, names), STDOUT_FILENO) ? 0 : 1;
+}
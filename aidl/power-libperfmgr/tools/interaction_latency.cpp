@@ -0,0 +1,178 @@
+/*
+ * Copyright 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures how late InteractionHandler releases an interaction boost once it
+// is due. A FIFO stands in for the display idle node and the release is taken
+// from the kInteractionRelease record of HintRecorder. Two cases are run:
+//
+//   idle-after-hold   the display goes idle --hold-ms after the boost; the
+//                     boost is due at the idle write
+//   idle-within-hold  the display goes idle right after the boost; the boost
+//                     is due at the end of the minimum hold
+//                     (vendor.powerhal.disp.idle_wait)
+//
+//   powerhal_interaction_latency [--iterations=N] [--hold-ms=MS]
+
+#include <android-base/file.h>
+#include <android-base/properties.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../HintCoalescer.h"
+#include "../HintRecorder.h"
+#include "../InteractionHandler.h"
+#include "TempHintManager.h"
+
+using aidl::google::hardware::power::impl::pixel::HintCoalescer;
+using aidl::google::hardware::power::impl::pixel::HintRecorder;
+using aidl::google::hardware::power::impl::pixel::InteractionHandler;
+using aidl::google::hardware::power::impl::pixel::TempHintManager;
+using ::android::base::WriteStringToFd;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+int64_t toNs(Clock::time_point t) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+}
+
+// Returns the time of the first release recorded at or after sinceNs, or -1
+// if the boost is not released within timeout
+int64_t waitForRelease(int64_t sinceNs, std::chrono::milliseconds timeout) {
+    std::vector<HintRecorder::Record> records;
+    const Clock::time_point end = Clock::now() + timeout;
+
+    while (Clock::now() < end) {
+        HintRecorder::getInstance().read(&records);
+        for (const HintRecorder::Record &r : records) {
+            if (r.event == HintRecorder::Event::kInteractionRelease && r.timestampNs >= sinceNs) {
+                return r.timestampNs;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    return -1;
+}
+
+void report(const char *name, std::vector<double> latenciesUs) {
+    if (latenciesUs.empty()) {
+        printf("%-18s no release observed\n", name);
+        return;
+    }
+    std::sort(latenciesUs.begin(), latenciesUs.end());
+    auto at = [&](double fraction) {
+        return latenciesUs[std::min(latenciesUs.size() - 1,
+                                    static_cast<size_t>(fraction * latenciesUs.size()))];
+    };
+    printf("%-18s n=%zu p50=%.0fus p90=%.0fus p99=%.0fus max=%.0fus\n", name, latenciesUs.size(),
+           at(0.5), at(0.9), at(0.99), latenciesUs.back());
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    int iterations = 50;
+    int holdMs = 200;
+    const struct option options[] = {
+            {"iterations", required_argument, nullptr, 'n'},
+            {"hold-ms", required_argument, nullptr, 'h'},
+            {nullptr, 0, nullptr, 0},
+    };
+    for (int c; (c = getopt_long(argc, argv, "", options, nullptr)) != -1;) {
+        switch (c) {
+            case 'n':
+                iterations = atoi(optarg);
+                break;
+            case 'h':
+                holdMs = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [--iterations=N] [--hold-ms=MS]\n", argv[0]);
+                return 1;
+        }
+    }
+    const std::chrono::milliseconds minHold(
+            ::android::base::GetUintProperty("vendor.powerhal.disp.idle_wait", 100U));
+
+    TempHintManager hm;
+    if (!hm.get()) {
+        fprintf(stderr, "unable to create the HintManager\n");
+        return 1;
+    }
+    auto hc = std::make_shared<HintCoalescer>(hm.get(), std::chrono::milliseconds(20));
+
+    TemporaryDir dir;
+    const std::string idlePath = std::string(dir.path) + "/idle_state";
+    if (mkfifo(idlePath.c_str(), 0600)) {
+        perror("mkfifo");
+        return 1;
+    }
+    // Opened for writing as well so that the handler never sees EOF
+    int idleFd = open(idlePath.c_str(), O_RDWR | O_CLOEXEC);
+    if (idleFd < 0 || !WriteStringToFd("idle", idleFd)) {
+        perror(idlePath.c_str());
+        return 1;
+    }
+
+    InteractionHandler handler(hc);
+    if (!handler.Init(idlePath.c_str())) {
+        fprintf(stderr, "unable to start the interaction handler\n");
+        return 1;
+    }
+
+    std::vector<double> afterHold;
+    std::vector<double> withinHold;
+    for (int i = 0; i < iterations; i++) {
+        // Let the handler read the active state before the boost
+        WriteStringToFd("active", idleFd);
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        handler.Acquire(0);
+        std::this_thread::sleep_for(std::chrono::milliseconds(holdMs));
+        const Clock::time_point idleAt = Clock::now();
+        WriteStringToFd("idle", idleFd);
+        int64_t released = waitForRelease(toNs(idleAt), std::chrono::seconds(10));
+        if (released >= 0) {
+            afterHold.push_back((released - toNs(idleAt)) / 1000.0);
+        }
+
+        WriteStringToFd("active", idleFd);
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        const Clock::time_point acquiredAt = Clock::now();
+        handler.Acquire(0);
+        WriteStringToFd("idle", idleFd);
+        released = waitForRelease(toNs(acquiredAt), std::chrono::seconds(10));
+        if (released >= 0) {
+            withinHold.push_back((released - toNs(acquiredAt + minHold)) / 1000.0);
+        }
+    }
+
+    handler.Exit();
+    close(idleFd);
+
+    report("idle-after-hold", afterHold);
+    report("idle-within-hold", withinHold);
+    return 0;
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Drives the running power HAL with N synthetic ADPF sessions, one thread
+// each, and reports the call latency seen by the clients:
+//
+//   report  the oneway reportActualWorkDuration of every frame, which only
+//           blocks once the HAL falls behind and the async queue fills up
+//   probe   a synchronous getHintSessionPreferredRate after every frame,
+//           which waits for a free thread of the HAL binder pool
+//
+// A setBoost(INTERACTION) is sent every 4 frames of the first session, as
+// input would during a scroll.
+//
+//   powerhal_session_load [--sessions=N] [--fps=F] [--seconds=S]
+//
+// Compare runs with vendor.powerhal.binder.threads at 0 and above 0.
+
+#include <aidl/android/hardware/power/IPower.h>
+#include <android/binder_manager.h>
+#include <android/binder_process.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using aidl::android::hardware::power::Boost;
+using aidl::android::hardware::power::IPower;
+using aidl::android::hardware::power::IPowerHintSession;
+using aidl::android::hardware::power::WorkDuration;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct Options {
+    int sessions = 4;
+    int fps = 60;
+    int seconds = 10;
+};
+
+struct Latencies {
+    std::mutex lock;
+    std::vector<int64_t> reportNs;  // protected by lock
+    std::vector<int64_t> probeNs;   // protected by lock
+};
+
+int64_t sinceNs(Clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+void runSession(const std::shared_ptr<IPower> &power, const Options &options, int index,
+                Latencies *latencies) {
+    const std::chrono::nanoseconds period(1000000000LL / options.fps);
+    const int64_t targetNs = period.count() / 2;
+    std::shared_ptr<IPowerHintSession> session;
+
+    if (!power->createHintSession(getpid(), getuid(), {gettid()}, targetNs, &session).isOk() ||
+        !session) {
+        fprintf(stderr, "session %d: createHintSession failed\n", index);
+        return;
+    }
+
+    std::vector<int64_t> reportNs;
+    std::vector<int64_t> probeNs;
+    const int frames = options.fps * options.seconds;
+    Clock::time_point next = Clock::now();
+    for (int frame = 0; frame < frames; frame++) {
+        // Synthetic work between a third and the whole target
+        const int64_t workNs = targetNs / 3 + (frame * 7919 + index * 104729) % (targetNs * 2 / 3);
+        const Clock::time_point start = Clock::now();
+        while (sinceNs(start) < workNs) {
+        }
+
+        std::vector<WorkDuration> durations(1);
+        durations[0].timeStampNanos =
+                std::chrono::duration_cast<std::chrono::nanoseconds>(start.time_since_epoch())
+                        .count();
+        durations[0].durationNanos = sinceNs(start);
+        Clock::time_point call = Clock::now();
+        session->reportActualWorkDuration(durations);
+        reportNs.push_back(sinceNs(call));
+
+        call = Clock::now();
+        int64_t rate;
+        power->getHintSessionPreferredRate(&rate);
+        probeNs.push_back(sinceNs(call));
+
+        if (index == 0 && frame % 4 == 0) {
+            power->setBoost(Boost::INTERACTION, 0);
+        }
+
+        next += period;
+        std::this_thread::sleep_until(next);
+    }
+    session->close();
+
+    std::lock_guard<std::mutex> guard(latencies->lock);
+    latencies->reportNs.insert(latencies->reportNs.end(), reportNs.begin(), reportNs.end());
+    latencies->probeNs.insert(latencies->probeNs.end(), probeNs.begin(), probeNs.end());
+}
+
+void report(const char *name, std::vector<int64_t> ns) {
+    if (ns.empty()) {
+        printf("%-7s no calls\n", name);
+        return;
+    }
+    std::sort(ns.begin(), ns.end());
+    auto at = [&](double fraction) {
+        return ns[std::min(ns.size() - 1, static_cast<size_t>(fraction * ns.size()))] / 1000.0;
+    };
+    printf("%-7s calls=%zu p50=%.1fus p90=%.1fus p99=%.1fus max=%.1fus\n", name, ns.size(),
+           at(0.5), at(0.9), at(0.99), ns.back() / 1000.0);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    Options options;
+    const struct option longOptions[] = {
+            {"sessions", required_argument, nullptr, 'n'},
+            {"fps", required_argument, nullptr, 'f'},
+            {"seconds", required_argument, nullptr, 's'},
+            {nullptr, 0, nullptr, 0},
+    };
+    for (int c; (c = getopt_long(argc, argv, "", longOptions, nullptr)) != -1;) {
+        switch (c) {
+            case 'n':
+                options.sessions = atoi(optarg);
+                break;
+            case 'f':
+                options.fps = atoi(optarg);
+                break;
+            case 's':
+                options.seconds = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [--sessions=N] [--fps=F] [--seconds=S]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (options.sessions < 1 || options.fps < 1 || options.seconds < 1) {
+        fprintf(stderr, "sessions, fps and seconds must be positive\n");
+        return 1;
+    }
+
+    const std::string instance = std::string(IPower::descriptor) + "/default";
+    std::shared_ptr<IPower> power =
+            IPower::fromBinder(ndk::SpAIBinder(AServiceManager_waitForService(instance.c_str())));
+    if (!power) {
+        fprintf(stderr, "%s is not available\n", instance.c_str());
+        return 1;
+    }
+    int64_t rate;
+    if (!power->getHintSessionPreferredRate(&rate).isOk()) {
+        fprintf(stderr, "the power HAL does not support hint sessions\n");
+        return 1;
+    }
+    ABinderProcess_startThreadPool();
+
+    Latencies latencies;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < options.sessions; i++) {
+        threads.emplace_back(runSession, power, std::cref(options), i, &latencies);
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+
+    printf("sessions=%d fps=%d seconds=%d\n", options.sessions, options.fps, options.seconds);
+    report("report", latencies.reportNs);
+    report("probe", latencies.probeNs);
+    return 0;
+}
@@ -26,11 +26,15 @@
 
 #include <sys/ioctl.h>
 
+#include <linux/types.h>
+
 #include <log/log.h>
 
 #include <hardware/exynos/ion.h>
 #include <hardware/exynos/dmabuf_container.h>
 
+#include "ion_internal.h"
+
 struct dma_buf_merge {
     int      *dma_bufs;
     int32_t  count;
@@ -48,13 +52,28 @@ int dma_buf_merge(int base_fd, int src_fds[], int src_count)
         .dma_bufs = src_fds,
         .count = src_count,
     };
+    int i;
 
     if (src_count > MAX_BUFCON_SRC_BUFS) {
         ALOGE("too many source buffers");
         return -1;
     }
 
-    if (ioctl(base_fd, DMA_BUF_IOCTL_MERGE, &data) < 0) {
+    if (base_fd < 0 || src_count < 1) {
+        ALOGE("invalid base fd %d or source count %d", base_fd, src_count);
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (i = 0; i < src_count; i++) {
+        if (src_fds[i] < 0) {
+            ALOGE("invalid source fd %d at index %d", src_fds[i], i);
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    if (exynos_ion_ioctl(base_fd, DMA_BUF_IOCTL_MERGE, &data) < 0) {
         ALOGE("failed to merge %d dma-bufs: %s", src_count, strerror(errno));
         return -1;
     }
@@ -64,7 +83,7 @@ int dma_buf_merge(int base_fd, int src_fds[], int src_count)
 
 int dmabuf_container_set_mask(int dmabuf, uint32_t mask)
 {
-    if (ioctl(dmabuf, DMA_BUF_IOCTL_CONTAINER_SET_MASK, &mask) < 0) {
+    if (exynos_ion_ioctl(dmabuf, DMA_BUF_IOCTL_CONTAINER_SET_MASK, &mask) < 0) {
         ALOGE("Failed to configure dma-buf container mask %#x: %s", mask, strerror(errno));
         return -1;
     }
@@ -74,7 +93,7 @@ int dmabuf_container_set_mask(int dmabuf, uint32_t mask)
 
 int dmabuf_container_get_mask(int dmabuf, uint32_t *mask)
 {
-    if (ioctl(dmabuf, DMA_BUF_IOCTL_CONTAINER_GET_MASK, mask) < 0) {
+    if (exynos_ion_ioctl(dmabuf, DMA_BUF_IOCTL_CONTAINER_GET_MASK, mask) < 0) {
         ALOGE("Failed to retrieve dma-buf container mask: %s", strerror(errno));
         return -1;
     }
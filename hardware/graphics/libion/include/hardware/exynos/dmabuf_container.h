@@ -24,6 +24,11 @@
 
 __BEGIN_DECLS
 
+/*
+ * Merges base_fd and src_fds into a new container. A container holds its
+ * buffers until it is closed, and callers that compose the same buffers again
+ * keep it and only change its mask with dmabuf_container_set_mask().
+ */
 int dma_buf_merge(int base_fd, int src_fds[], int src_count);
 int dmabuf_container_set_mask(int dmabuf, uint32_t mask);
 int dmabuf_container_get_mask(int dmabuf, uint32_t *mask);
@@ -19,6 +19,7 @@
 #ifndef __HARDWARE_EXYNOS_ION_H__
 #define __HARDWARE_EXYNOS_ION_H__
 
+#include <stdint.h>
 #include <sys/types.h>
 
 #define ION_EXYNOS_HEAP_ID_SYSTEM        0
@@ -54,25 +55,134 @@
 #define ION_SYNC_READ      (1 << 0)
 #define ION_SYNC_WRITE     (2 << 0)
 
+#define EXYNOS_ION_STATS_HEAPS 16
+#define EXYNOS_ION_LATENCY_BUCKETS 20
+
+/*
+ * Allocation statistics of a legacy heap id. latency_us[0] counts
+ * allocations under 1us and latency_us[i] those under 2^i us; the last
+ * bucket also takes everything slower.
+ */
+struct exynos_ion_heap_stats {
+    uint64_t count;
+    uint64_t bytes;
+    uint64_t failures;
+    uint64_t latency_us[EXYNOS_ION_LATENCY_BUCKETS];
+};
+
+/*
+ * Replaces the kernel as the provider of /dev/ion, e.g. with a userspace
+ * emulation on hosts without ION. open() and close() stand in for the ION
+ * device node; ioctl() receives the ION and dma-buf ioctls of ion_uapi.h
+ * and linux/dma-buf.h and returns -1 with errno set on failure, like
+ * ioctl(2). Buffers returned by the backend must be real fds, as libion
+ * maps, seeks and closes them directly.
+ */
+struct exynos_ion_backend {
+    int (*open)(void);
+    int (*close)(int fd);
+    int (*ioctl)(int fd, unsigned long request, void *arg);
+};
+
 __BEGIN_DECLS
 
+/*
+ * Selects the backend, or the kernel if backend is NULL. It must be called
+ * before exynos_ion_open(), while no ION fd is in use, and the backend must
+ * stay valid until it is replaced.
+ */
+int exynos_ion_set_backend(const struct exynos_ion_backend *backend);
+
+/*
+ * Probes the ION ABI and heaps and loads the fallback policy, which otherwise
+ * happens on the first call that needs them. Clients may call it early at
+ * process start to keep that cost off their first allocation.
+ */
+int exynos_ion_init(void);
+
 int exynos_ion_open();
 int exynos_ion_close(int fd);
 int exynos_ion_alloc(int ion_fd, size_t len,
                       unsigned int heap_mask, unsigned int flags);
+/*
+ * exynos_ion_alloc() walks the heap fallback policy when the requested heaps
+ * fail. This variant also reports the heap mask and flags of the tier that
+ * served the allocation; either pointer may be NULL.
+ */
+int exynos_ion_alloc_fallback(int ion_fd, size_t len, unsigned int heap_mask,
+                              unsigned int flags, unsigned int *used_heap_mask,
+                              unsigned int *used_flags);
+/*
+ * Allocates count buffers of lens[i] bytes into out_fds. Either all buffers
+ * are allocated or none: on failure the buffers obtained so far are freed
+ * and -1 is returned. A batch that fails walks the heap fallback policy as a
+ * whole, so that all of its buffers come from the same heap.
+ */
+int exynos_ion_alloc_batch(int ion_fd, const size_t *lens, unsigned int count,
+                           unsigned int heap_mask, unsigned int flags, int *out_fds);
+/*
+ * Allocates count (2 to MAX_BUFCON_BUFS) buffers like exynos_ion_alloc_batch()
+ * and merges them into a single dma-buf container, returned in *container_fd.
+ * The container holds its own references, so the buffers are freed and
+ * out_fds is filled with -1. Merging is optional: if the kernel has no
+ * dma-buf containers, *container_fd is -1 and out_fds holds the buffers,
+ * which the caller frees. Returns -1 if allocating or merging fails.
+ */
+int exynos_ion_alloc_container(int ion_fd, const size_t *lens, unsigned int count,
+                               unsigned int heap_mask, unsigned int flags,
+                               int *container_fd, int *out_fds);
 int exynos_ion_import_handle(int ion_fd, int fd, int* handle);
 int exynos_ion_free_handle(int ion_fd, int handle);
 int exynos_ion_sync_fd(int ion_fd, int fd);
+/*
+ * Only legacy ION syncs the range. On modern ION DMA_BUF_IOCTL_SYNC has no
+ * range, so every partial sync below flushes the whole buffer and its cost
+ * grows with the buffer size rather than len.
+ */
 int exynos_ion_sync_fd_partial(int ion_fd, int fd, off_t offset, size_t len);
 
 int exynos_ion_sync_start(int ion_fd, int fd, int direction);
 int exynos_ion_sync_end(int ion_fd, int fd, int direction);
 
+/*
+ * Bracket CPU access to [offset, offset + len) of a buffer. Start/end pairs
+ * on the same fd that are open at the same time share one window: the window
+ * is synchronized when it opens and once more when its last range ends. The
+ * ranges only decide when a window opens and closes: on modern ION each of
+ * those syncs covers the whole buffer.
+ */
+int exynos_ion_sync_start_partial(int ion_fd, int fd, int direction, off_t offset, size_t len);
+int exynos_ion_sync_end_partial(int ion_fd, int fd, int direction, off_t offset, size_t len);
+
 const char *exynos_ion_get_heap_name(unsigned int legacy_heap_id);
 
 int exynos_ion_dma_buf_track(int fd);
 int exynos_ion_dma_buf_untrack(int fd);
 
+/*
+ * Userspace buffer lifetime tracking. On modern ION every buffer returned by
+ * exynos_ion_alloc() or exynos_ion_import_handle() is recorded until it is
+ * passed to exynos_ion_free_handle().
+ */
+int exynos_ion_buffer_set_tag(int fd, const char *tag);
+/* Writes the live buffers grouped by heap to out_fd */
+void exynos_ion_dump_buffers(int out_fd);
+/*
+ * Writes the buffers that have been live for at least min_age_ms to out_fd
+ * and returns their number. Buffers closed without exynos_ion_free_handle()
+ * are left out if their fd is closed or now refers to a file of another
+ * size; an fd number reused by another buffer of the same size is still
+ * reported.
+ */
+unsigned int exynos_ion_report_leaks(int out_fd, uint64_t min_age_ms);
+
+/*
+ * Fills stats, indexed by legacy heap id, with the allocations made by this
+ * process. An allocation from several heaps counts towards the lowest id.
+ */
+int exynos_ion_get_stats(struct exynos_ion_heap_stats stats[EXYNOS_ION_STATS_HEAPS]);
+void exynos_ion_dump_stats(int out_fd);
+
 __END_DECLS
 
 #endif /* __HARDWARE_EXYNOS_ION_H__ */
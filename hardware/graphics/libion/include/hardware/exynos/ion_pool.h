@@ -0,0 +1,89 @@
+/*
+ *  hardware/exynos/ion_pool.h
+ *
+ *   Copyright 2018 Samsung Electronics Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef __HARDWARE_EXYNOS_ION_POOL_H__
+#define __HARDWARE_EXYNOS_ION_POOL_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Opt-in cache of dma-buf fds allocated with exynos_ion_alloc() from one heap
+ * mask and flags combination. Buffers returned with exynos_ion_pool_put() are
+ * kept on per size class free lists and handed out again by
+ * exynos_ion_pool_get() without a trip to the kernel. Only buffers that the
+ * pool itself handed out from its heap mask and flags are kept; any other
+ * fd passed to exynos_ion_pool_put(), including a buffer that was served by
+ * a fallback heap, is closed.
+ *
+ * Recycled buffers are NOT cleared: they keep the contents written by their
+ * previous user. Pools therefore require ION_FLAG_NOZEROED, the flag under
+ * which stale contents are allowed, and should only serve a trusted heap.
+ *
+ * Buffers cached by a pool are not listed by the buffer tracker; they are
+ * tracked again when exynos_ion_pool_get() hands them out.
+ */
+#define EXYNOS_ION_POOL_MAX_CLASSES 16
+
+/* exynos_ion_pool_trim() levels */
+#define EXYNOS_ION_POOL_TRIM_MODERATE 0 /* shrink every class to its low watermark */
+#define EXYNOS_ION_POOL_TRIM_COMPLETE 1 /* release every cached buffer */
+
+struct exynos_ion_pool;
+
+struct exynos_ion_pool_stats {
+    uint64_t gets;
+    uint64_t hits;
+    uint64_t puts;
+    uint64_t released;   /* buffers closed by put over the high watermark or trim */
+    uint64_t rejected;   /* puts of buffers the pool did not hand out, also released */
+    size_t bytes_cached;
+    unsigned int buffers_cached;
+};
+
+__BEGIN_DECLS
+
+/*
+ * size_classes must be increasing multiples of the page size. Each class caches at most
+ * high_watermark buffers and is shrunk to low_watermark by a moderate trim. Returns NULL
+ * if flags lack ION_FLAG_NOZEROED.
+ */
+struct exynos_ion_pool *exynos_ion_pool_create(int ion_fd, unsigned int heap_mask,
+                                               unsigned int flags, const size_t *size_classes,
+                                               unsigned int nr_classes,
+                                               unsigned int low_watermark,
+                                               unsigned int high_watermark);
+void exynos_ion_pool_destroy(struct exynos_ion_pool *pool);
+
+/*
+ * Returns a buffer fd of at least len bytes. Requests larger than the biggest
+ * size class are allocated directly and released by exynos_ion_pool_put().
+ */
+int exynos_ion_pool_get(struct exynos_ion_pool *pool, size_t len);
+void exynos_ion_pool_put(struct exynos_ion_pool *pool, int fd);
+
+void exynos_ion_pool_trim(struct exynos_ion_pool *pool, int level);
+/* Trims every pool of the process, e.g. from a memory pressure callback */
+void exynos_ion_pool_trim_all(int level);
+
+void exynos_ion_pool_get_stats(struct exynos_ion_pool *pool,
+                               struct exynos_ion_pool_stats *stats);
+
+__END_DECLS
+
+#endif /* __HARDWARE_EXYNOS_ION_POOL_H__ */
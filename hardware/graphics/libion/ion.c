@@ -19,12 +19,21 @@
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
+#include <limits.h>
+#include <stdbool.h>
 
 #include <stdatomic.h>
+#include <pthread.h>
+
+#include <stdlib.h>
 
 #include <unistd.h>
+#include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#if defined(__ANDROID__)
+#include <sys/system_properties.h>
+#endif
 #include <fcntl.h>
 
 #define LOG_TAG "ion-exynos"
@@ -32,9 +41,12 @@
 #include <log/log.h>
 
 #include <hardware/exynos/ion.h>
+#include <hardware/exynos/dmabuf_container.h>
 
 #include <linux/dma-buf.h>
+#include <linux/types.h>
 
+#include "ion_internal.h"
 #include "ion_uapi.h"
 
 #define ION_MAX_HEAP_COUNT 14
@@ -65,12 +77,6 @@ static const struct {
 
 #define ION_NUM_HEAP_NAMES (unsigned int)(sizeof(ion_heap_name)/sizeof(ion_heap_name[0]))
 
-static struct {
-    char name[MAX_HEAP_NAME];
-    unsigned int namelen;
-    unsigned int type;
-} ion_heap_list[ION_NUM_HEAP_IDS]; /* No more than 16 heap ids */
-
 #define ION_HEAP_TYPE_NONE INT_MAX
 
 const char *exynos_ion_get_heap_name(unsigned int legacy_heap_id) {
@@ -80,48 +86,200 @@ const char *exynos_ion_get_heap_name(unsigned int legacy_heap_id) {
     return ion_heap_name[legacy_heap_id].name;
 }
 
-static unsigned int ion_get_matched_heapmask(unsigned int legacy_heap_id) {
+/*
+ * Every ioctl on /dev/ion and on the dma-bufs it hands out goes through the
+ * selected backend, which is the kernel unless exynos_ion_set_backend()
+ * installed another one.
+ */
+static int ion_kernel_open(void) {
+    return open("/dev/ion", O_RDONLY | O_CLOEXEC);
+}
+
+static int ion_kernel_ioctl(int fd, unsigned long request, void *arg) {
+    return ioctl(fd, request, arg);
+}
+
+static const struct exynos_ion_backend ion_kernel_backend = {
+    .open = ion_kernel_open,
+    .close = close,
+    .ioctl = ion_kernel_ioctl,
+};
+
+static _Atomic(const struct exynos_ion_backend *) ion_backend = &ion_kernel_backend;
+
+static inline const struct exynos_ion_backend *ion_get_backend(void) {
+    return atomic_load_explicit(&ion_backend, memory_order_acquire);
+}
+
+int exynos_ion_ioctl(int fd, unsigned long request, void *arg) {
+    return ion_get_backend()->ioctl(fd, request, arg);
+}
+
+static int ion_free_handle(int fd, int handle) {
+    struct ion_handle_data data = { .handle = handle, };
+    return exynos_ion_ioctl(fd, ION_IOC_FREE, &data);
+}
+
+/*
+ * Everything probed from the ION device: the ABI version and, on modern ION,
+ * the heaps and the modern heap mask of every legacy heap id, resolved by name
+ * once so that the alloc path only ORs table entries. A snapshot is built
+ * completely before it is published and never changes afterwards, so readers
+ * need no locking. Threads racing the first probe each build a snapshot; the
+ * first one published wins and the others are discarded.
+ */
+enum ion_version { ION_VERSION_UNKNOWN, ION_VERSION_MODERN, ION_VERSION_LEGACY };
+
+#define ION_LEGACY_HEAP_TABLE_SIZE 16
+
+struct ion_discovery {
+    int version;
+    struct {
+        char name[MAX_HEAP_NAME];
+        unsigned int namelen;
+        unsigned int type;
+    } heaps[ION_NUM_HEAP_IDS]; /* No more than 16 heap ids */
+    unsigned int heap_mask[ION_LEGACY_HEAP_TABLE_SIZE];
+};
+
+static _Atomic(struct ion_discovery *) ion_discovery_current = ATOMIC_VAR_INIT(NULL);
+
+static void ion_dump_heap_list(const struct ion_discovery *disc) {
     unsigned int heap_id;
 
+    ALOGI("ION HEAP LIST");
+    for (heap_id = 0; heap_id < ION_NUM_HEAP_IDS; heap_id++)
+        if (disc->heaps[heap_id].type != ION_HEAP_TYPE_NONE)
+                ALOGI("ID %d, TYPE %d, NAME %s", heap_id,
+                      disc->heaps[heap_id].type, disc->heaps[heap_id].name);
+}
+
+static unsigned int ion_get_matched_heapmask(const struct ion_discovery *disc,
+                                             unsigned int legacy_heap_id) {
+    unsigned int heap_id;
+
+    if (ion_heap_name[legacy_heap_id].namelen == 0)
+        return 0;
+
     for (heap_id = 0; heap_id < ION_NUM_HEAP_IDS; heap_id++) {
-        if (ion_heap_list[heap_id].type == ION_HEAP_TYPE_NONE)
+        if (disc->heaps[heap_id].type == ION_HEAP_TYPE_NONE)
             continue;
 
-        if ((ion_heap_list[heap_id].namelen == ion_heap_name[legacy_heap_id].namelen) &&
-                !strcmp(ion_heap_list[heap_id].name, ion_heap_name[legacy_heap_id].name))
+        if ((disc->heaps[heap_id].namelen == ion_heap_name[legacy_heap_id].namelen) &&
+                !strcmp(disc->heaps[heap_id].name, ion_heap_name[legacy_heap_id].name))
             return 1 << heap_id;
     }
 
-    ALOGE("%s: unable to find heap '%s'(id %u)",
-          __func__, ion_heap_name[legacy_heap_id].name, legacy_heap_id);
-    ALOGI("ION HEAP LIST");
-    for (heap_id = 0; heap_id < ION_NUM_HEAP_IDS; heap_id++)
-        if (ion_heap_list[heap_id].type != ION_HEAP_TYPE_NONE)
-                ALOGI("ID %d, TYPE %d, NAME %s", heap_id,
-                      ion_heap_list[heap_id].type, ion_heap_list[heap_id].name);
-
     return 0;
 }
 
-static unsigned int ion_get_modern_heapmask(unsigned int legacy_heap_mask) {
-    unsigned int heap_mask = 0;
-    unsigned int legacy_heap_id;
+static void ion_query_heaps(int ion_fd, struct ion_discovery *disc) {
+    int ret;
+    unsigned int i;
+    struct ion_heap_query query;
+    struct ion_heap_data data[ION_NUM_HEAP_IDS];
 
-    for (legacy_heap_id = 0; legacy_heap_id < ION_NUM_HEAP_NAMES; legacy_heap_id++) {
-        if ((1 << legacy_heap_id) & legacy_heap_mask)
-            heap_mask |= ion_get_matched_heapmask(legacy_heap_id);
+    for (i = 0; i < ION_NUM_HEAP_IDS; i++)
+         disc->heaps[i].type = ION_HEAP_TYPE_NONE;
+
+    memset(&data, 0, sizeof(data));
+    memset(&query, 0, sizeof(query));
+
+    query.cnt = ION_NUM_HEAP_IDS;
+    query.heaps = (__u64)data;
+
+    ret = exynos_ion_ioctl(ion_fd, ION_IOC_HEAP_QUERY, &query);
+    if (ret < 0) {
+        ALOGE("%s: failed query heaps with ion_fd %d: %s",
+              __func__, ion_fd, strerror(errno));
+        return;
     }
 
-    return heap_mask;
+    if (query.cnt > ION_NUM_HEAP_IDS)
+        query.cnt = ION_NUM_HEAP_IDS;
+
+    for (i = 0; i < query.cnt; i++) {
+        if (data[i].heap_id < ION_NUM_HEAP_IDS) {
+            strncpy(disc->heaps[data[i].heap_id].name, data[i].name, MAX_HEAP_NAME);
+            disc->heaps[data[i].heap_id].name[MAX_HEAP_NAME - 1] = '\0';
+            disc->heaps[data[i].heap_id].namelen = strlen(disc->heaps[data[i].heap_id].name);
+            disc->heaps[data[i].heap_id].type = data[i].type;
+        }
+    }
+
+    for (i = 0; i < ION_NUM_HEAP_NAMES; i++)
+        disc->heap_mask[i] = ion_get_matched_heapmask(disc, i);
 }
 
-static int ion_free_handle(int fd, int handle) {
-    struct ion_handle_data data = { .handle = handle, };
-    return ioctl(fd, ION_IOC_FREE, &data);
+static int ion_probe_version(int ion_fd) {
+    ion_free_handle(ion_fd, 0);
+
+    /**
+      * Check for FREE IOCTL here; it is available only in the old
+      * kernels, not the new ones.
+      */
+    return (errno == ENOTTY) ? ION_VERSION_MODERN : ION_VERSION_LEGACY;
+}
+
+/*
+ * Returns the published snapshot, probing ion_fd if there is none yet, or NULL
+ * if a snapshot could not be allocated.
+ */
+static const struct ion_discovery *ion_get_discovery(int ion_fd) {
+    struct ion_discovery *disc = atomic_load_explicit(&ion_discovery_current,
+                                                      memory_order_acquire);
+    struct ion_discovery *expected = NULL;
+
+    if (disc)
+        return disc;
+
+    disc = calloc(1, sizeof(*disc));
+    if (!disc) {
+        ALOGE("%s: failed to allocate the heap snapshot", __func__);
+        return NULL;
+    }
+
+    disc->version = ion_probe_version(ion_fd);
+    if (disc->version == ION_VERSION_MODERN)
+        ion_query_heaps(ion_fd, disc);
+
+    if (!atomic_compare_exchange_strong_explicit(&ion_discovery_current, &expected, disc,
+                                                 memory_order_acq_rel, memory_order_acquire)) {
+        free(disc);
+        return expected;
+    }
+
+    return disc;
+}
+
+static int ion_is_legacy(int ion_fd) {
+    const struct ion_discovery *disc = ion_get_discovery(ion_fd);
+
+    if (!disc)
+        return ion_probe_version(ion_fd) == ION_VERSION_LEGACY;
+
+    return disc->version == ION_VERSION_LEGACY;
+}
+
+int exynos_ion_tracker_enabled(int ion_fd) {
+    return !ion_is_legacy(ion_fd);
+}
+
+static unsigned int ion_get_modern_heapmask(const struct ion_discovery *disc,
+                                            unsigned int legacy_heap_mask) {
+    unsigned int heap_mask = 0;
+
+    legacy_heap_mask &= (1U << ION_NUM_HEAP_NAMES) - 1;
+    while (legacy_heap_mask) {
+        heap_mask |= disc->heap_mask[__builtin_ctz(legacy_heap_mask)];
+        legacy_heap_mask &= legacy_heap_mask - 1;
+    }
+
+    return heap_mask;
 }
 
 static int ion_alloc_legacy(int ion_fd, size_t len,
-                            unsigned int heap_mask, unsigned int flags) {
+                            unsigned int heap_mask, unsigned int flags, bool quiet) {
     int ret;
     struct ion_fd_data fd_data;
     struct ion_allocation_data_legacy alloc_data = {
@@ -130,18 +288,21 @@ static int ion_alloc_legacy(int ion_fd, size_t len,
         .heap_id_mask = heap_mask,
         .flags = flags,
     };
+    uint64_t start_ns = exynos_ion_stats_now_ns();
 
-    ret = ioctl(ion_fd, ION_IOC_ALLOC_LEGACY, &alloc_data);
+    ret = exynos_ion_ioctl(ion_fd, ION_IOC_ALLOC_LEGACY, &alloc_data);
     if (ret < 0) {
-        ALOGE("%s(%d, %zu, %#x, %#x) ION_IOC_ALLOC failed: %s", __func__,
-              ion_fd, len, heap_mask, flags, strerror(errno));
+        exynos_ion_stats_record(heap_mask, len, 1, start_ns);
+        ALOGE_IF(!quiet, "%s(%d, %zu, %#x, %#x) ION_IOC_ALLOC failed: %s", __func__,
+                 ion_fd, len, heap_mask, flags, strerror(errno));
         return -1;
     }
 
     fd_data.handle = alloc_data.handle;
 
-    ret = ioctl(ion_fd, ION_IOC_SHARE, &fd_data);
+    ret = exynos_ion_ioctl(ion_fd, ION_IOC_SHARE, &fd_data);
     ion_free_handle(ion_fd, alloc_data.handle);
+    exynos_ion_stats_record(heap_mask, len, ret < 0, start_ns);
     if (ret < 0) {
         ALOGE("%s(%d, %zu, %#x, %#x) ION_IOC_SHARE failed: %s", __func__,
               ion_fd, len, heap_mask, flags, strerror(errno));
@@ -151,106 +312,343 @@ static int ion_alloc_legacy(int ion_fd, size_t len,
     return fd_data.fd;
 }
 
-static int ion_alloc_modern(int ion_fd, size_t len,
-                            unsigned int legacy_heap_mask,
-                            unsigned int flags) {
+static unsigned int ion_resolve_modern_heapmask(int ion_fd, unsigned int legacy_heap_mask,
+                                                bool quiet) {
+    const struct ion_discovery *disc = ion_get_discovery(ion_fd);
+    unsigned int heap_mask;
+
+    if (!disc)
+        return 0;
+
+    heap_mask = ion_get_modern_heapmask(disc, legacy_heap_mask);
+    if (!heap_mask && !quiet) {
+        ALOGE("%s: unable to find heaps of heap_mask %#x", __func__, legacy_heap_mask);
+        ion_dump_heap_list(disc);
+    }
+
+    return heap_mask;
+}
+
+static int ion_alloc_modern_heapmask(int ion_fd, size_t len,
+                                     unsigned int legacy_heap_mask,
+                                     unsigned int heap_mask,
+                                     unsigned int flags, bool quiet) {
     int ret;
     struct ion_allocation_data_modern data = {
         .len = len,
+        .heap_id_mask = heap_mask,
         .flags = flags,
     };
+    uint64_t start_ns = exynos_ion_stats_now_ns();
 
-    data.heap_id_mask = ion_get_modern_heapmask(legacy_heap_mask);
-    if (!data.heap_id_mask) {
-        ALOGE("%s: unable to find heaps of heap_mask %#x", __func__, legacy_heap_mask);
-        return -1;
-    }
-
-    ret = ioctl(ion_fd, ION_IOC_ALLOC_MODERN, &data);
+    ret = exynos_ion_ioctl(ion_fd, ION_IOC_ALLOC_MODERN, &data);
+    exynos_ion_stats_record(legacy_heap_mask, len, ret < 0, start_ns);
     if (ret < 0) {
-        ALOGE("%s(%d, %zu, %#x(%#x), %#x) failed: %s", __func__,
-              ion_fd, len, legacy_heap_mask, data.heap_id_mask, flags, strerror(errno));
+        ALOGE_IF(!quiet, "%s(%d, %zu, %#x(%#x), %#x) failed: %s", __func__,
+                 ion_fd, len, legacy_heap_mask, data.heap_id_mask, flags, strerror(errno));
         return -1;
     }
 
+    exynos_ion_tracker_add((int)data.fd, legacy_heap_mask, len, flags);
+    exynos_ion_sync_window_clear((int)data.fd);
+
     return (int)data.fd;
 }
 
-static void ion_query_heaps(int ion_fd) {
-    int ret;
-    unsigned int i;
-    struct ion_heap_query query;
-    struct ion_heap_data data[ION_NUM_HEAP_IDS];
+static int ion_alloc_modern(int ion_fd, size_t len,
+                            unsigned int legacy_heap_mask,
+                            unsigned int flags, bool quiet) {
+    unsigned int heap_mask = ion_resolve_modern_heapmask(ion_fd, legacy_heap_mask, quiet);
 
-    memset(&data, 0, sizeof(data));
-    memset(&query, 0, sizeof(query));
+    if (!heap_mask)
+        return -1;
 
-    query.cnt = ION_NUM_HEAP_IDS;
-    query.heaps = (__u64)data;
+    return ion_alloc_modern_heapmask(ion_fd, len, legacy_heap_mask, heap_mask, flags, quiet);
+}
 
-    ret = ioctl(ion_fd, ION_IOC_HEAP_QUERY, &query);
-    if (ret < 0) {
-        ALOGE("%s: failed query heaps with ion_fd %d: %s",
-              __func__, ion_fd, strerror(errno));
-        return;
+int exynos_ion_set_backend(const struct exynos_ion_backend *backend) {
+    if (backend && (!backend->open || !backend->close || !backend->ioctl)) {
+        errno = EINVAL;
+        return -1;
     }
 
-    if (query.cnt > ION_NUM_HEAP_IDS)
-        query.cnt = ION_NUM_HEAP_IDS;
+    atomic_store_explicit(&ion_backend, backend ? backend : &ion_kernel_backend,
+                          memory_order_release);
+    /*
+     * The new backend may implement the other ABI. The previous snapshot is
+     * leaked rather than freed as a concurrent caller may still be using it.
+     */
+    atomic_store_explicit(&ion_discovery_current, NULL, memory_order_release);
+    return 0;
+}
 
-    for (i = 0; i < ION_NUM_HEAP_IDS; i++)
-         ion_heap_list[i].type = ION_HEAP_TYPE_NONE;
+int exynos_ion_open() {
+    int fd = ion_get_backend()->open();
+    if (fd < 0)
+        ALOGE("open /dev/ion failed: %s", strerror(errno));
+    return fd;
+}
 
-    for (i = 0; i < query.cnt; i++) {
-        if (data[i].heap_id < ION_NUM_HEAP_IDS) {
-            strncpy(ion_heap_list[data[i].heap_id].name, data[i].name, MAX_HEAP_NAME);
-            ion_heap_list[data[i].heap_id].name[MAX_HEAP_NAME - 1] = '\0';
-            ion_heap_list[data[i].heap_id].namelen = strlen(ion_heap_list[data[i].heap_id].name);
-            ion_heap_list[data[i].heap_id].type = data[i].type;
-        }
-    }
+int exynos_ion_close(int fd) {
+    int ret = ion_get_backend()->close(fd);
+    if (ret < 0)
+        ALOGE("closing fd %d of /dev/ion failed: %s", fd, strerror(errno));
+    return ret;
 }
 
-enum ion_version { ION_VERSION_UNKNOWN, ION_VERSION_MODERN, ION_VERSION_LEGACY };
+/*
+ * Heap fallback policy, indexed by legacy heap id. When an allocation from the
+ * lowest heap of a mask fails, it is retried from the fallback heap mask of
+ * that heap with drop_flags cleared, up to ION_FALLBACK_MAX_TIERS times.
+ * Protected allocations never fall back.
+ *
+ * The built-in policy moves carve-out heaps to the system heap. It can be
+ * replaced with the vendor.ion.fallback property, a comma separated list of
+ * "<legacy heap id>:<fallback legacy heap mask>[:<flags to drop>]" entries,
+ * or "none" to disable falling back.
+ */
+#define ION_FALLBACK_MAX_TIERS 3
+#define ION_FALLBACK_PROP "vendor.ion.fallback"
+
+static struct {
+    unsigned int heap_mask;
+    unsigned int drop_flags;
+} ion_fallback_policy[ION_NUM_HEAP_NAMES] = {
+    [ION_EXYNOS_HEAP_ID_VIDEO_FRAME] = { EXYNOS_ION_HEAP_SYSTEM_MASK, ION_FLAG_NOZEROED },
+    [ION_EXYNOS_HEAP_ID_GPU_BUFFER]  = { EXYNOS_ION_HEAP_SYSTEM_MASK, 0 },
+    [ION_EXYNOS_HEAP_ID_EXT_UI]      = { EXYNOS_ION_HEAP_SYSTEM_MASK, 0 },
+};
+static pthread_once_t ion_fallback_once = PTHREAD_ONCE_INIT;
 
-static atomic_int g_ion_version = ATOMIC_VAR_INIT(ION_VERSION_UNKNOWN);
+/* Host builds have no properties and keep the built-in policy */
+static void ion_fallback_load_policy(void) {
+#if defined(__ANDROID__)
+    char value[PROP_VALUE_MAX];
+    char *entry, *saveptr;
 
-static int ion_is_legacy(int ion_fd) {
-    int version = atomic_load_explicit(&g_ion_version, memory_order_acquire);
-    if (version == ION_VERSION_UNKNOWN) {
-        ion_free_handle(ion_fd, 0);
+    if (__system_property_get(ION_FALLBACK_PROP, value) <= 0)
+        return;
 
-        /**
-          * Check for FREE IOCTL here; it is available only in the old
-          * kernels, not the new ones.
-          */
-        version = (errno == ENOTTY) ? ION_VERSION_MODERN : ION_VERSION_LEGACY;
-        if (version == ION_VERSION_MODERN)
-            ion_query_heaps(ion_fd);
+    memset(ion_fallback_policy, 0, sizeof(ion_fallback_policy));
+    if (!strcmp(value, "none"))
+        return;
 
-        atomic_store_explicit(&g_ion_version, version, memory_order_release);
+    for (entry = strtok_r(value, ",", &saveptr); entry; entry = strtok_r(NULL, ",", &saveptr)) {
+        unsigned long id, heap_mask, drop_flags = 0;
+        char *end;
+
+        id = strtoul(entry, &end, 0);
+        if (*end != ':' || id >= ION_NUM_HEAP_NAMES)
+            goto invalid;
+        heap_mask = strtoul(end + 1, &end, 0);
+        if (*end == ':')
+            drop_flags = strtoul(end + 1, &end, 0);
+        if (*end != '\0')
+            goto invalid;
+
+        ion_fallback_policy[id].heap_mask = (unsigned int)heap_mask;
+        ion_fallback_policy[id].drop_flags = (unsigned int)drop_flags;
+        continue;
+invalid:
+        ALOGE("%s: ignoring invalid entry '%s' of %s", __func__, entry, ION_FALLBACK_PROP);
     }
-    return (version == ION_VERSION_LEGACY) ? 1 : 0;
+#endif
 }
 
-int exynos_ion_open() {
-    int fd = open("/dev/ion", O_RDONLY | O_CLOEXEC);
-    if (fd < 0)
-        ALOGE("open /dev/ion failed: %s", strerror(errno));
-    return fd;
+/* The failure of a single tier is not an error; the caller logs the outcome */
+static int ion_alloc_one(int ion_fd, size_t len, unsigned int heap_mask, unsigned int flags) {
+    return ion_is_legacy(ion_fd) ? ion_alloc_legacy(ion_fd, len, heap_mask, flags, true)
+                                 : ion_alloc_modern(ion_fd, len, heap_mask, flags, true);
 }
 
-int exynos_ion_close(int fd) {
-    int ret = close(fd);
-    if (ret < 0)
-        ALOGE("closing fd %d of /dev/ion failed: %s", fd, strerror(errno));
-    return ret;
+/*
+ * Moves heap_mask and flags to the next tier of the fallback policy. Returns
+ * false if there is none; protected buffers never fall back.
+ */
+static bool ion_fallback_next(unsigned int *heap_mask, unsigned int *flags) {
+    unsigned int heap_id;
+
+    if ((*flags & ION_FLAG_PROTECTED) || !*heap_mask)
+        return false;
+
+    heap_id = __builtin_ctz(*heap_mask);
+    if (heap_id >= ION_NUM_HEAP_NAMES || !ion_fallback_policy[heap_id].heap_mask)
+        return false;
+
+    *flags &= ~ion_fallback_policy[heap_id].drop_flags;
+    *heap_mask = ion_fallback_policy[heap_id].heap_mask;
+
+    return true;
+}
+
+int exynos_ion_alloc_fallback(int ion_fd, size_t len, unsigned int heap_mask,
+                              unsigned int flags, unsigned int *used_heap_mask,
+                              unsigned int *used_flags) {
+    unsigned int requested_heap_mask = heap_mask, requested_flags = flags;
+    unsigned int tier;
+    int fd;
+
+    pthread_once(&ion_fallback_once, ion_fallback_load_policy);
+
+    for (tier = 0; ; tier++) {
+        unsigned int failed_heap_mask = heap_mask;
+
+        fd = ion_alloc_one(ion_fd, len, heap_mask, flags);
+        if (fd >= 0 || tier == ION_FALLBACK_MAX_TIERS || !ion_fallback_next(&heap_mask, &flags))
+            break;
+
+        ALOGW("%s: %zu bytes from heap_mask %#x failed, falling back to %#x (tier %u)",
+              __func__, len, failed_heap_mask, heap_mask, tier + 1);
+    }
+
+    if (fd < 0) {
+        int err = errno;
+
+        ALOGE("%s(%d, %zu, %#x, %#x) failed after %u fallback tiers: %s", __func__, ion_fd,
+              len, requested_heap_mask, requested_flags, tier, strerror(err));
+        errno = err;
+        return -1;
+    }
+
+    if (used_heap_mask)
+        *used_heap_mask = heap_mask;
+    if (used_flags)
+        *used_flags = flags;
+
+    return fd;
 }
 
 int exynos_ion_alloc(int ion_fd, size_t len,
                       unsigned int heap_mask, unsigned int flags) {
-    return ion_is_legacy(ion_fd) ? ion_alloc_legacy(ion_fd, len, heap_mask, flags)
-                                 : ion_alloc_modern(ion_fd, len, heap_mask, flags);
+    return exynos_ion_alloc_fallback(ion_fd, len, heap_mask, flags, NULL, NULL);
+}
+
+int exynos_ion_init(void) {
+    const struct ion_discovery *disc = atomic_load_explicit(&ion_discovery_current,
+                                                            memory_order_acquire);
+    int ion_fd;
+
+    if (!disc) {
+        ion_fd = exynos_ion_open();
+        if (ion_fd < 0)
+            return -1;
+
+        disc = ion_get_discovery(ion_fd);
+        exynos_ion_close(ion_fd);
+        if (!disc)
+            return -1;
+    }
+
+    pthread_once(&ion_fallback_once, ion_fallback_load_policy);
+
+    return 0;
+}
+
+/* Releases a buffer that was allocated here and not handed out to the caller */
+static void ion_release_buffer(int ion_fd, int fd) {
+    if (!ion_is_legacy(ion_fd))
+        exynos_ion_free_handle(ion_fd, fd);
+    close(fd);
+}
+
+/* Allocates the whole batch from one heap mask, or nothing */
+static int ion_alloc_batch_one(int ion_fd, const size_t *lens, unsigned int count,
+                               unsigned int heap_mask, unsigned int flags, int *out_fds) {
+    unsigned int modern_heap_mask = 0;
+    unsigned int i;
+    int legacy = ion_is_legacy(ion_fd);
+
+    if (!legacy) {
+        modern_heap_mask = ion_resolve_modern_heapmask(ion_fd, heap_mask, true);
+        if (!modern_heap_mask)
+            return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        out_fds[i] = legacy ? ion_alloc_legacy(ion_fd, lens[i], heap_mask, flags, true)
+                            : ion_alloc_modern_heapmask(ion_fd, lens[i], heap_mask,
+                                                        modern_heap_mask, flags, true);
+        if (out_fds[i] < 0) {
+            int err = errno;
+
+            while (i-- > 0) {
+                ion_release_buffer(ion_fd, out_fds[i]);
+                out_fds[i] = -1;
+            }
+            errno = err;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int exynos_ion_alloc_batch(int ion_fd, const size_t *lens, unsigned int count,
+                           unsigned int heap_mask, unsigned int flags, int *out_fds) {
+    unsigned int requested_heap_mask = heap_mask, requested_flags = flags;
+    unsigned int tier;
+
+    if (!lens || !out_fds || count == 0) {
+        ALOGE("%s: invalid arguments (lens %p, out_fds %p, count %u)", __func__, lens, out_fds,
+              count);
+        errno = EINVAL;
+        return -1;
+    }
+
+    pthread_once(&ion_fallback_once, ion_fallback_load_policy);
+
+    /* a batch falls back as a whole, so that all of its buffers share a heap */
+    for (tier = 0; ; tier++) {
+        unsigned int failed_heap_mask = heap_mask;
+
+        if (!ion_alloc_batch_one(ion_fd, lens, count, heap_mask, flags, out_fds))
+            return 0;
+        if (tier == ION_FALLBACK_MAX_TIERS || !ion_fallback_next(&heap_mask, &flags))
+            break;
+
+        ALOGW("%s: %u buffers from heap_mask %#x failed, falling back to %#x (tier %u)",
+              __func__, count, failed_heap_mask, heap_mask, tier + 1);
+    }
+
+    ALOGE("%s(%d, %u buffers, %#x, %#x) failed after %u fallback tiers: %s", __func__, ion_fd,
+          count, requested_heap_mask, requested_flags, tier, strerror(errno));
+    return -1;
+}
+
+int exynos_ion_alloc_container(int ion_fd, const size_t *lens, unsigned int count,
+                               unsigned int heap_mask, unsigned int flags,
+                               int *container_fd, int *out_fds) {
+    unsigned int i;
+
+    if (!container_fd || !out_fds || count < 2 || count > MAX_BUFCON_BUFS) {
+        ALOGE("%s: invalid arguments (container_fd %p, out_fds %p, count %u)", __func__,
+              container_fd, out_fds, count);
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (exynos_ion_alloc_batch(ion_fd, lens, count, heap_mask, flags, out_fds))
+        return -1;
+
+    *container_fd = dma_buf_merge(out_fds[0], out_fds + 1, count - 1);
+    if (*container_fd < 0) {
+        if (errno == ENOTTY)
+            return 0;
+
+        for (i = 0; i < count; i++) {
+            ion_release_buffer(ion_fd, out_fds[i]);
+            out_fds[i] = -1;
+        }
+        return -1;
+    }
+
+    /* the container holds its own references to the merged buffers */
+    for (i = 0; i < count; i++) {
+        ion_release_buffer(ion_fd, out_fds[i]);
+        out_fds[i] = -1;
+    }
+
+    return 0;
 }
 
 #define DMA_BUF_IOCTL_TRACK    _IO('b', 8)
@@ -267,7 +665,7 @@ int exynos_ion_dma_buf_track(int fd)
     if (!dma_buf_trace_supported)
         return 0;
 
-    if (ioctl(fd, DMA_BUF_IOCTL_TRACK) < 0) {
+    if (exynos_ion_ioctl(fd, DMA_BUF_IOCTL_TRACK, NULL) < 0) {
         if (errno == ENOTTY) {
             dma_buf_trace_supported = false;
             return 0;
@@ -284,7 +682,7 @@ int exynos_ion_dma_buf_untrack(int fd)
     if (!dma_buf_trace_supported)
         return 0;
 
-    if (ioctl(fd, DMA_BUF_IOCTL_UNTRACK) < 0) {
+    if (exynos_ion_ioctl(fd, DMA_BUF_IOCTL_UNTRACK, NULL) < 0) {
         if (errno == ENOTTY) {
             dma_buf_trace_supported = false;
             return 0;
@@ -297,16 +695,21 @@ int exynos_ion_dma_buf_untrack(int fd)
 }
 
 int exynos_ion_import_handle(int ion_fd, int fd, int* handle) {
+    off_t size;
     int ret;
     struct ion_fd_data data = {
         .fd = fd,
     };
 
-    assert(handle == NULL);
+    assert(handle != NULL);
 
     if (!ion_is_legacy(ion_fd)) {
         if (exynos_ion_dma_buf_track(fd))
             return -1;
+        /* the size of a dma-buf is reported by seeking to its end */
+        size = lseek(fd, 0, SEEK_END);
+        exynos_ion_tracker_add_import(fd, size < 0 ? 0 : (size_t)size);
+        exynos_ion_sync_window_clear(fd);
         /*
          * buffer fd is not a handle and they are maintained seperately.
          * But we provide buffer fd as the buffer handle to keep the libion
@@ -317,7 +720,7 @@ int exynos_ion_import_handle(int ion_fd, int fd, int* handle) {
         return 0;
     }
 
-    ret = ioctl(ion_fd, ION_IOC_IMPORT, &data);
+    ret = exynos_ion_ioctl(ion_fd, ION_IOC_IMPORT, &data);
     if (ret < 0) {
         ALOGE("%s(%d, %d) failed: %s", __func__, ion_fd, fd, strerror(errno));
         return -1;
@@ -332,6 +735,8 @@ int exynos_ion_free_handle(int ion_fd, int handle) {
     int ret;
 
     if (!ion_is_legacy(ion_fd)) {
+        exynos_ion_tracker_remove(handle);
+        exynos_ion_sync_window_clear(handle);
         if (exynos_ion_dma_buf_untrack(handle))
             return -1;
         return 0;
@@ -354,7 +759,7 @@ int exynos_ion_sync_fd(int ion_fd, int fd) {
     if (!ion_is_legacy(ion_fd))
         return 0;
 
-    if (ioctl(ion_fd, ION_IOC_SYNC, &data) < 0) {
+    if (exynos_ion_ioctl(ion_fd, ION_IOC_SYNC, &data) < 0) {
         ALOGE("%s(%d, %d) failed: %s", __func__, ion_fd, fd, strerror(errno));
         return -1;
     }
@@ -362,6 +767,17 @@ int exynos_ion_sync_fd(int ion_fd, int fd) {
     return 0;
 }
 
+static int ion_dma_buf_sync(int fd, __u64 flags) {
+    struct dma_buf_sync data = { .flags = flags, };
+
+    if (exynos_ion_ioctl(fd, DMA_BUF_IOCTL_SYNC, &data) < 0) {
+        ALOGE("%s(%d, %llu) failed: %m", __func__, fd, data.flags);
+        return -1;
+    }
+
+    return 0;
+}
+
 int exynos_ion_sync_fd_partial(int ion_fd, int fd, off_t offset, size_t len) {
     struct ion_fd_partial_data data = {
         .fd = fd,
@@ -369,11 +785,14 @@ int exynos_ion_sync_fd_partial(int ion_fd, int fd, off_t offset, size_t len) {
         .len = len
     };
 
-    if (!ion_is_legacy(ion_fd)) {
-        return 0;
-    }
+    /*
+     * Flush like ION_IOC_SYNC_PARTIAL does on legacy kernels. DMA_BUF_IOCTL_SYNC
+     * has no range, so the whole buffer is flushed.
+     */
+    if (!ion_is_legacy(ion_fd))
+        return ion_dma_buf_sync(fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_RW);
 
-    if (ioctl(ion_fd, ION_IOC_SYNC_PARTIAL, &data) < 0) {
+    if (exynos_ion_ioctl(ion_fd, ION_IOC_SYNC_PARTIAL, &data) < 0) {
         ALOGE("%s(%d, %d, %lu, %zu) failed: %s", __func__, ion_fd, fd, offset, len, strerror(errno));
         return -1;
     }
@@ -385,18 +804,9 @@ static int exynos_ion_sync(int ion_fd, int fd, int direction, int sync) {
     if (ion_is_legacy(ion_fd))
         return exynos_ion_sync_fd(ion_fd, fd);
 
-    struct dma_buf_sync data;
-
     direction &= (ION_SYNC_READ | ION_SYNC_WRITE);
 
-    data.flags = sync | direction;
-
-    if (ioctl(fd, DMA_BUF_IOCTL_SYNC, &data) < 0) {
-        ALOGE("%s(%d, %llu) failed: %m", __func__, fd, data.flags);
-        return -1;
-    }
-
-    return 0;
+    return ion_dma_buf_sync(fd, sync | direction);
 }
 
 int exynos_ion_sync_start(int ion_fd, int fd, int direction) {
@@ -406,3 +816,201 @@ int exynos_ion_sync_start(int ion_fd, int fd, int direction) {
 int exynos_ion_sync_end(int ion_fd, int fd, int direction) {
     return exynos_ion_sync(ion_fd, fd, direction, DMA_BUF_SYNC_END);
 }
+
+/*
+ * CPU access windows opened by exynos_ion_sync_start_partial() and not yet
+ * closed. A window keeps the ranges started on its buffer, each with its own
+ * depth, and merges a started range with the ranges it overlaps or adjoins.
+ * DMA_BUF_IOCTL_SYNC has no range, so the first start of a window syncs the
+ * whole buffer and later starts only sync again for a new direction. The end
+ * that closes the last range of a window syncs once for all of them; an end
+ * matching no range is synchronized on its own.
+ *
+ * Windows are forgotten when their buffer is freed through libion. Windows of
+ * fds closed behind libion's back are reclaimed once every slot is in use.
+ * Allocations and imports forget any window left on the number of their new
+ * fd, so ion_sync_window_hint counts the windows per fd bucket, letting them
+ * skip the lock and the scan for the fds that never had a window.
+ */
+#define ION_SYNC_WINDOW_COUNT 32
+#define ION_SYNC_WINDOW_RANGES 8
+#define ION_SYNC_WINDOW_HINTS 256
+
+struct ion_sync_range {
+    off_t start;
+    off_t end;
+    unsigned int depth;
+};
+
+static struct ion_sync_window {
+    int fd;             /* -1 if the slot is free */
+    int direction;
+    unsigned int nr_ranges;
+    struct ion_sync_range ranges[ION_SYNC_WINDOW_RANGES];
+} ion_sync_windows[ION_SYNC_WINDOW_COUNT] = {
+    [0 ... ION_SYNC_WINDOW_COUNT - 1] = { .fd = -1 },
+};
+static pthread_mutex_t ion_sync_windows_lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_uint ion_sync_window_hint[ION_SYNC_WINDOW_HINTS];
+
+static atomic_uint *ion_sync_window_hint_of(int fd) {
+    return &ion_sync_window_hint[(unsigned int)fd % ION_SYNC_WINDOW_HINTS];
+}
+
+static void ion_sync_window_set_fd_locked(struct ion_sync_window *window, int fd) {
+    if (window->fd >= 0)
+        atomic_fetch_sub_explicit(ion_sync_window_hint_of(window->fd), 1, memory_order_relaxed);
+    if (fd >= 0)
+        atomic_fetch_add_explicit(ion_sync_window_hint_of(fd), 1, memory_order_relaxed);
+    window->fd = fd;
+}
+
+static struct ion_sync_window *ion_sync_window_find_locked(int fd) {
+    int i;
+
+    for (i = 0; i < ION_SYNC_WINDOW_COUNT; i++)
+        if (ion_sync_windows[i].fd == fd)
+            return &ion_sync_windows[i];
+
+    return NULL;
+}
+
+static struct ion_sync_window *ion_sync_window_alloc_locked(int fd) {
+    struct ion_sync_window *window = ion_sync_window_find_locked(-1);
+    int i;
+
+    if (!window) {
+        for (i = 0; i < ION_SYNC_WINDOW_COUNT && !window; i++)
+            if (fcntl(ion_sync_windows[i].fd, F_GETFD) < 0 && errno == EBADF)
+                window = &ion_sync_windows[i];
+        if (!window)
+            return NULL;
+    }
+
+    ion_sync_window_set_fd_locked(window, fd);
+    window->direction = 0;
+    window->nr_ranges = 0;
+
+    return window;
+}
+
+static void ion_sync_window_remove_range_locked(struct ion_sync_window *window, unsigned int i) {
+    window->ranges[i] = window->ranges[--window->nr_ranges];
+}
+
+/* Adds [start, end) to window, merging it with the ranges it touches */
+static void ion_sync_window_add_range_locked(struct ion_sync_window *window,
+                                             off_t start, off_t end) {
+    struct ion_sync_range range = { .start = start, .end = end, .depth = 1 };
+    unsigned int i = 0;
+
+    while (i < window->nr_ranges) {
+        struct ion_sync_range *r = &window->ranges[i];
+
+        if (r->end < range.start || range.end < r->start) {
+            i++;
+            continue;
+        }
+
+        if (r->start < range.start)
+            range.start = r->start;
+        if (r->end > range.end)
+            range.end = r->end;
+        range.depth += r->depth;
+        ion_sync_window_remove_range_locked(window, i);
+    }
+
+    /* out of ranges: fold the oldest one in rather than losing its depth */
+    if (window->nr_ranges == ION_SYNC_WINDOW_RANGES) {
+        struct ion_sync_range *r = &window->ranges[0];
+
+        if (r->start < range.start)
+            range.start = r->start;
+        if (r->end > range.end)
+            range.end = r->end;
+        range.depth += r->depth;
+        ion_sync_window_remove_range_locked(window, 0);
+    }
+
+    window->ranges[window->nr_ranges++] = range;
+}
+
+void exynos_ion_sync_window_clear(int fd) {
+    struct ion_sync_window *window;
+
+    if (fd < 0 || !atomic_load_explicit(ion_sync_window_hint_of(fd), memory_order_relaxed))
+        return;
+
+    pthread_mutex_lock(&ion_sync_windows_lock);
+    window = ion_sync_window_find_locked(fd);
+    if (window)
+        ion_sync_window_set_fd_locked(window, -1);
+    pthread_mutex_unlock(&ion_sync_windows_lock);
+}
+
+int exynos_ion_sync_start_partial(int ion_fd, int fd, int direction, off_t offset, size_t len) {
+    struct ion_sync_window *window;
+    int sync = 1;
+
+    if (ion_is_legacy(ion_fd))
+        return exynos_ion_sync_fd_partial(ion_fd, fd, offset, len);
+
+    direction &= (ION_SYNC_READ | ION_SYNC_WRITE);
+
+    pthread_mutex_lock(&ion_sync_windows_lock);
+    window = ion_sync_window_find_locked(fd);
+    if (window) {
+        sync = (window->direction & direction) != direction;
+    } else {
+        window = ion_sync_window_alloc_locked(fd);
+    }
+
+    /* untracked if every window is in use; the end then syncs on its own */
+    if (window) {
+        window->direction |= direction;
+        ion_sync_window_add_range_locked(window, offset, offset + (off_t)len);
+    }
+    pthread_mutex_unlock(&ion_sync_windows_lock);
+
+    if (!sync)
+        return 0;
+
+    return ion_dma_buf_sync(fd, DMA_BUF_SYNC_START | direction);
+}
+
+int exynos_ion_sync_end_partial(int ion_fd, int fd, int direction, off_t offset, size_t len) {
+    struct ion_sync_window *window;
+    off_t end = offset + (off_t)len;
+    unsigned int i;
+
+    if (ion_is_legacy(ion_fd))
+        return exynos_ion_sync_fd_partial(ion_fd, fd, offset, len);
+
+    direction &= (ION_SYNC_READ | ION_SYNC_WRITE);
+
+    pthread_mutex_lock(&ion_sync_windows_lock);
+    window = ion_sync_window_find_locked(fd);
+    if (window) {
+        for (i = 0; i < window->nr_ranges; i++) {
+            struct ion_sync_range *r = &window->ranges[i];
+
+            if (r->start <= offset && end <= r->end)
+                break;
+        }
+
+        if (i < window->nr_ranges) {
+            if (--window->ranges[i].depth == 0)
+                ion_sync_window_remove_range_locked(window, i);
+            if (window->nr_ranges > 0) {
+                pthread_mutex_unlock(&ion_sync_windows_lock);
+                return 0;
+            }
+
+            direction |= window->direction;
+            ion_sync_window_set_fd_locked(window, -1);
+        }
+    }
+    pthread_mutex_unlock(&ion_sync_windows_lock);
+
+    return ion_dma_buf_sync(fd, DMA_BUF_SYNC_END | direction);
+}
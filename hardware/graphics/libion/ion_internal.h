@@ -0,0 +1,65 @@
+/*
+ *  ion_internal.h
+ *
+ *   Copyright 2018 Samsung Electronics Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef __EXYNOS_ION_INTERNAL_H__
+#define __EXYNOS_ION_INTERNAL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Everything declared here is shared between the files of libion only and is
+ * kept out of its exported symbols.
+ */
+#define EXYNOS_ION_HIDDEN __attribute__((visibility("hidden")))
+
+/*
+ * ioctl() through the backend selected by exynos_ion_set_backend() (ion.c)
+ */
+EXYNOS_ION_HIDDEN int exynos_ion_ioctl(int fd, unsigned long request, void *arg);
+
+/*
+ * Drops the CPU access windows of fd (ion.c). Called wherever libion frees a
+ * buffer or hands out a new fd, which may reuse the number of a buffer that
+ * was closed inside a window. Without a lock for fds that never had one.
+ */
+EXYNOS_ION_HIDDEN void exynos_ion_sync_window_clear(int fd);
+
+/*
+ * Buffer lifetime tracking (ion_tracker.c). Buffers are keyed by their
+ * dma-buf fd, which is also the buffer handle on modern ION.
+ */
+EXYNOS_ION_HIDDEN void exynos_ion_tracker_add(int fd, unsigned int legacy_heap_mask, size_t len,
+                                              unsigned int flags);
+/* Tracks an imported buffer, unless fd is tracked already, e.g. allocated here */
+EXYNOS_ION_HIDDEN void exynos_ion_tracker_add_import(int fd, size_t len);
+EXYNOS_ION_HIDDEN void exynos_ion_tracker_remove(int fd);
+/* Whether buffers of ion_fd are tracked, i.e. ION is modern (ion.c) */
+EXYNOS_ION_HIDDEN int exynos_ion_tracker_enabled(int ion_fd);
+
+/*
+ * Allocation statistics (ion_stats.c). exynos_ion_stats_record() accounts one
+ * allocation attempt that started at start_ns to the lowest legacy heap id
+ * of the mask.
+ */
+EXYNOS_ION_HIDDEN uint64_t exynos_ion_stats_now_ns(void);
+EXYNOS_ION_HIDDEN void exynos_ion_stats_record(unsigned int legacy_heap_mask, size_t len,
+                                               int failed, uint64_t start_ns);
+
+#endif /* __EXYNOS_ION_INTERNAL_H__ */
@@ -0,0 +1,315 @@
+/*
+ *  ion_pool.c
+ *
+ *   Copyright 2018 Samsung Electronics Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <unistd.h>
+#include <sys/types.h>
+
+#define LOG_TAG "ion-exynos-pool"
+
+#include <log/log.h>
+
+#include <hardware/exynos/ion.h>
+#include <hardware/exynos/ion_pool.h>
+
+#include "ion_internal.h"
+
+struct ion_pool_class {
+    size_t size;
+    unsigned int count;
+    int *fds;           /* high_watermark entries */
+};
+
+struct exynos_ion_pool {
+    int ion_fd;
+    unsigned int heap_mask;
+    unsigned int flags;
+    unsigned int low_watermark;
+    unsigned int high_watermark;
+    unsigned int nr_classes;
+    int tracked;                            /* buffers are known to the tracker */
+    struct ion_pool_class classes[EXYNOS_ION_POOL_MAX_CLASSES];
+
+    pthread_mutex_t lock;
+    struct exynos_ion_pool_stats stats;     /* protected by lock */
+    /*
+     * Size class + 1 of every fd handed out by exynos_ion_pool_get() and not
+     * yet put back, indexed by fd, 0 for any other fd. Only these buffers
+     * are known to come from the pool's heap mask and flags.
+     */
+    unsigned char *owned;                   /* protected by lock */
+    int nr_owned;
+
+    struct exynos_ion_pool *next;           /* protected by ion_pool_list_lock */
+};
+
+#define ION_POOL_TRIM_BATCH 16
+
+static pthread_mutex_t ion_pool_list_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct exynos_ion_pool *ion_pool_list;
+
+struct exynos_ion_pool *exynos_ion_pool_create(int ion_fd, unsigned int heap_mask,
+                                               unsigned int flags, const size_t *size_classes,
+                                               unsigned int nr_classes,
+                                               unsigned int low_watermark,
+                                               unsigned int high_watermark) {
+    struct exynos_ion_pool *pool;
+    unsigned int i;
+
+    if (nr_classes == 0 || nr_classes > EXYNOS_ION_POOL_MAX_CLASSES ||
+            high_watermark == 0 || low_watermark > high_watermark) {
+        ALOGE("%s: invalid pool configuration (classes %u, watermarks %u/%u)",
+              __func__, nr_classes, low_watermark, high_watermark);
+        return NULL;
+    }
+
+    /* recycled buffers keep their contents, which only NOZEROED buffers may do */
+    if (!(flags & ION_FLAG_NOZEROED)) {
+        ALOGE("%s: pools require ION_FLAG_NOZEROED (flags %#x)", __func__, flags);
+        return NULL;
+    }
+
+    for (i = 0; i < nr_classes; i++) {
+        /* dma-bufs are page granular; a class must match the exported size */
+        if (size_classes[i] == 0 || (size_classes[i] % (size_t)getpagesize()) ||
+                (i > 0 && size_classes[i] <= size_classes[i - 1])) {
+            ALOGE("%s: size classes must be increasing multiples of the page size", __func__);
+            return NULL;
+        }
+    }
+
+    pool = calloc(1, sizeof(*pool));
+    if (!pool)
+        return NULL;
+
+    pool->ion_fd = ion_fd;
+    pool->heap_mask = heap_mask;
+    pool->flags = flags;
+    pool->low_watermark = low_watermark;
+    pool->high_watermark = high_watermark;
+    pool->nr_classes = nr_classes;
+    pool->tracked = exynos_ion_tracker_enabled(ion_fd);
+    pthread_mutex_init(&pool->lock, NULL);
+
+    for (i = 0; i < nr_classes; i++) {
+        pool->classes[i].size = size_classes[i];
+        pool->classes[i].fds = calloc(high_watermark, sizeof(int));
+        if (!pool->classes[i].fds) {
+            exynos_ion_pool_destroy(pool);
+            return NULL;
+        }
+    }
+
+    pthread_mutex_lock(&ion_pool_list_lock);
+    pool->next = ion_pool_list;
+    ion_pool_list = pool;
+    pthread_mutex_unlock(&ion_pool_list_lock);
+
+    return pool;
+}
+
+void exynos_ion_pool_destroy(struct exynos_ion_pool *pool) {
+    struct exynos_ion_pool **p;
+    unsigned int i;
+
+    if (!pool)
+        return;
+
+    pthread_mutex_lock(&ion_pool_list_lock);
+    for (p = &ion_pool_list; *p; p = &(*p)->next) {
+        if (*p == pool) {
+            *p = pool->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&ion_pool_list_lock);
+
+    exynos_ion_pool_trim(pool, EXYNOS_ION_POOL_TRIM_COMPLETE);
+
+    for (i = 0; i < pool->nr_classes; i++)
+        free(pool->classes[i].fds);
+    free(pool->owned);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+static struct ion_pool_class *ion_pool_find_class(struct exynos_ion_pool *pool, size_t len) {
+    unsigned int i;
+
+    for (i = 0; i < pool->nr_classes; i++)
+        if (len <= pool->classes[i].size)
+            return &pool->classes[i];
+
+    return NULL;
+}
+
+/* Records that fd was handed out from class; a failure only costs the reuse */
+static void ion_pool_own_locked(struct exynos_ion_pool *pool, int fd,
+                                struct ion_pool_class *class) {
+    if (fd >= pool->nr_owned) {
+        int nr_owned = pool->nr_owned ? pool->nr_owned : 64;
+        unsigned char *owned;
+
+        while (nr_owned <= fd)
+            nr_owned *= 2;
+        owned = realloc(pool->owned, nr_owned);
+        if (!owned)
+            return;
+        memset(owned + pool->nr_owned, 0, nr_owned - pool->nr_owned);
+        pool->owned = owned;
+        pool->nr_owned = nr_owned;
+    }
+
+    pool->owned[fd] = (unsigned char)(class - pool->classes + 1);
+}
+
+/* Returns the class fd was handed out from, or NULL if it is foreign */
+static struct ion_pool_class *ion_pool_disown_locked(struct exynos_ion_pool *pool, int fd) {
+    unsigned char owner;
+
+    if (fd >= pool->nr_owned || !pool->owned[fd])
+        return NULL;
+
+    owner = pool->owned[fd];
+    pool->owned[fd] = 0;
+
+    return &pool->classes[owner - 1];
+}
+
+int exynos_ion_pool_get(struct exynos_ion_pool *pool, size_t len) {
+    struct ion_pool_class *class = ion_pool_find_class(pool, len);
+    unsigned int used_heap_mask, used_flags;
+    int fd = -1;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stats.gets++;
+    if (class && class->count > 0) {
+        fd = class->fds[--class->count];
+        pool->stats.hits++;
+        pool->stats.buffers_cached--;
+        pool->stats.bytes_cached -= class->size;
+        ion_pool_own_locked(pool, fd, class);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (fd >= 0) {
+        if (pool->tracked)
+            exynos_ion_tracker_add(fd, pool->heap_mask, class->size, pool->flags);
+        return fd;
+    }
+
+    fd = exynos_ion_alloc_fallback(pool->ion_fd, class ? class->size : len, pool->heap_mask,
+                                   pool->flags, &used_heap_mask, &used_flags);
+
+    /* a buffer from a fallback heap is never recycled into this pool */
+    if (fd >= 0 && class && used_heap_mask == pool->heap_mask && used_flags == pool->flags) {
+        pthread_mutex_lock(&pool->lock);
+        ion_pool_own_locked(pool, fd, class);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return fd;
+}
+
+void exynos_ion_pool_put(struct exynos_ion_pool *pool, int fd) {
+    struct ion_pool_class *class;
+    off_t size;
+
+    if (fd < 0)
+        return;
+
+    /*
+     * The buffer goes to its next user without the windows of this one. It is
+     * untracked before another thread can take it from the free list, and
+     * tracked again when it is handed out, so idle buffers are not leaks.
+     */
+    exynos_ion_sync_window_clear(fd);
+    exynos_ion_tracker_remove(fd);
+
+    /* the size of a dma-buf is reported by seeking to its end */
+    size = lseek(fd, 0, SEEK_END);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stats.puts++;
+    class = ion_pool_disown_locked(pool, fd);
+    if (!class || size < 0 || (size_t)size != class->size) {
+        /* not handed out by this pool, or its fd was closed and reused */
+        pool->stats.rejected++;
+        pool->stats.released++;
+    } else if (class->count < pool->high_watermark) {
+        class->fds[class->count++] = fd;
+        pool->stats.buffers_cached++;
+        pool->stats.bytes_cached += class->size;
+        fd = -1;
+    } else {
+        pool->stats.released++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (fd >= 0)
+        close(fd);
+}
+
+void exynos_ion_pool_trim(struct exynos_ion_pool *pool, int level) {
+    unsigned int keep = (level == EXYNOS_ION_POOL_TRIM_COMPLETE) ? 0 : pool->low_watermark;
+    int fds[ION_POOL_TRIM_BATCH];
+    unsigned int i;
+
+    /* close() outside of the lock, in batches */
+    for (i = 0; i < pool->nr_classes; i++) {
+        struct ion_pool_class *class = &pool->classes[i];
+        unsigned int nr_fds, taken;
+
+        do {
+            nr_fds = 0;
+
+            pthread_mutex_lock(&pool->lock);
+            while (class->count > keep && nr_fds < ION_POOL_TRIM_BATCH) {
+                fds[nr_fds++] = class->fds[--class->count];
+                pool->stats.buffers_cached--;
+                pool->stats.bytes_cached -= class->size;
+                pool->stats.released++;
+            }
+            pthread_mutex_unlock(&pool->lock);
+
+            taken = nr_fds;
+            while (nr_fds > 0)
+                close(fds[--nr_fds]);
+        } while (taken == ION_POOL_TRIM_BATCH);
+    }
+}
+
+void exynos_ion_pool_trim_all(int level) {
+    struct exynos_ion_pool *pool;
+
+    pthread_mutex_lock(&ion_pool_list_lock);
+    for (pool = ion_pool_list; pool; pool = pool->next)
+        exynos_ion_pool_trim(pool, level);
+    pthread_mutex_unlock(&ion_pool_list_lock);
+}
+
+void exynos_ion_pool_get_stats(struct exynos_ion_pool *pool,
+                               struct exynos_ion_pool_stats *stats) {
+    pthread_mutex_lock(&pool->lock);
+    *stats = pool->stats;
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,149 @@
+/*
+ *  ion_stats.c
+ *
+ *   Copyright 2018 Samsung Electronics Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <stdatomic.h>
+
+#define LOG_TAG "ion-exynos-stats"
+
+#include <log/log.h>
+
+#include <hardware/exynos/ion.h>
+
+#include "ion_internal.h"
+
+/*
+ * Allocation statistics are accumulated in a few slots. Each thread sticks to
+ * the slot it is given on its first allocation so that concurrent allocators
+ * rarely share cache lines, and readers merge all slots.
+ */
+#define ION_STATS_SLOTS 8
+
+struct ion_stats_heap {
+    atomic_uint_fast64_t count;
+    atomic_uint_fast64_t bytes;
+    atomic_uint_fast64_t failures;
+    atomic_uint_fast64_t latency[EXYNOS_ION_LATENCY_BUCKETS];
+};
+
+static struct ion_stats_slot {
+    struct ion_stats_heap heaps[EXYNOS_ION_STATS_HEAPS];
+} ion_stats_slots[ION_STATS_SLOTS];
+
+static atomic_uint ion_stats_next_slot = ATOMIC_VAR_INIT(0);
+static __thread int ion_stats_thread_slot = -1;
+
+uint64_t exynos_ion_stats_now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static unsigned int ion_stats_bucket(uint64_t latency_ns) {
+    uint64_t us = latency_ns / 1000;
+    unsigned int bucket;
+
+    if (us == 0)
+        return 0;
+
+    bucket = 64 - __builtin_clzll(us);
+    return bucket < EXYNOS_ION_LATENCY_BUCKETS ? bucket : EXYNOS_ION_LATENCY_BUCKETS - 1;
+}
+
+void exynos_ion_stats_record(unsigned int legacy_heap_mask, size_t len, int failed,
+                             uint64_t start_ns) {
+    uint64_t latency_ns = exynos_ion_stats_now_ns() - start_ns;
+    struct ion_stats_heap *heap;
+    unsigned int heap_id;
+
+    if (!legacy_heap_mask)
+        return;
+
+    heap_id = __builtin_ctz(legacy_heap_mask);
+    if (heap_id >= EXYNOS_ION_STATS_HEAPS)
+        return;
+
+    if (ion_stats_thread_slot < 0)
+        ion_stats_thread_slot = atomic_fetch_add_explicit(&ion_stats_next_slot, 1,
+                                                          memory_order_relaxed) % ION_STATS_SLOTS;
+
+    heap = &ion_stats_slots[ion_stats_thread_slot].heaps[heap_id];
+    atomic_fetch_add_explicit(&heap->count, 1, memory_order_relaxed);
+    if (failed)
+        atomic_fetch_add_explicit(&heap->failures, 1, memory_order_relaxed);
+    else
+        atomic_fetch_add_explicit(&heap->bytes, len, memory_order_relaxed);
+    atomic_fetch_add_explicit(&heap->latency[ion_stats_bucket(latency_ns)], 1,
+                              memory_order_relaxed);
+}
+
+int exynos_ion_get_stats(struct exynos_ion_heap_stats stats[EXYNOS_ION_STATS_HEAPS]) {
+    unsigned int slot, heap_id, bucket;
+
+    memset(stats, 0, sizeof(*stats) * EXYNOS_ION_STATS_HEAPS);
+
+    for (slot = 0; slot < ION_STATS_SLOTS; slot++) {
+        for (heap_id = 0; heap_id < EXYNOS_ION_STATS_HEAPS; heap_id++) {
+            struct ion_stats_heap *heap = &ion_stats_slots[slot].heaps[heap_id];
+
+            stats[heap_id].count += atomic_load_explicit(&heap->count, memory_order_relaxed);
+            stats[heap_id].bytes += atomic_load_explicit(&heap->bytes, memory_order_relaxed);
+            stats[heap_id].failures += atomic_load_explicit(&heap->failures,
+                                                            memory_order_relaxed);
+            for (bucket = 0; bucket < EXYNOS_ION_LATENCY_BUCKETS; bucket++)
+                stats[heap_id].latency_us[bucket] +=
+                        atomic_load_explicit(&heap->latency[bucket], memory_order_relaxed);
+        }
+    }
+
+    return 0;
+}
+
+void exynos_ion_dump_stats(int out_fd) {
+    struct exynos_ion_heap_stats stats[EXYNOS_ION_STATS_HEAPS];
+    unsigned int heap_id, bucket;
+
+    exynos_ion_get_stats(stats);
+
+    for (heap_id = 0; heap_id < EXYNOS_ION_STATS_HEAPS; heap_id++) {
+        const char *name = exynos_ion_get_heap_name(heap_id);
+
+        if (!stats[heap_id].count)
+            continue;
+
+        dprintf(out_fd, "%s (heap id %u): %llu allocs, %llu bytes, %llu failures\n",
+                name ? name : "unknown", heap_id,
+                (unsigned long long)stats[heap_id].count,
+                (unsigned long long)stats[heap_id].bytes,
+                (unsigned long long)stats[heap_id].failures);
+
+        dprintf(out_fd, "  latency(us):");
+        for (bucket = 0; bucket < EXYNOS_ION_LATENCY_BUCKETS; bucket++) {
+            if (!stats[heap_id].latency_us[bucket])
+                continue;
+            dprintf(out_fd, " <%llu:%llu", 1ULL << bucket,
+                    (unsigned long long)stats[heap_id].latency_us[bucket]);
+        }
+        dprintf(out_fd, "\n");
+    }
+}
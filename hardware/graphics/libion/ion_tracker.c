@@ -0,0 +1,367 @@
+/*
+ *  ion_tracker.c
+ *
+ *   Copyright 2018 Samsung Electronics Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <stdatomic.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#define LOG_TAG "ion-exynos-tracker"
+
+#include <log/log.h>
+
+#include <hardware/exynos/ion.h>
+
+#include "ion_internal.h"
+
+/*
+ * Live buffers are kept in fixed-size records in a single arena that is
+ * mapped on first use. The arena is split into shards selected by the fd and
+ * each shard is an open addressing table probed linearly. Slots are claimed
+ * and released with compare-and-swap on their key, so there is no lock on the
+ * allocation path. A claimed slot is keyed ION_TRACKER_CLAIMED until its
+ * record is written, and only then published under its fd. Record contents
+ * are guarded by a per-record sequence counter that lets the dump skip
+ * records that are being rewritten.
+ */
+#define ION_TRACKER_SHARDS          16
+#define ION_TRACKER_SHARD_SLOTS     64
+#define ION_TRACKER_TAG_LEN         16
+
+/* legacy heap ids index the groups of the dump, imported buffers come last */
+#define ION_TRACKER_HEAP_GROUPS     16
+
+#define ION_TRACKER_EMPTY           (-1)
+#define ION_TRACKER_TOMBSTONE       (-2)
+#define ION_TRACKER_CLAIMED         (-3)
+
+struct ion_buffer_record {
+    atomic_int fd;
+    atomic_uint seq;        /* odd while the record is being written */
+    unsigned int heap_mask; /* legacy heap mask, 0 for imported buffers */
+    unsigned int flags;
+    size_t len;
+    uint64_t timestamp_ns;
+    char tag[ION_TRACKER_TAG_LEN];
+};
+
+struct ion_tracker_arena {
+    struct ion_buffer_record shards[ION_TRACKER_SHARDS][ION_TRACKER_SHARD_SLOTS];
+};
+
+static _Atomic(struct ion_tracker_arena *) ion_tracker_arena = ATOMIC_VAR_INIT(NULL);
+static atomic_uint ion_tracker_dropped = ATOMIC_VAR_INIT(0);
+
+static uint64_t ion_tracker_now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static struct ion_tracker_arena *ion_tracker_get_arena(int create) {
+    struct ion_tracker_arena *arena = atomic_load_explicit(&ion_tracker_arena,
+                                                           memory_order_acquire);
+    struct ion_tracker_arena *expected = NULL;
+    unsigned int i, j;
+
+    if (arena || !create)
+        return arena;
+
+    arena = mmap(NULL, sizeof(*arena), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (arena == MAP_FAILED)
+        return NULL;
+
+    for (i = 0; i < ION_TRACKER_SHARDS; i++)
+        for (j = 0; j < ION_TRACKER_SHARD_SLOTS; j++)
+            atomic_init(&arena->shards[i][j].fd, ION_TRACKER_EMPTY);
+
+    if (!atomic_compare_exchange_strong_explicit(&ion_tracker_arena, &expected, arena,
+                                                 memory_order_acq_rel, memory_order_acquire)) {
+        munmap(arena, sizeof(*arena));
+        arena = expected;
+    }
+
+    return arena;
+}
+
+static struct ion_buffer_record *ion_tracker_shard(struct ion_tracker_arena *arena, int fd) {
+    return arena->shards[(unsigned int)fd % ION_TRACKER_SHARDS];
+}
+
+static unsigned int ion_tracker_slot(int fd) {
+    /* fds are dense; spread neighbours that land in the same shard */
+    return ((unsigned int)fd / ION_TRACKER_SHARDS * 2654435761U) % ION_TRACKER_SHARD_SLOTS;
+}
+
+static struct ion_buffer_record *ion_tracker_find(struct ion_tracker_arena *arena, int fd) {
+    struct ion_buffer_record *shard = ion_tracker_shard(arena, fd);
+    unsigned int slot = ion_tracker_slot(fd);
+    unsigned int i;
+
+    for (i = 0; i < ION_TRACKER_SHARD_SLOTS; i++) {
+        struct ion_buffer_record *rec = &shard[(slot + i) % ION_TRACKER_SHARD_SLOTS];
+        int key = atomic_load_explicit(&rec->fd, memory_order_acquire);
+
+        if (key == fd)
+            return rec;
+        if (key == ION_TRACKER_EMPTY)
+            break;
+    }
+
+    return NULL;
+}
+
+/* Claims a free slot for fd, which must be published with ion_tracker_publish() */
+static struct ion_buffer_record *ion_tracker_claim(struct ion_tracker_arena *arena, int fd) {
+    struct ion_buffer_record *shard = ion_tracker_shard(arena, fd);
+    unsigned int slot = ion_tracker_slot(fd);
+    unsigned int i;
+
+    for (i = 0; i < ION_TRACKER_SHARD_SLOTS; i++) {
+        struct ion_buffer_record *rec = &shard[(slot + i) % ION_TRACKER_SHARD_SLOTS];
+        int key = atomic_load_explicit(&rec->fd, memory_order_relaxed);
+
+        while (key == ION_TRACKER_EMPTY || key == ION_TRACKER_TOMBSTONE) {
+            if (atomic_compare_exchange_weak_explicit(&rec->fd, &key, ION_TRACKER_CLAIMED,
+                                                      memory_order_acq_rel,
+                                                      memory_order_relaxed))
+                return rec;
+        }
+    }
+
+    return NULL;
+}
+
+static void ion_tracker_publish(struct ion_buffer_record *rec, int fd) {
+    atomic_store_explicit(&rec->fd, fd, memory_order_release);
+}
+
+static void ion_tracker_write(struct ion_buffer_record *rec, unsigned int heap_mask,
+                              size_t len, unsigned int flags) {
+    unsigned int seq = atomic_load_explicit(&rec->seq, memory_order_relaxed);
+
+    atomic_store_explicit(&rec->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    rec->heap_mask = heap_mask;
+    rec->flags = flags;
+    rec->len = len;
+    rec->timestamp_ns = ion_tracker_now_ns();
+    rec->tag[0] = '\0';
+
+    atomic_store_explicit(&rec->seq, seq + 2, memory_order_release);
+}
+
+static void ion_tracker_record(int fd, unsigned int legacy_heap_mask, size_t len,
+                               unsigned int flags, int keep_existing) {
+    struct ion_tracker_arena *arena = ion_tracker_get_arena(1);
+    struct ion_buffer_record *rec;
+
+    if (!arena || fd < 0)
+        return;
+
+    /* a stale record is left behind if the fd was closed without being freed */
+    rec = ion_tracker_find(arena, fd);
+    if (rec) {
+        if (!keep_existing)
+            ion_tracker_write(rec, legacy_heap_mask, len, flags);
+        return;
+    }
+
+    rec = ion_tracker_claim(arena, fd);
+    if (!rec) {
+        atomic_fetch_add_explicit(&ion_tracker_dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    ion_tracker_write(rec, legacy_heap_mask, len, flags);
+    ion_tracker_publish(rec, fd);
+}
+
+void exynos_ion_tracker_add(int fd, unsigned int legacy_heap_mask, size_t len,
+                            unsigned int flags) {
+    ion_tracker_record(fd, legacy_heap_mask, len, flags, 0);
+}
+
+void exynos_ion_tracker_add_import(int fd, size_t len) {
+    ion_tracker_record(fd, 0, len, 0, 1);
+}
+
+void exynos_ion_tracker_remove(int fd) {
+    struct ion_tracker_arena *arena = ion_tracker_get_arena(0);
+    struct ion_buffer_record *rec;
+
+    if (!arena || fd < 0)
+        return;
+
+    rec = ion_tracker_find(arena, fd);
+    if (rec)
+        atomic_store_explicit(&rec->fd, ION_TRACKER_TOMBSTONE, memory_order_release);
+}
+
+int exynos_ion_buffer_set_tag(int fd, const char *tag) {
+    struct ion_tracker_arena *arena = ion_tracker_get_arena(0);
+    struct ion_buffer_record *rec;
+    unsigned int seq;
+
+    if (!arena)
+        return -1;
+
+    rec = ion_tracker_find(arena, fd);
+    if (!rec)
+        return -1;
+
+    seq = atomic_load_explicit(&rec->seq, memory_order_relaxed);
+    atomic_store_explicit(&rec->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    strncpy(rec->tag, tag, ION_TRACKER_TAG_LEN - 1);
+    rec->tag[ION_TRACKER_TAG_LEN - 1] = '\0';
+
+    atomic_store_explicit(&rec->seq, seq + 2, memory_order_release);
+
+    return 0;
+}
+
+/* Copies a live record, or returns -1 if it is free or being rewritten */
+static int ion_tracker_read(struct ion_buffer_record *rec, int *fd,
+                            struct ion_buffer_record *out) {
+    unsigned int seq = atomic_load_explicit(&rec->seq, memory_order_acquire);
+
+    *fd = atomic_load_explicit(&rec->fd, memory_order_acquire);
+    if ((seq & 1) || *fd < 0)
+        return -1;
+
+    out->heap_mask = rec->heap_mask;
+    out->flags = rec->flags;
+    out->len = rec->len;
+    out->timestamp_ns = rec->timestamp_ns;
+    memcpy(out->tag, rec->tag, ION_TRACKER_TAG_LEN);
+    out->tag[ION_TRACKER_TAG_LEN - 1] = '\0';
+
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&rec->seq, memory_order_relaxed) != seq)
+        return -1;
+
+    return 0;
+}
+
+/*
+ * Returns whether fd may still refer to the buffer of rec. A buffer closed
+ * with close() instead of exynos_ion_free_handle() stays in the tracker, and
+ * its fd number may since have been reused. Only a closed fd or one of
+ * another size is told apart: before Linux 5.3 every dma-buf shares one
+ * inode, so the identity of the file does not tell buffers apart either.
+ */
+static int ion_tracker_is_live(int fd, const struct ion_buffer_record *rec) {
+    off_t size;
+
+    if (fcntl(fd, F_GETFD) < 0)
+        return 0;
+
+    size = lseek(fd, 0, SEEK_END);
+    return !rec->len || size < 0 || (size_t)size == rec->len;
+}
+
+/*
+ * Walks every live record, grouped by the lowest legacy heap id of its mask.
+ * Imported buffers have no heap and are listed last. Records younger than
+ * min_age_ms and records whose fd no longer refers to their buffer are
+ * skipped; the latter are counted in *stale.
+ */
+static unsigned int ion_tracker_dump(int out_fd, uint64_t min_age_ms, unsigned int *stale) {
+    struct ion_tracker_arena *arena = ion_tracker_get_arena(0);
+    uint64_t now = ion_tracker_now_ns();
+    unsigned int heap_id, i, j, total = 0;
+
+    *stale = 0;
+    if (!arena)
+        return 0;
+
+    for (heap_id = 0; heap_id <= ION_TRACKER_HEAP_GROUPS; heap_id++) {
+        const char *name = exynos_ion_get_heap_name(heap_id);
+        unsigned int count = 0;
+        size_t bytes = 0;
+
+        for (i = 0; i < ION_TRACKER_SHARDS; i++) {
+            for (j = 0; j < ION_TRACKER_SHARD_SLOTS; j++) {
+                struct ion_buffer_record rec;
+                uint64_t age_ms;
+                int fd;
+
+                if (ion_tracker_read(&arena->shards[i][j], &fd, &rec))
+                    continue;
+
+                if (rec.heap_mask ? (unsigned int)__builtin_ctz(rec.heap_mask) != heap_id
+                                  : heap_id != ION_TRACKER_HEAP_GROUPS)
+                    continue;
+
+                age_ms = (now - rec.timestamp_ns) / 1000000;
+                if (age_ms < min_age_ms)
+                    continue;
+
+                if (!ion_tracker_is_live(fd, &rec)) {
+                    (*stale)++;
+                    continue;
+                }
+
+                if (count++ == 0) {
+                    if (heap_id == ION_TRACKER_HEAP_GROUPS)
+                        dprintf(out_fd, "imported:\n");
+                    else
+                        dprintf(out_fd, "%s (heap id %u):\n", name ? name : "unknown", heap_id);
+                }
+                bytes += rec.len;
+                dprintf(out_fd, "  fd %d size %zu flags %#x age %llu ms%s%s\n", fd, rec.len,
+                        rec.flags, (unsigned long long)age_ms, rec.tag[0] ? " tag " : "",
+                        rec.tag);
+            }
+        }
+
+        if (count)
+            dprintf(out_fd, "  %u buffers, %zu bytes\n", count, bytes);
+        total += count;
+    }
+
+    return total;
+}
+
+void exynos_ion_dump_buffers(int out_fd) {
+    unsigned int stale;
+    unsigned int total = ion_tracker_dump(out_fd, 0, &stale);
+
+    dprintf(out_fd, "%u live buffers, %u untracked, %u closed without being freed\n", total,
+            atomic_load_explicit(&ion_tracker_dropped, memory_order_relaxed), stale);
+}
+
+unsigned int exynos_ion_report_leaks(int out_fd, uint64_t min_age_ms) {
+    unsigned int stale;
+
+    return ion_tracker_dump(out_fd, min_age_ms, &stale);
+}
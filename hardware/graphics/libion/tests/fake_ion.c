@@ -0,0 +1,268 @@
+/*
+ *  fake_ion.c
+ *
+ *   Copyright 2018 Samsung Electronics Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <linux/dma-buf.h>
+
+#include <hardware/exynos/ion.h>
+
+#include "fake_ion.h"
+#include "ion_uapi.h"
+
+#define FAKE_ION_MAX_HANDLES 4096
+
+static const struct {
+    const char *name;
+    uint32_t modern_id;
+} fake_ion_heaps[] = {
+    { "ion_system_heap", FAKE_ION_MODERN_SYSTEM_ID },
+    { "vframe_heap",     FAKE_ION_MODERN_VIDEO_FRAME_ID },
+    { "gpu_buffer",      FAKE_ION_MODERN_GPU_BUFFER_ID },
+};
+
+#define FAKE_ION_HEAP_COUNT (sizeof(fake_ion_heaps) / sizeof(fake_ion_heaps[0]))
+
+static pthread_mutex_t fake_ion_lock = PTHREAD_MUTEX_INITIALIZER;
+static int fake_ion_version;
+static uint32_t fake_ion_fail_mask;
+static struct fake_ion_counters fake_ion_counters;
+/* memfd of every legacy handle, handle - 1 indexed, -1 if free */
+static int fake_ion_handles[FAKE_ION_MAX_HANDLES] = {
+    [0 ... FAKE_ION_MAX_HANDLES - 1] = -1,
+};
+
+static int fake_ion_open(void) {
+    return memfd_create("fake-ion", MFD_CLOEXEC);
+}
+
+static int fake_ion_new_buffer(size_t len) {
+    int fd = memfd_create("fake-ion-buffer", MFD_CLOEXEC);
+
+    if (fd < 0)
+        return -1;
+
+    if (ftruncate(fd, (off_t)len) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static int fake_ion_alloc_locked(uint32_t heap_id_mask, uint32_t flags, size_t len) {
+    int fd;
+
+    fake_ion_counters.last_heap_id_mask = heap_id_mask;
+    fake_ion_counters.last_flags = flags;
+
+    if (!heap_id_mask || (heap_id_mask & fake_ion_fail_mask)) {
+        fake_ion_counters.failed_allocs++;
+        errno = ENOMEM;
+        return -1;
+    }
+
+    fd = fake_ion_new_buffer(len);
+    if (fd >= 0)
+        fake_ion_counters.allocs++;
+
+    return fd;
+}
+
+static int fake_ion_new_handle_locked(int fd) {
+    int i;
+
+    for (i = 0; i < FAKE_ION_MAX_HANDLES; i++) {
+        if (fake_ion_handles[i] < 0) {
+            fake_ion_handles[i] = fd;
+            return i + 1;
+        }
+    }
+
+    close(fd);
+    errno = ENOMEM;
+    return -1;
+}
+
+static int *fake_ion_handle_locked(int handle) {
+    if (handle < 1 || handle > FAKE_ION_MAX_HANDLES || fake_ion_handles[handle - 1] < 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return &fake_ion_handles[handle - 1];
+}
+
+static int fake_ion_legacy_ioctl_locked(unsigned long request, void *arg) {
+    switch (request) {
+    case ION_IOC_ALLOC_LEGACY: {
+        struct ion_allocation_data_legacy *data = arg;
+        int fd = fake_ion_alloc_locked(data->heap_id_mask, data->flags, data->len);
+
+        if (fd < 0)
+            return -1;
+
+        data->handle = fake_ion_new_handle_locked(fd);
+        return data->handle < 0 ? -1 : 0;
+    }
+    case ION_IOC_FREE: {
+        struct ion_handle_data *data = arg;
+        int *fd = fake_ion_handle_locked(data->handle);
+
+        if (!fd)
+            return -1;
+
+        close(*fd);
+        *fd = -1;
+        fake_ion_counters.frees++;
+        return 0;
+    }
+    case ION_IOC_SHARE: {
+        struct ion_fd_data *data = arg;
+        int *fd = fake_ion_handle_locked(data->handle);
+
+        if (!fd)
+            return -1;
+
+        data->fd = fcntl(*fd, F_DUPFD_CLOEXEC, 0);
+        return data->fd < 0 ? -1 : 0;
+    }
+    case ION_IOC_IMPORT: {
+        struct ion_fd_data *data = arg;
+        int fd = fcntl(data->fd, F_DUPFD_CLOEXEC, 0);
+
+        if (fd < 0)
+            return -1;
+
+        data->handle = fake_ion_new_handle_locked(fd);
+        return data->handle < 0 ? -1 : 0;
+    }
+    case ION_IOC_SYNC:
+    case ION_IOC_SYNC_PARTIAL:
+        fake_ion_counters.legacy_syncs++;
+        return 0;
+    }
+
+    errno = ENOTTY;
+    return -1;
+}
+
+static int fake_ion_modern_ioctl_locked(unsigned long request, void *arg) {
+    switch (request) {
+    case ION_IOC_HEAP_QUERY: {
+        struct ion_heap_query *query = arg;
+        struct ion_heap_data *heaps = (struct ion_heap_data *)(uintptr_t)query->heaps;
+        unsigned int i;
+
+        if (heaps) {
+            for (i = 0; i < FAKE_ION_HEAP_COUNT && i < query->cnt; i++) {
+                memset(&heaps[i], 0, sizeof(heaps[i]));
+                strncpy(heaps[i].name, fake_ion_heaps[i].name, MAX_HEAP_NAME - 1);
+                heaps[i].type = ION_HEAP_TYPE_SYSTEM;
+                heaps[i].heap_id = fake_ion_heaps[i].modern_id;
+            }
+        }
+        query->cnt = FAKE_ION_HEAP_COUNT;
+        return 0;
+    }
+    case ION_IOC_ALLOC_MODERN: {
+        struct ion_allocation_data_modern *data = arg;
+        int fd = fake_ion_alloc_locked(data->heap_id_mask, data->flags, data->len);
+
+        if (fd < 0)
+            return -1;
+
+        data->fd = (__u32)fd;
+        return 0;
+    }
+    case DMA_BUF_IOCTL_SYNC: {
+        struct dma_buf_sync *data = arg;
+
+        if (data->flags & DMA_BUF_SYNC_END)
+            fake_ion_counters.sync_ends++;
+        else
+            fake_ion_counters.sync_starts++;
+        return 0;
+    }
+    }
+
+    /* ION_IOC_FREE included: its absence identifies the modern ABI */
+    errno = ENOTTY;
+    return -1;
+}
+
+static int fake_ion_ioctl(int fd, unsigned long request, void *arg) {
+    int ret;
+
+    (void)fd;
+
+    pthread_mutex_lock(&fake_ion_lock);
+    if (fake_ion_version == FAKE_ION_LEGACY)
+        ret = fake_ion_legacy_ioctl_locked(request, arg);
+    else
+        ret = fake_ion_modern_ioctl_locked(request, arg);
+    pthread_mutex_unlock(&fake_ion_lock);
+
+    return ret;
+}
+
+static const struct exynos_ion_backend fake_ion_backend = {
+    .open = fake_ion_open,
+    .close = close,
+    .ioctl = fake_ion_ioctl,
+};
+
+void fake_ion_install(int version) {
+    int i;
+
+    pthread_mutex_lock(&fake_ion_lock);
+    fake_ion_version = version;
+    fake_ion_fail_mask = 0;
+    memset(&fake_ion_counters, 0, sizeof(fake_ion_counters));
+    for (i = 0; i < FAKE_ION_MAX_HANDLES; i++) {
+        if (fake_ion_handles[i] >= 0)
+            close(fake_ion_handles[i]);
+        fake_ion_handles[i] = -1;
+    }
+    pthread_mutex_unlock(&fake_ion_lock);
+
+    exynos_ion_set_backend(&fake_ion_backend);
+}
+
+void fake_ion_uninstall(void) {
+    exynos_ion_set_backend(NULL);
+}
+
+void fake_ion_set_fail_mask(uint32_t fail_mask) {
+    pthread_mutex_lock(&fake_ion_lock);
+    fake_ion_fail_mask = fail_mask;
+    pthread_mutex_unlock(&fake_ion_lock);
+}
+
+void fake_ion_get_counters(struct fake_ion_counters *counters) {
+    pthread_mutex_lock(&fake_ion_lock);
+    *counters = fake_ion_counters;
+    pthread_mutex_unlock(&fake_ion_lock);
+}
@@ -0,0 +1,70 @@
+/*
+ *  fake_ion.h
+ *
+ *   Copyright 2018 Samsung Electronics Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef __EXYNOS_FAKE_ION_H__
+#define __EXYNOS_FAKE_ION_H__
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+
+/*
+ * Userspace ION device for the libion tests and benchmarks, installed with
+ * exynos_ion_set_backend(). Buffers are memfds of the requested size, so
+ * libion can seek, map and close them like dma-bufs.
+ *
+ * The modern device numbers its heaps differently from the legacy heap ids,
+ * so that an allocation only reaches the right heap if libion resolved the
+ * heap by name.
+ */
+#define FAKE_ION_LEGACY 0
+#define FAKE_ION_MODERN 1
+
+/* kernel heap ids of the modern device */
+#define FAKE_ION_MODERN_SYSTEM_ID      2
+#define FAKE_ION_MODERN_VIDEO_FRAME_ID 7
+#define FAKE_ION_MODERN_GPU_BUFFER_ID  11
+
+struct fake_ion_counters {
+    unsigned int allocs;        /* successful allocations */
+    unsigned int failed_allocs;
+    unsigned int frees;         /* legacy handles freed */
+    unsigned int sync_starts;   /* DMA_BUF_IOCTL_SYNC with DMA_BUF_SYNC_START */
+    unsigned int sync_ends;
+    unsigned int legacy_syncs;  /* ION_IOC_SYNC and ION_IOC_SYNC_PARTIAL */
+    uint32_t last_heap_id_mask; /* as passed to the alloc ioctl */
+    uint32_t last_flags;
+};
+
+__BEGIN_DECLS
+
+/* Resets the device and installs it as the libion backend */
+void fake_ion_install(int version);
+/* Restores the kernel backend */
+void fake_ion_uninstall(void);
+
+/*
+ * Allocations whose ioctl heap mask intersects fail_mask fail with ENOMEM.
+ * The mask is in kernel heap ids, i.e. legacy ids on the legacy device.
+ */
+void fake_ion_set_fail_mask(uint32_t fail_mask);
+
+void fake_ion_get_counters(struct fake_ion_counters *counters);
+
+__END_DECLS
+
+#endif /* __EXYNOS_FAKE_ION_H__ */
@@ -0,0 +1,302 @@
+/*
+ *  ion_benchmark.cpp
+ *
+ *   Copyright 2018 Samsung Electronics Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+// Cost of the libion allocation, import, sync and free paths on top of the
+// device, measured against the fake ION device of both ABIs so that the kernel
+// does not dominate. Where the kernel provides /dev/ion, the cost of syncs is
+// also measured on it.
+
+#include <unistd.h>
+
+#include <benchmark/benchmark.h>
+
+#include <hardware/exynos/dmabuf_container.h>
+#include <hardware/exynos/ion.h>
+#include <hardware/exynos/ion_pool.h>
+
+#include "fake_ion.h"
+
+namespace {
+
+class FakeIon {
+  public:
+    explicit FakeIon(int version) {
+        fake_ion_install(version);
+        mIonFd = exynos_ion_open();
+    }
+
+    ~FakeIon() {
+        if (mIonFd >= 0)
+            exynos_ion_close(mIonFd);
+        fake_ion_uninstall();
+    }
+
+    int fd() const { return mIonFd; }
+
+  private:
+    int mIonFd;
+};
+
+void allocFree(benchmark::State &state, int version, unsigned int heap_mask,
+               uint32_t fail_mask) {
+    FakeIon ion(version);
+    const size_t len = static_cast<size_t>(state.range(0));
+
+    if (ion.fd() < 0) {
+        state.SkipWithError("unable to open the fake ION device");
+        return;
+    }
+    fake_ion_set_fail_mask(fail_mask);
+
+    for (auto _ : state) {
+        int fd = exynos_ion_alloc(ion.fd(), len, heap_mask, 0);
+        if (fd < 0) {
+            state.SkipWithError("allocation failed");
+            break;
+        }
+        exynos_ion_free_handle(ion.fd(), fd);
+        close(fd);
+    }
+}
+
+void BM_AllocLegacy(benchmark::State &state) {
+    allocFree(state, FAKE_ION_LEGACY, EXYNOS_ION_HEAP_SYSTEM_MASK, 0);
+}
+BENCHMARK(BM_AllocLegacy)->Arg(4096)->Arg(1 << 20);
+
+void BM_AllocModern(benchmark::State &state) {
+    allocFree(state, FAKE_ION_MODERN, EXYNOS_ION_HEAP_SYSTEM_MASK, 0);
+}
+BENCHMARK(BM_AllocModern)->Arg(4096)->Arg(1 << 20);
+
+// Every allocation fails on the video frame heap and falls back to the system heap
+void BM_AllocModernFallback(benchmark::State &state) {
+    allocFree(state, FAKE_ION_MODERN, EXYNOS_ION_HEAP_VIDEO_FRAME_MASK,
+              1u << FAKE_ION_MODERN_VIDEO_FRAME_ID);
+}
+BENCHMARK(BM_AllocModernFallback)->Arg(4096)->Arg(1 << 20);
+
+// Imports a buffer into a handle and frees it again, as a client of another
+// process's buffer does
+void importFree(benchmark::State &state, int version) {
+    FakeIon ion(version);
+    int fd = exynos_ion_alloc(ion.fd(), 4096, EXYNOS_ION_HEAP_SYSTEM_MASK, 0);
+
+    if (fd < 0) {
+        state.SkipWithError("allocation failed");
+        return;
+    }
+
+    for (auto _ : state) {
+        int handle;
+        if (exynos_ion_import_handle(ion.fd(), fd, &handle)) {
+            state.SkipWithError("import failed");
+            break;
+        }
+        exynos_ion_free_handle(ion.fd(), handle);
+    }
+
+    close(fd);
+}
+
+void BM_ImportFreeLegacy(benchmark::State &state) {
+    importFree(state, FAKE_ION_LEGACY);
+}
+BENCHMARK(BM_ImportFreeLegacy);
+
+void BM_ImportFreeModern(benchmark::State &state) {
+    importFree(state, FAKE_ION_MODERN);
+}
+BENCHMARK(BM_ImportFreeModern);
+
+// Only the free and close of a buffer; the allocation is not timed
+void freeOnly(benchmark::State &state, int version) {
+    FakeIon ion(version);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        int fd = exynos_ion_alloc(ion.fd(), 4096, EXYNOS_ION_HEAP_SYSTEM_MASK, 0);
+        state.ResumeTiming();
+        if (fd < 0) {
+            state.SkipWithError("allocation failed");
+            break;
+        }
+        exynos_ion_free_handle(ion.fd(), fd);
+        close(fd);
+    }
+}
+
+void BM_FreeLegacy(benchmark::State &state) {
+    freeOnly(state, FAKE_ION_LEGACY);
+}
+BENCHMARK(BM_FreeLegacy);
+
+void BM_FreeModern(benchmark::State &state) {
+    freeOnly(state, FAKE_ION_MODERN);
+}
+BENCHMARK(BM_FreeModern);
+
+void syncStartEnd(benchmark::State &state, int version) {
+    FakeIon ion(version);
+    const int direction = ION_SYNC_READ | ION_SYNC_WRITE;
+    int fd = exynos_ion_alloc(ion.fd(), 4096, EXYNOS_ION_HEAP_SYSTEM_MASK, ION_FLAG_CACHED);
+
+    if (fd < 0) {
+        state.SkipWithError("allocation failed");
+        return;
+    }
+
+    for (auto _ : state) {
+        if (exynos_ion_sync_start(ion.fd(), fd, direction) ||
+                exynos_ion_sync_end(ion.fd(), fd, direction)) {
+            state.SkipWithError("sync failed");
+            break;
+        }
+    }
+
+    exynos_ion_free_handle(ion.fd(), fd);
+    close(fd);
+}
+
+void BM_SyncLegacy(benchmark::State &state) {
+    syncStartEnd(state, FAKE_ION_LEGACY);
+}
+BENCHMARK(BM_SyncLegacy);
+
+void BM_SyncModern(benchmark::State &state) {
+    syncStartEnd(state, FAKE_ION_MODERN);
+}
+BENCHMARK(BM_SyncModern);
+
+void BM_AllocBatch(benchmark::State &state) {
+    FakeIon ion(FAKE_ION_MODERN);
+    const unsigned int count = static_cast<unsigned int>(state.range(0));
+    size_t lens[MAX_BUFCON_BUFS];
+    int fds[MAX_BUFCON_BUFS];
+
+    if (ion.fd() < 0) {
+        state.SkipWithError("unable to open the fake ION device");
+        return;
+    }
+    for (unsigned int i = 0; i < count; i++)
+        lens[i] = 4096;
+
+    for (auto _ : state) {
+        if (exynos_ion_alloc_batch(ion.fd(), lens, count, EXYNOS_ION_HEAP_SYSTEM_MASK, 0, fds)) {
+            state.SkipWithError("allocation failed");
+            break;
+        }
+        for (unsigned int i = 0; i < count; i++) {
+            exynos_ion_free_handle(ion.fd(), fds[i]);
+            close(fds[i]);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_AllocBatch)->Arg(2)->Arg(MAX_BUFCON_BUFS);
+
+// A warm pool, where every get is served from a free list
+void BM_PoolGetPut(benchmark::State &state) {
+    FakeIon ion(FAKE_ION_MODERN);
+    static const size_t classes[] = {4096, 65536, 1 << 20};
+    const size_t len = static_cast<size_t>(state.range(0));
+    struct exynos_ion_pool *pool = exynos_ion_pool_create(
+            ion.fd(), EXYNOS_ION_HEAP_SYSTEM_MASK, ION_FLAG_NOZEROED, classes, 3, 1, 4);
+
+    if (!pool) {
+        state.SkipWithError("unable to create the pool");
+        return;
+    }
+
+    for (auto _ : state) {
+        int fd = exynos_ion_pool_get(pool, len);
+        if (fd < 0) {
+            state.SkipWithError("allocation failed");
+            break;
+        }
+        exynos_ion_pool_put(pool, fd);
+    }
+
+    exynos_ion_pool_destroy(pool);
+}
+BENCHMARK(BM_PoolGetPut)->Arg(4096)->Arg(1 << 20);
+
+// Starts and ends CPU access to the first 4 KB of buffers of growing size.
+// DMA_BUF_IOCTL_SYNC has no range, so on modern ION every partial sync
+// flushes the whole buffer; on the kernel the cost follows the buffer size.
+// The fake device does no cache maintenance and only leaves libion's share.
+void syncPartial(benchmark::State &state, int ion_fd) {
+    const size_t len = static_cast<size_t>(state.range(0));
+    const int direction = ION_SYNC_READ | ION_SYNC_WRITE;
+    int fd = exynos_ion_alloc(ion_fd, len, EXYNOS_ION_HEAP_SYSTEM_MASK, ION_FLAG_CACHED);
+
+    if (fd < 0) {
+        state.SkipWithError("allocation failed");
+        return;
+    }
+
+    for (auto _ : state) {
+        if (exynos_ion_sync_start_partial(ion_fd, fd, direction, 0, 4096) ||
+                exynos_ion_sync_end_partial(ion_fd, fd, direction, 0, 4096)) {
+            state.SkipWithError("sync failed");
+            break;
+        }
+    }
+
+    exynos_ion_free_handle(ion_fd, fd);
+    close(fd);
+}
+
+void BM_SyncPartialLegacy(benchmark::State &state) {
+    FakeIon ion(FAKE_ION_LEGACY);
+    syncPartial(state, ion.fd());
+}
+BENCHMARK(BM_SyncPartialLegacy)->RangeMultiplier(16)->Range(4096, 16 << 20);
+
+void BM_SyncPartialModern(benchmark::State &state) {
+    FakeIon ion(FAKE_ION_MODERN);
+    syncPartial(state, ion.fd());
+}
+BENCHMARK(BM_SyncPartialModern)->RangeMultiplier(16)->Range(4096, 16 << 20);
+
+void BM_SyncPartialKernel(benchmark::State &state) {
+    int ion_fd = exynos_ion_open();
+
+    syncPartial(state, ion_fd);
+    exynos_ion_close(ion_fd);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    int ion_fd = exynos_ion_open();
+
+    if (ion_fd >= 0) {
+        exynos_ion_close(ion_fd);
+        benchmark::RegisterBenchmark("BM_SyncPartialKernel", BM_SyncPartialKernel)
+                ->RangeMultiplier(16)
+                ->Range(4096, 16 << 20);
+    }
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+
+    return 0;
+}
@@ -0,0 +1,514 @@
+/*
+ *  ion_test.cpp
+ *
+ *   Copyright 2018 Samsung Electronics Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <gtest/gtest.h>
+
+#include <hardware/exynos/ion.h>
+#include <hardware/exynos/ion_pool.h>
+
+#include "fake_ion.h"
+
+namespace {
+
+bool isOpen(int fd) {
+    return fcntl(fd, F_GETFD) >= 0;
+}
+
+class IonTest : public ::testing::Test {
+  protected:
+    void install(int version) {
+        fake_ion_install(version);
+        mIonFd = exynos_ion_open();
+        ASSERT_GE(mIonFd, 0);
+    }
+
+    void TearDown() override {
+        if (mIonFd >= 0)
+            exynos_ion_close(mIonFd);
+        fake_ion_uninstall();
+    }
+
+    struct fake_ion_counters counters() {
+        struct fake_ion_counters c;
+        fake_ion_get_counters(&c);
+        return c;
+    }
+
+    int mIonFd = -1;
+};
+
+class LegacyIonTest : public IonTest {
+  protected:
+    void SetUp() override { install(FAKE_ION_LEGACY); }
+};
+
+class ModernIonTest : public IonTest {
+  protected:
+    void SetUp() override { install(FAKE_ION_MODERN); }
+};
+
+TEST_F(LegacyIonTest, AllocPassesLegacyHeapMask) {
+    int fd = exynos_ion_alloc(mIonFd, 8192, EXYNOS_ION_HEAP_VIDEO_FRAME_MASK, ION_FLAG_CACHED);
+    ASSERT_GE(fd, 0);
+
+    struct fake_ion_counters c = counters();
+    EXPECT_EQ(c.allocs, 1u);
+    EXPECT_EQ(c.last_heap_id_mask, static_cast<uint32_t>(EXYNOS_ION_HEAP_VIDEO_FRAME_MASK));
+    EXPECT_EQ(c.last_flags, static_cast<uint32_t>(ION_FLAG_CACHED));
+    // the handle is freed as soon as the buffer is shared
+    EXPECT_EQ(c.frees, 1u);
+    EXPECT_EQ(lseek(fd, 0, SEEK_END), 8192);
+
+    close(fd);
+}
+
+TEST_F(LegacyIonTest, ImportAndFreeHandle) {
+    int fd = exynos_ion_alloc(mIonFd, 4096, EXYNOS_ION_HEAP_SYSTEM_MASK, 0);
+    ASSERT_GE(fd, 0);
+
+    int handle;
+    ASSERT_EQ(exynos_ion_import_handle(mIonFd, fd, &handle), 0);
+    EXPECT_GT(handle, 0);
+    EXPECT_EQ(exynos_ion_free_handle(mIonFd, handle), 0);
+    EXPECT_EQ(counters().frees, 2u);
+
+    close(fd);
+}
+
+TEST_F(LegacyIonTest, PartialSyncUsesIonIoctl) {
+    int fd = exynos_ion_alloc(mIonFd, 4096, EXYNOS_ION_HEAP_SYSTEM_MASK, 0);
+    ASSERT_GE(fd, 0);
+
+    EXPECT_EQ(exynos_ion_sync_start_partial(mIonFd, fd, ION_SYNC_READ, 0, 4096), 0);
+    EXPECT_EQ(exynos_ion_sync_end_partial(mIonFd, fd, ION_SYNC_READ, 0, 4096), 0);
+
+    struct fake_ion_counters c = counters();
+    EXPECT_EQ(c.legacy_syncs, 2u);
+    EXPECT_EQ(c.sync_starts + c.sync_ends, 0u);
+
+    close(fd);
+}
+
+TEST_F(ModernIonTest, AllocResolvesHeapByName) {
+    int fd = exynos_ion_alloc(mIonFd, 8192, EXYNOS_ION_HEAP_VIDEO_FRAME_MASK, ION_FLAG_CACHED);
+    ASSERT_GE(fd, 0);
+
+    struct fake_ion_counters c = counters();
+    EXPECT_EQ(c.allocs, 1u);
+    EXPECT_EQ(c.last_heap_id_mask, 1u << FAKE_ION_MODERN_VIDEO_FRAME_ID);
+    EXPECT_EQ(c.last_flags, static_cast<uint32_t>(ION_FLAG_CACHED));
+    EXPECT_EQ(lseek(fd, 0, SEEK_END), 8192);
+
+    EXPECT_EQ(exynos_ion_free_handle(mIonFd, fd), 0);
+    close(fd);
+}
+
+TEST_F(ModernIonTest, AllocFailsForUnknownHeap) {
+    EXPECT_LT(exynos_ion_alloc(mIonFd, 4096, EXYNOS_ION_HEAP_CAMERA_MASK, 0), 0);
+    EXPECT_EQ(counters().allocs, 0u);
+}
+
+TEST_F(ModernIonTest, BatchRollsBackOnFailure) {
+    const size_t lens[] = {4096, 8192, 4096};
+    int fds[3];
+
+    ASSERT_EQ(exynos_ion_alloc_batch(mIonFd, lens, 3, EXYNOS_ION_HEAP_SYSTEM_MASK, 0, fds), 0);
+    for (int fd : fds) {
+        exynos_ion_free_handle(mIonFd, fd);
+        close(fd);
+    }
+
+    fake_ion_set_fail_mask(1u << FAKE_ION_MODERN_SYSTEM_ID);
+    EXPECT_LT(exynos_ion_alloc_batch(mIonFd, lens, 3, EXYNOS_ION_HEAP_SYSTEM_MASK, 0, fds), 0);
+    EXPECT_EQ(counters().allocs, 3u);
+}
+
+TEST_F(ModernIonTest, BatchFallsBackAsAWhole) {
+    const size_t lens[] = {4096, 8192, 4096};
+    int fds[3];
+
+    fake_ion_set_fail_mask(1u << FAKE_ION_MODERN_VIDEO_FRAME_ID);
+    ASSERT_EQ(exynos_ion_alloc_batch(mIonFd, lens, 3, EXYNOS_ION_HEAP_VIDEO_FRAME_MASK, 0, fds),
+              0);
+
+    struct fake_ion_counters c = counters();
+    EXPECT_EQ(c.failed_allocs, 1u);
+    EXPECT_EQ(c.allocs, 3u);
+    EXPECT_EQ(c.last_heap_id_mask, 1u << FAKE_ION_MODERN_SYSTEM_ID);
+
+    for (int fd : fds) {
+        exynos_ion_free_handle(mIonFd, fd);
+        close(fd);
+    }
+}
+
+TEST_F(ModernIonTest, BatchRejectsInvalidArguments) {
+    const size_t lens[] = {4096};
+    int fd;
+
+    EXPECT_LT(exynos_ion_alloc_batch(mIonFd, nullptr, 1, EXYNOS_ION_HEAP_SYSTEM_MASK, 0, &fd), 0);
+    EXPECT_LT(exynos_ion_alloc_batch(mIonFd, lens, 1, EXYNOS_ION_HEAP_SYSTEM_MASK, 0, nullptr), 0);
+    EXPECT_LT(exynos_ion_alloc_batch(mIonFd, lens, 0, EXYNOS_ION_HEAP_SYSTEM_MASK, 0, &fd), 0);
+    EXPECT_EQ(counters().allocs, 0u);
+}
+
+TEST_F(ModernIonTest, ContainerWithoutMergeReturnsBuffers) {
+    const size_t lens[] = {4096, 8192};
+    int container = -2;
+    int fds[2];
+
+    // the fake device has no DMA_BUF_IOCTL_MERGE
+    ASSERT_EQ(exynos_ion_alloc_container(mIonFd, lens, 2, EXYNOS_ION_HEAP_SYSTEM_MASK, 0,
+                                         &container, fds),
+              0);
+    EXPECT_EQ(container, -1);
+    for (int fd : fds) {
+        EXPECT_TRUE(isOpen(fd));
+        exynos_ion_free_handle(mIonFd, fd);
+        close(fd);
+    }
+}
+
+TEST_F(ModernIonTest, FallbackToSystemHeap) {
+    unsigned int used_heap_mask = 0, used_flags = 0;
+
+    fake_ion_set_fail_mask(1u << FAKE_ION_MODERN_VIDEO_FRAME_ID);
+    int fd = exynos_ion_alloc_fallback(mIonFd, 4096, EXYNOS_ION_HEAP_VIDEO_FRAME_MASK,
+                                       ION_FLAG_CACHED | ION_FLAG_NOZEROED,
+                                       &used_heap_mask, &used_flags);
+    ASSERT_GE(fd, 0);
+
+    EXPECT_EQ(used_heap_mask, static_cast<unsigned int>(EXYNOS_ION_HEAP_SYSTEM_MASK));
+    // buffers of the system heap must be zeroed
+    EXPECT_EQ(used_flags, static_cast<unsigned int>(ION_FLAG_CACHED));
+
+    struct fake_ion_counters c = counters();
+    EXPECT_EQ(c.failed_allocs, 1u);
+    EXPECT_EQ(c.allocs, 1u);
+    EXPECT_EQ(c.last_heap_id_mask, 1u << FAKE_ION_MODERN_SYSTEM_ID);
+
+    exynos_ion_free_handle(mIonFd, fd);
+    close(fd);
+}
+
+TEST_F(ModernIonTest, NoFallbackForProtectedBuffers) {
+    fake_ion_set_fail_mask(1u << FAKE_ION_MODERN_VIDEO_FRAME_ID);
+    EXPECT_LT(exynos_ion_alloc(mIonFd, 4096, EXYNOS_ION_HEAP_VIDEO_FRAME_MASK,
+                               ION_FLAG_PROTECTED), 0);
+
+    struct fake_ion_counters c = counters();
+    EXPECT_EQ(c.failed_allocs, 1u);
+    EXPECT_EQ(c.allocs, 0u);
+}
+
+TEST_F(ModernIonTest, FallbackGivesUpWhenEveryTierFails) {
+    fake_ion_set_fail_mask((1u << FAKE_ION_MODERN_VIDEO_FRAME_ID) |
+                           (1u << FAKE_ION_MODERN_SYSTEM_ID));
+    EXPECT_LT(exynos_ion_alloc(mIonFd, 4096, EXYNOS_ION_HEAP_VIDEO_FRAME_MASK, 0), 0);
+    EXPECT_EQ(counters().failed_allocs, 2u);
+}
+
+class IonPoolTest : public ModernIonTest {
+  protected:
+    void SetUp() override {
+        ModernIonTest::SetUp();
+        static const size_t classes[] = {4096, 16384};
+        mPool = exynos_ion_pool_create(mIonFd, EXYNOS_ION_HEAP_VIDEO_FRAME_MASK,
+                                       ION_FLAG_NOZEROED, classes, 2, 1, 4);
+        ASSERT_NE(mPool, nullptr);
+    }
+
+    void TearDown() override {
+        if (mPool)
+            exynos_ion_pool_destroy(mPool);
+        ModernIonTest::TearDown();
+    }
+
+    struct exynos_ion_pool_stats stats() {
+        struct exynos_ion_pool_stats s;
+        exynos_ion_pool_get_stats(mPool, &s);
+        return s;
+    }
+
+    struct exynos_ion_pool *mPool = nullptr;
+};
+
+TEST_F(IonPoolTest, RecyclesOwnBuffers) {
+    int fd = exynos_ion_pool_get(mPool, 100);
+    ASSERT_GE(fd, 0);
+    EXPECT_EQ(lseek(fd, 0, SEEK_END), 4096);
+    exynos_ion_pool_put(mPool, fd);
+
+    EXPECT_EQ(exynos_ion_pool_get(mPool, 4096), fd);
+    EXPECT_EQ(counters().allocs, 1u);
+
+    struct exynos_ion_pool_stats s = stats();
+    EXPECT_EQ(s.gets, 2u);
+    EXPECT_EQ(s.hits, 1u);
+    EXPECT_EQ(s.puts, 1u);
+
+    exynos_ion_pool_put(mPool, fd);
+    EXPECT_EQ(stats().buffers_cached, 1u);
+}
+
+TEST_F(IonPoolTest, ClosesForeignBuffers) {
+    int fd = exynos_ion_alloc(mIonFd, 4096, EXYNOS_ION_HEAP_VIDEO_FRAME_MASK, ION_FLAG_NOZEROED);
+    ASSERT_GE(fd, 0);
+
+    exynos_ion_pool_put(mPool, fd);
+    EXPECT_FALSE(isOpen(fd));
+
+    struct exynos_ion_pool_stats s = stats();
+    EXPECT_EQ(s.rejected, 1u);
+    EXPECT_EQ(s.buffers_cached, 0u);
+}
+
+TEST_F(IonPoolTest, ClosesFallbackBuffers) {
+    fake_ion_set_fail_mask(1u << FAKE_ION_MODERN_VIDEO_FRAME_ID);
+    int fd = exynos_ion_pool_get(mPool, 8192);
+    ASSERT_GE(fd, 0);
+    fake_ion_set_fail_mask(0);
+
+    // a zeroed system heap buffer must not be handed out as a pool buffer
+    exynos_ion_pool_put(mPool, fd);
+    EXPECT_FALSE(isOpen(fd));
+    EXPECT_EQ(stats().rejected, 1u);
+}
+
+TEST_F(IonPoolTest, TrimReleasesCachedBuffers) {
+    int fds[3];
+
+    for (int &fd : fds) {
+        fd = exynos_ion_pool_get(mPool, 4096);
+        ASSERT_GE(fd, 0);
+    }
+    for (int fd : fds)
+        exynos_ion_pool_put(mPool, fd);
+    EXPECT_EQ(stats().buffers_cached, 3u);
+
+    exynos_ion_pool_trim(mPool, EXYNOS_ION_POOL_TRIM_MODERATE);
+    EXPECT_EQ(stats().buffers_cached, 1u);
+    exynos_ion_pool_trim(mPool, EXYNOS_ION_POOL_TRIM_COMPLETE);
+    EXPECT_EQ(stats().buffers_cached, 0u);
+}
+
+TEST_F(IonPoolTest, RequiresNoZeroedFlag) {
+    static const size_t classes[] = {4096};
+    EXPECT_EQ(exynos_ion_pool_create(mIonFd, EXYNOS_ION_HEAP_VIDEO_FRAME_MASK, ION_FLAG_CACHED,
+                                     classes, 1, 1, 4),
+              nullptr);
+}
+
+TEST_F(IonPoolTest, CachedBuffersAreNotLeaks) {
+    int nullFd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    ASSERT_GE(nullFd, 0);
+    unsigned int base = exynos_ion_report_leaks(nullFd, 0);
+
+    int fd = exynos_ion_pool_get(mPool, 4096);
+    ASSERT_GE(fd, 0);
+    EXPECT_EQ(exynos_ion_report_leaks(nullFd, 0), base + 1);
+
+    exynos_ion_pool_put(mPool, fd);
+    EXPECT_EQ(exynos_ion_report_leaks(nullFd, 0), base);
+
+    EXPECT_EQ(exynos_ion_pool_get(mPool, 4096), fd);
+    EXPECT_EQ(exynos_ion_report_leaks(nullFd, 0), base + 1);
+
+    exynos_ion_pool_put(mPool, fd);
+    close(nullFd);
+}
+
+class IonTrackerTest : public ModernIonTest {
+  protected:
+    void SetUp() override {
+        ModernIonTest::SetUp();
+        mNullFd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+        ASSERT_GE(mNullFd, 0);
+    }
+
+    void TearDown() override {
+        if (mNullFd >= 0)
+            close(mNullFd);
+        ModernIonTest::TearDown();
+    }
+
+    unsigned int leaks() { return exynos_ion_report_leaks(mNullFd, 0); }
+
+    int mNullFd = -1;
+};
+
+TEST_F(IonTrackerTest, ReportsLiveBuffersUntilFreed) {
+    unsigned int base = leaks();
+
+    int a = exynos_ion_alloc(mIonFd, 4096, EXYNOS_ION_HEAP_SYSTEM_MASK, 0);
+    int b = exynos_ion_alloc(mIonFd, 8192, EXYNOS_ION_HEAP_GPU_BUFFER_MASK, 0);
+    ASSERT_GE(a, 0);
+    ASSERT_GE(b, 0);
+    EXPECT_EQ(exynos_ion_buffer_set_tag(a, "ion_test"), 0);
+    EXPECT_EQ(leaks(), base + 2);
+
+    exynos_ion_free_handle(mIonFd, a);
+    close(a);
+    EXPECT_EQ(leaks(), base + 1);
+
+    exynos_ion_free_handle(mIonFd, b);
+    close(b);
+    EXPECT_EQ(leaks(), base);
+}
+
+TEST_F(IonTrackerTest, SkipsBuffersClosedWithoutFree) {
+    unsigned int base = leaks();
+
+    int fd = exynos_ion_alloc(mIonFd, 4096, EXYNOS_ION_HEAP_SYSTEM_MASK, 0);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    EXPECT_EQ(leaks(), base);
+
+    // a new buffer of another size reusing the fd number is told apart
+    int reused = memfd_create("ion_test", MFD_CLOEXEC);
+    ASSERT_EQ(reused, fd);
+    ASSERT_EQ(ftruncate(reused, 8192), 0);
+    EXPECT_EQ(leaks(), base);
+
+    close(reused);
+}
+
+TEST_F(IonTrackerTest, ImportKeepsRecordOfOwnBuffer) {
+    int fd = exynos_ion_alloc(mIonFd, 4096, EXYNOS_ION_HEAP_SYSTEM_MASK, 0);
+    int handle;
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(exynos_ion_import_handle(mIonFd, fd, &handle), 0);
+
+    int out = memfd_create("ion_test_dump", MFD_CLOEXEC);
+    ASSERT_GE(out, 0);
+    exynos_ion_dump_buffers(out);
+    char buf[4096] = {};
+    ASSERT_GT(pread(out, buf, sizeof(buf) - 1, 0), 0);
+    close(out);
+
+    // still listed under the heap it was allocated from
+    EXPECT_EQ(strstr(buf, "imported:"), nullptr) << buf;
+
+    exynos_ion_free_handle(mIonFd, fd);
+    close(fd);
+}
+
+TEST_F(IonTrackerTest, MinAgeFiltersYoungBuffers) {
+    unsigned int base = exynos_ion_report_leaks(mNullFd, 60 * 60 * 1000);
+
+    int fd = exynos_ion_alloc(mIonFd, 4096, EXYNOS_ION_HEAP_SYSTEM_MASK, 0);
+    ASSERT_GE(fd, 0);
+    EXPECT_EQ(exynos_ion_report_leaks(mNullFd, 60 * 60 * 1000), base);
+
+    exynos_ion_free_handle(mIonFd, fd);
+    close(fd);
+}
+
+class IonSyncTest : public ModernIonTest {
+  protected:
+    void SetUp() override {
+        ModernIonTest::SetUp();
+        mFd = exynos_ion_alloc(mIonFd, 1 << 21, EXYNOS_ION_HEAP_SYSTEM_MASK, 0);
+        ASSERT_GE(mFd, 0);
+    }
+
+    void TearDown() override {
+        if (mFd >= 0) {
+            exynos_ion_free_handle(mIonFd, mFd);
+            close(mFd);
+        }
+        ModernIonTest::TearDown();
+    }
+
+    void expectSyncs(unsigned int starts, unsigned int ends) {
+        struct fake_ion_counters c = counters();
+        EXPECT_EQ(c.sync_starts, starts);
+        EXPECT_EQ(c.sync_ends, ends);
+    }
+
+    int start(int direction, off_t offset, size_t len) {
+        return exynos_ion_sync_start_partial(mIonFd, mFd, direction, offset, len);
+    }
+
+    int end(int direction, off_t offset, size_t len) {
+        return exynos_ion_sync_end_partial(mIonFd, mFd, direction, offset, len);
+    }
+
+    int mFd = -1;
+};
+
+TEST_F(IonSyncTest, DisjointRangesShareOneWindow) {
+    ASSERT_EQ(start(ION_SYNC_READ, 0, 4096), 0);
+    ASSERT_EQ(start(ION_SYNC_READ, 1 << 20, 4096), 0);
+    expectSyncs(1, 0);
+
+    // the window stays open while the first range is still in use
+    ASSERT_EQ(end(ION_SYNC_READ, 1 << 20, 4096), 0);
+    expectSyncs(1, 0);
+    ASSERT_EQ(end(ION_SYNC_READ, 0, 4096), 0);
+    expectSyncs(1, 1);
+}
+
+TEST_F(IonSyncTest, AdjoiningRangesMerge) {
+    ASSERT_EQ(start(ION_SYNC_WRITE, 0, 4096), 0);
+    ASSERT_EQ(start(ION_SYNC_WRITE, 4096, 4096), 0);
+    expectSyncs(1, 0);
+
+    ASSERT_EQ(end(ION_SYNC_WRITE, 0, 4096), 0);
+    expectSyncs(1, 0);
+    ASSERT_EQ(end(ION_SYNC_WRITE, 4096, 4096), 0);
+    expectSyncs(1, 1);
+}
+
+TEST_F(IonSyncTest, NewDirectionSyncsAgain) {
+    ASSERT_EQ(start(ION_SYNC_READ, 0, 4096), 0);
+    ASSERT_EQ(start(ION_SYNC_READ, 0, 4096), 0);
+    expectSyncs(1, 0);
+    ASSERT_EQ(start(ION_SYNC_WRITE, 0, 4096), 0);
+    expectSyncs(2, 0);
+
+    for (int i = 0; i < 3; i++)
+        ASSERT_EQ(end(ION_SYNC_READ, 0, 4096), 0);
+    expectSyncs(2, 1);
+}
+
+TEST_F(IonSyncTest, UnmatchedEndSyncsOnItsOwn) {
+    ASSERT_EQ(end(ION_SYNC_READ, 0, 4096), 0);
+    expectSyncs(0, 1);
+}
+
+TEST_F(IonSyncTest, FreeForgetsTheWindow) {
+    ASSERT_EQ(start(ION_SYNC_READ, 0, 4096), 0);
+    expectSyncs(1, 0);
+
+    int handle;
+    ASSERT_EQ(exynos_ion_free_handle(mIonFd, mFd), 0);
+    ASSERT_EQ(exynos_ion_import_handle(mIonFd, mFd, &handle), 0);
+
+    ASSERT_EQ(start(ION_SYNC_READ, 0, 4096), 0);
+    expectSyncs(2, 0);
+    ASSERT_EQ(end(ION_SYNC_READ, 0, 4096), 0);
+    expectSyncs(2, 1);
+}
+
+}  // namespace